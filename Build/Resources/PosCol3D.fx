@@ -1,6 +1,7 @@
 float4x4 gWorldViewProj : WorldViewProjection;
 Texture2D gDiffuseMap : DiffuseMap;
 Texture2D gNormalMap : NormalMap;
+bool gNormalMapTwoChannel : NormalMapTwoChannel; // BC5 normal maps only store x and y
 Texture2D gSpecularMap : SpecularMap;
 Texture2D gGlossinessMap : GlossinessMap;
 float4x4 gWorldMatrix : World;
@@ -9,6 +10,8 @@ float gShininess : Shininess;
 float3 gAmbient : AmbientLight;
 float3 gLightDirection : LightDirection;
 float gLightIntensity : LightIntensity;
+Texture2D gAccumulationMap : AccumulationMap; // Weighted blended transparency: sum of the weighted, premultiplied transparent fragments
+Texture2D gRevealageMap : RevealageMap; // And the product of their (1 - alpha)
 
 
 // Hardcoded Values
@@ -84,6 +87,28 @@ BlendState gBlendStateOff
 	BlendEnable[0] = false;
 };
 
+// Transparent fragments add up into the accumulation target, and multiply (1 - alpha) into the revealage one, so their order doesn't matter
+BlendState gBlendStateAccumulate
+{
+	IndependentBlendEnable = true;
+	BlendEnable[0] = true;
+	SrcBlend[0] = one;
+	DestBlend[0] = one;
+	BlendOp[0] = add;
+	SrcBlendAlpha[0] = one;
+	DestBlendAlpha[0] = one;
+	BlendOpAlpha[0] = add;
+	RenderTargetWriteMask[0] = 0x0F;
+	BlendEnable[1] = true;
+	SrcBlend[1] = zero;
+	DestBlend[1] = inv_src_color;
+	BlendOp[1] = add;
+	SrcBlendAlpha[1] = zero;
+	DestBlendAlpha[1] = inv_src_alpha;
+	BlendOpAlpha[1] = add;
+	RenderTargetWriteMask[1] = 0x0F;
+};
+
 
 // -----------------
 // DepthStencilState
@@ -134,6 +159,13 @@ DepthStencilState gDepthStencilStateStencilOn
 	BackFaceStencilFail = keep;
 };
 
+DepthStencilState gDepthStencilStateDepthOff
+{
+	DepthEnable = false;
+	DepthWriteMask = zero;
+	StencilEnable = false;
+};
+
 
 // --------------------
 // Input/Output structs
@@ -158,6 +190,12 @@ struct VS_OUTPUT
 	float3 Tangent : TANGENT;
 };
 
+struct PS_TRANSPARENT_OUTPUT
+{
+	float4 Accumulation : SV_TARGET0;
+	float4 Revealage : SV_TARGET1;
+};
+
 
 // -------------
 // Vertex Shader
@@ -174,6 +212,13 @@ VS_OUTPUT VS(VS_INPUT input)
 	return output;
 }
 
+// A triangle that covers the whole screen, made up out of just its vertex indexes
+float4 VSFullScreen(uint vertexId : SV_VertexID) : SV_POSITION
+{
+	const float2 uv = float2((vertexId << 1) & 2, vertexId & 2);
+	return float4(uv * float2(2.f, -2.f) + float2(-1.f, 1.f), 0.f, 1.f);
+}
+
 // -----------------------------
 // Pixel Shaders Helper Function
 // -----------------------------
@@ -181,6 +226,10 @@ float4 Shading(VS_OUTPUT input, float4 difuseSample, float4 normalSample, float4
 {
 	// Remap the normal sample to the correct range [-1,1]
 	float3 remmapedNormal = normalSample.xyz * 2.f - float3(1.f, 1.f, 1.f);
+	
+	// Two channel normal maps leave z out, so rebuild it (the normal is unit length, and always points out of the surface)
+	if (gNormalMapTwoChannel)
+		remmapedNormal.z = sqrt(saturate(1.f - dot(remmapedNormal.xy, remmapedNormal.xy)));
 		
 	// And put it in tangent space
 	const float3 binormal = cross(input.Normal, input.Tangent);
@@ -211,6 +260,17 @@ float4 Shading(VS_OUTPUT input, float4 difuseSample, float4 normalSample, float4
 	return saturate(float4(finalColor, 1.f));
 }
 
+PS_TRANSPARENT_OUTPUT AccumulateTransparent(float4 color, float viewDepth)
+{
+	// Weight the fragment by how close it is (McGuire and Bavoil's equation 7, the same one the Software Mode uses)
+	const float weight = color.a * clamp(10.f / (1e-5f + pow(viewDepth / 5.f, 2.f) + pow(viewDepth / 200.f, 6.f)), 1e-2f, 3e3f);
+	
+	PS_TRANSPARENT_OUTPUT output = (PS_TRANSPARENT_OUTPUT)0;
+	output.Accumulation = float4(color.rgb * color.a, color.a) * weight;
+	output.Revealage = color.aaaa;
+	return output;
+}
+
 // -------------
 // Pixel Shaders
 // -------------
@@ -237,6 +297,12 @@ float4 PSPointDifOnly(VS_OUTPUT input) : SV_TARGET
 	return float4(input.Color, 1.f); // If they aren't, return the predefined color
 }
 
+PS_TRANSPARENT_OUTPUT PSPointTransparent(VS_OUTPUT input)
+{
+	// The w of SV_POSITION is still the view depth
+	return AccumulateTransparent(PSPointDifOnly(input), input.Position.w);
+}
+
 float4 PSLinear(VS_OUTPUT input) : SV_TARGET
 {
 	if(input.UVCoord.x >= 0.f) // Check if the vertex has valid uv coords before sampling
@@ -260,6 +326,12 @@ float4 PSLinearDifOnly(VS_OUTPUT input) : SV_TARGET
 	return float4(input.Color, 1.f); // If they aren't, return the predefined color
 }
 
+PS_TRANSPARENT_OUTPUT PSLinearTransparent(VS_OUTPUT input)
+{
+	// The w of SV_POSITION is still the view depth
+	return AccumulateTransparent(PSLinearDifOnly(input), input.Position.w);
+}
+
 float4 PSAnisotropic(VS_OUTPUT input) : SV_TARGET
 {
 	if(input.UVCoord.x >= 0.f) // Check if the vertex has valid uv coords before sampling
@@ -283,6 +355,25 @@ float4 PSAnisotropicDifOnly(VS_OUTPUT input) : SV_TARGET
 	return float4(input.Color, 1.f); // If they aren't, return the predefined color
 }
 
+PS_TRANSPARENT_OUTPUT PSAnisotropicTransparent(VS_OUTPUT input)
+{
+	// The w of SV_POSITION is still the view depth
+	return AccumulateTransparent(PSAnisotropicDifOnly(input), input.Position.w);
+}
+
+float4 PSComposite(float4 position : SV_POSITION) : SV_TARGET
+{
+	// Pixels without any transparent fragments are left alone
+	const int3 pixel = int3(position.xy, 0);
+	const float revealage = gRevealageMap.Load(pixel).r;
+	if (revealage >= 1.f)
+		discard;
+	
+	// The average color of the fragments covers as much of the opaque color as the revealage took away from it (blended as src_alpha, inv_src_alpha)
+	const float4 accumulation = gAccumulationMap.Load(pixel);
+	return float4(accumulation.rgb / max(accumulation.a, 1e-5f), 1.f - revealage);
+}
+
 
 // ----------
 // Techniques
@@ -332,10 +423,10 @@ technique11 TransparentPointTechnique
 	{
 		SetRasterizerState(gRasterizerStateNoCull);
 		SetDepthStencilState(gDepthStencilStateStencilOff, 0);
-		SetBlendState(gBlendStateOn, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetBlendState(gBlendStateAccumulate, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
 		SetVertexShader( CompileShader( vs_5_0, VS() ) );
 		SetGeometryShader( NULL );
-		SetPixelShader( CompileShader( ps_5_0, PSPointDifOnly() ) );
+		SetPixelShader( CompileShader( ps_5_0, PSPointTransparent() ) );
 	}
 }
 
@@ -384,10 +475,10 @@ technique11 TransparentLinearTechnique
 	{
 		SetRasterizerState(gRasterizerStateNoCull);
 		SetDepthStencilState(gDepthStencilStateStencilOff, 0);
-		SetBlendState(gBlendStateOn, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetBlendState(gBlendStateAccumulate, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
 		SetVertexShader( CompileShader( vs_5_0, VS() ) );
 		SetGeometryShader( NULL );
-		SetPixelShader( CompileShader( ps_5_0, PSLinearDifOnly() ) );
+		SetPixelShader( CompileShader( ps_5_0, PSLinearTransparent() ) );
 	}
 }
 
@@ -436,9 +527,22 @@ technique11 TransparentAnisotropicTechnique
 	{
 		SetRasterizerState(gRasterizerStateNoCull);
 		SetDepthStencilState(gDepthStencilStateStencilOff, 0);
-		SetBlendState(gBlendStateOn, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetBlendState(gBlendStateAccumulate, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
 		SetVertexShader( CompileShader( vs_5_0, VS() ) );
 		SetGeometryShader( NULL );
-		SetPixelShader( CompileShader( ps_5_0, PSAnisotropicDifOnly() ) );
+		SetPixelShader( CompileShader( ps_5_0, PSAnisotropicTransparent() ) );
+	}
+}
+
+technique11 TransparentCompositeTechnique
+{
+	pass P0
+	{
+		SetRasterizerState(gRasterizerStateNoCull);
+		SetDepthStencilState(gDepthStencilStateDepthOff, 0);
+		SetBlendState(gBlendStateOn, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetVertexShader( CompileShader( vs_5_0, VSFullScreen() ) );
+		SetGeometryShader( NULL );
+		SetPixelShader( CompileShader( ps_5_0, PSComposite() ) );
 	}
 }
\ No newline at end of file
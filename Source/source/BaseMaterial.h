@@ -19,6 +19,7 @@ public:
 	void SetShininess(float shininess) const;
 	virtual void SetDiffuseMap(ID3D11ShaderResourceView* pResourceView) const {}
 	virtual void SetNormalMap(ID3D11ShaderResourceView* pResourceView) const {}
+	virtual void SetNormalMapTwoChannel(bool isTwoChannel) const {}
 	virtual void SetSpecularMap(ID3D11ShaderResourceView* pResourceView) const {}
 	virtual void SetGlossinessMap(ID3D11ShaderResourceView* pResourceView) const {}
 	virtual void SetWorldMatrix(float* pMatrix) const {}
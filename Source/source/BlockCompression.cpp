@@ -0,0 +1,391 @@
+#include "pch.h"
+#include "BlockCompression.h"
+
+#include <cfloat>
+#include <cmath>
+
+// The 2 endpoint colors of a color block are stored as RGB565
+static uint16_t ToRGB565(const float* pColor)
+{
+	const auto r = static_cast<uint32_t>(Elite::Clamp(pColor[0], 0.f, 255.f) * 31.f / 255.f + 0.5f);
+	const auto g = static_cast<uint32_t>(Elite::Clamp(pColor[1], 0.f, 255.f) * 63.f / 255.f + 0.5f);
+	const auto b = static_cast<uint32_t>(Elite::Clamp(pColor[2], 0.f, 255.f) * 31.f / 255.f + 0.5f);
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static uint32_t FromRGB565(uint32_t color)
+{
+	// Repeat the top bits in the bottom ones, so 0 stays 0 and the highest value becomes 255
+	const uint32_t r = (color >> 11) & 0x1F;
+	const uint32_t g = (color >> 5) & 0x3F;
+	const uint32_t b = color & 0x1F;
+	return ((r << 3) | (r >> 2)) | (((g << 2) | (g >> 4)) << 8) | (((b << 3) | (b >> 2)) << 16) | 0xFF000000;
+}
+
+static void GetColorPalette(uint32_t color0, uint32_t color1, bool allowTransparency, uint32_t* pPalette)
+{
+	pPalette[0] = FromRGB565(color0);
+	pPalette[1] = FromRGB565(color1);
+
+	// The other 2 colors lie at a third and two thirds from the first endpoint to the second one,
+	// unless a BC1 block stores its smallest endpoint first: then it's the color halfway between them, and transparent black
+	if (color0 > color1 || !allowTransparency)
+	{
+		pPalette[2] = 0xFF000000;
+		pPalette[3] = 0xFF000000;
+		for (uint32_t channel = 0; channel < 3; ++channel)
+		{
+			const uint32_t shift = channel * 8;
+			const uint32_t value0 = (pPalette[0] >> shift) & 0xFF;
+			const uint32_t value1 = (pPalette[1] >> shift) & 0xFF;
+			pPalette[2] |= ((2 * value0 + value1 + 1) / 3) << shift;
+			pPalette[3] |= ((value0 + 2 * value1 + 1) / 3) << shift;
+		}
+	}
+	else
+	{
+		pPalette[2] = 0xFF000000;
+		for (uint32_t channel = 0; channel < 3; ++channel)
+		{
+			const uint32_t shift = channel * 8;
+			pPalette[2] |= ((((pPalette[0] >> shift) & 0xFF) + ((pPalette[1] >> shift) & 0xFF) + 1) / 2) << shift;
+		}
+		pPalette[3] = 0;
+	}
+}
+
+static float ChooseColorIndices(const float colors[16][3], uint32_t color0, uint32_t color1, uint32_t& indices)
+{
+	// Every texel gets the closest of the 4 palette colors (2 bits each), returning the total squared error
+	uint32_t palette[4];
+	GetColorPalette(color0, color1, false, palette);
+
+	float error = 0.f;
+	indices = 0;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		float bestDistance = FLT_MAX;
+		uint32_t bestIdx = 0;
+		for (uint32_t paletteIdx = 0; paletteIdx < 4; ++paletteIdx)
+		{
+			float distance = 0.f;
+			for (uint32_t channel = 0; channel < 3; ++channel)
+			{
+				const float difference = colors[i][channel] - static_cast<float>((palette[paletteIdx] >> (channel * 8)) & 0xFF);
+				distance += difference * difference;
+			}
+
+			if (distance < bestDistance)
+			{
+				bestDistance = distance;
+				bestIdx = paletteIdx;
+			}
+		}
+		indices |= bestIdx << (i * 2);
+		error += bestDistance;
+	}
+	return error;
+}
+
+static bool FitColorEndpoints(const float colors[16][3], uint32_t indices, float* pEndpoint0, float* pEndpoint1)
+{
+	// Every texel is (weight * endpoint0 + (1 - weight) * endpoint1), so with the indices fixed,
+	// the endpoints that fit the colors best are the least squares solution of a 2x2 system
+	static const float weights[4]{ 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+	float sumWeight0 = 0.f, sumWeight01 = 0.f, sumWeight1 = 0.f;
+	float sumColor0[3]{}, sumColor1[3]{};
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		const float weight = weights[(indices >> (i * 2)) & 3];
+		sumWeight0 += weight * weight;
+		sumWeight01 += weight * (1.f - weight);
+		sumWeight1 += (1.f - weight) * (1.f - weight);
+		for (uint32_t channel = 0; channel < 3; ++channel)
+		{
+			sumColor0[channel] += weight * colors[i][channel];
+			sumColor1[channel] += (1.f - weight) * colors[i][channel];
+		}
+	}
+
+	// All texels on the same endpoint, there's nothing to solve
+	const float determinant = sumWeight0 * sumWeight1 - sumWeight01 * sumWeight01;
+	if (std::abs(determinant) < 1e-6f)
+		return false;
+
+	for (uint32_t channel = 0; channel < 3; ++channel)
+	{
+		pEndpoint0[channel] = (sumColor0[channel] * sumWeight1 - sumColor1[channel] * sumWeight01) / determinant;
+		pEndpoint1[channel] = (sumColor1[channel] * sumWeight0 - sumColor0[channel] * sumWeight01) / determinant;
+	}
+	return true;
+}
+
+static void EncodeColorBlock(const uint32_t* pTexels, uint8_t* pBlock)
+{
+	float colors[16][3];
+	float mean[3]{};
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		for (uint32_t channel = 0; channel < 3; ++channel)
+		{
+			colors[i][channel] = static_cast<float>((pTexels[i] >> (channel * 8)) & 0xFF);
+			mean[channel] += colors[i][channel] / 16.f;
+		}
+	}
+
+	// The axis the colors are spread along the most (the principal axis of their covariance, through a few power iterations),
+	// starting from the covariance's column of the channel that varies the most
+	float covariance[3][3]{};
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		for (uint32_t row = 0; row < 3; ++row)
+		{
+			for (uint32_t column = 0; column < 3; ++column)
+				covariance[row][column] += (colors[i][row] - mean[row]) * (colors[i][column] - mean[column]);
+		}
+	}
+
+	uint32_t startChannel = 0;
+	for (uint32_t channel = 1; channel < 3; ++channel)
+	{
+		if (covariance[channel][channel] > covariance[startChannel][startChannel])
+			startChannel = channel;
+	}
+	float axis[3]{ covariance[0][startChannel], covariance[1][startChannel], covariance[2][startChannel] };
+	for (uint32_t iteration = 0; iteration < 4; ++iteration)
+	{
+		float nextAxis[3]{};
+		for (uint32_t row = 0; row < 3; ++row)
+			nextAxis[row] = covariance[row][0] * axis[0] + covariance[row][1] * axis[1] + covariance[row][2] * axis[2];
+
+		// Only the direction matters, so just keep it from overflowing
+		const float largest = std::max(std::abs(nextAxis[0]), std::max(std::abs(nextAxis[1]), std::abs(nextAxis[2])));
+		if (largest <= 0.f)
+			break;
+		for (uint32_t row = 0; row < 3; ++row)
+			axis[row] = nextAxis[row] / largest;
+	}
+
+	// The endpoints are the 2 colors furthest apart along it (a single colored block just gets its mean for both)
+	float endpoint0[3]{ mean[0], mean[1], mean[2] };
+	float endpoint1[3]{ mean[0], mean[1], mean[2] };
+	float minProjection = FLT_MAX, maxProjection = -FLT_MAX;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		const float projection = colors[i][0] * axis[0] + colors[i][1] * axis[1] + colors[i][2] * axis[2];
+		if (projection < minProjection)
+		{
+			minProjection = projection;
+			std::copy(colors[i], colors[i] + 3, endpoint1);
+		}
+		if (projection > maxProjection)
+		{
+			maxProjection = projection;
+			std::copy(colors[i], colors[i] + 3, endpoint0);
+		}
+	}
+
+	uint32_t color0 = ToRGB565(endpoint0);
+	uint32_t color1 = ToRGB565(endpoint1);
+	uint32_t indices = 0;
+	const float error = ChooseColorIndices(colors, color0, color1, indices);
+
+	// Move the endpoints to where they fit the colors best with the indices just picked, and keep that if it's better
+	if (FitColorEndpoints(colors, indices, endpoint0, endpoint1))
+	{
+		const uint32_t fittedColor0 = ToRGB565(endpoint0);
+		const uint32_t fittedColor1 = ToRGB565(endpoint1);
+		uint32_t fittedIndices = 0;
+		if (ChooseColorIndices(colors, fittedColor0, fittedColor1, fittedIndices) < error)
+		{
+			color0 = fittedColor0;
+			color1 = fittedColor1;
+			indices = fittedIndices;
+		}
+	}
+
+	// The first endpoint has to be the biggest one, for the decoder to pick the 4 color palette (swapping them swaps indices 0 with 1 and 2 with 3)
+	if (color0 < color1)
+	{
+		std::swap(color0, color1);
+		indices ^= 0x55555555;
+	}
+	else if (color0 == color1)
+	{
+		indices = 0;
+	}
+
+	pBlock[0] = static_cast<uint8_t>(color0);
+	pBlock[1] = static_cast<uint8_t>(color0 >> 8);
+	pBlock[2] = static_cast<uint8_t>(color1);
+	pBlock[3] = static_cast<uint8_t>(color1 >> 8);
+	for (uint32_t i = 0; i < 4; ++i)
+		pBlock[4 + i] = static_cast<uint8_t>(indices >> (i * 8));
+}
+
+static void DecodeColorBlock(const uint8_t* pBlock, bool allowTransparency, uint32_t* pTexels)
+{
+	uint32_t palette[4];
+	GetColorPalette(pBlock[0] | (pBlock[1] << 8), pBlock[2] | (pBlock[3] << 8), allowTransparency, palette);
+
+	const uint32_t indices = pBlock[4] | (pBlock[5] << 8) | (pBlock[6] << 16) | (uint32_t(pBlock[7]) << 24);
+	for (uint32_t i = 0; i < 16; ++i)
+		pTexels[i] = palette[(indices >> (i * 2)) & 3];
+}
+
+static void GetChannelPalette(uint32_t value0, uint32_t value1, uint32_t* pPalette)
+{
+	pPalette[0] = value0;
+	pPalette[1] = value1;
+
+	// With the biggest endpoint first, the other 6 values are spread evenly between them,
+	// otherwise it's only 4 of them, plus 0 and 255
+	if (value0 > value1)
+	{
+		for (uint32_t i = 1; i < 7; ++i)
+			pPalette[i + 1] = ((7 - i) * value0 + i * value1 + 3) / 7;
+	}
+	else
+	{
+		for (uint32_t i = 1; i < 5; ++i)
+			pPalette[i + 1] = ((5 - i) * value0 + i * value1 + 2) / 5;
+		pPalette[6] = 0;
+		pPalette[7] = 255;
+	}
+}
+
+static void EncodeChannelBlock(const uint32_t* pTexels, uint32_t shift, uint8_t* pBlock)
+{
+	// The block's lowest and highest value are the endpoints (biggest first, for the palette with 6 values in between)
+	uint32_t values[16];
+	uint32_t minValue = 255, maxValue = 0;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		values[i] = (pTexels[i] >> shift) & 0xFF;
+		minValue = std::min(minValue, values[i]);
+		maxValue = std::max(maxValue, values[i]);
+	}
+
+	uint32_t palette[8];
+	GetChannelPalette(maxValue, minValue, palette);
+
+	// And every texel gets the closest value of the palette (3 bits each)
+	uint64_t indices = 0;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		uint32_t bestIdx = 0;
+		for (uint32_t paletteIdx = 1; paletteIdx < 8; ++paletteIdx)
+		{
+			if (std::abs(int(values[i]) - int(palette[paletteIdx])) < std::abs(int(values[i]) - int(palette[bestIdx])))
+				bestIdx = paletteIdx;
+		}
+		indices |= uint64_t(bestIdx) << (i * 3);
+	}
+
+	pBlock[0] = static_cast<uint8_t>(maxValue);
+	pBlock[1] = static_cast<uint8_t>(minValue);
+	for (uint32_t i = 0; i < 6; ++i)
+		pBlock[2 + i] = static_cast<uint8_t>(indices >> (i * 8));
+}
+
+static void DecodeChannelBlock(const uint8_t* pBlock, uint32_t* pValues)
+{
+	uint32_t palette[8];
+	GetChannelPalette(pBlock[0], pBlock[1], palette);
+
+	uint64_t indices = 0;
+	for (uint32_t i = 0; i < 6; ++i)
+		indices |= uint64_t(pBlock[2 + i]) << (i * 8);
+	for (uint32_t i = 0; i < 16; ++i)
+		pValues[i] = palette[(indices >> (i * 3)) & 7];
+}
+
+uint32_t BlockCompression::GetBlockBytes(TextureFormat format)
+{
+	switch (format)
+	{
+	case TextureFormat::BC1:
+		return 8;
+	case TextureFormat::BC3:
+	case TextureFormat::BC5:
+		return 16;
+	default:
+		return 16 * sizeof(uint32_t);
+	}
+}
+
+DXGI_FORMAT BlockCompression::GetDXGIFormat(TextureFormat format)
+{
+	switch (format)
+	{
+	case TextureFormat::BC1:
+		return DXGI_FORMAT_BC1_UNORM;
+	case TextureFormat::BC3:
+		return DXGI_FORMAT_BC3_UNORM;
+	case TextureFormat::BC5:
+		return DXGI_FORMAT_BC5_UNORM;
+	default:
+		return DXGI_FORMAT_R8G8B8A8_UNORM;
+	}
+}
+
+void BlockCompression::EncodeBlock(TextureFormat format, const uint32_t* pTexels, uint8_t* pBlock)
+{
+	switch (format)
+	{
+	case TextureFormat::BC1:
+		EncodeColorBlock(pTexels, pBlock);
+		break;
+	case TextureFormat::BC3:
+		// The alpha block comes first
+		EncodeChannelBlock(pTexels, 24, pBlock);
+		EncodeColorBlock(pTexels, pBlock + 8);
+		break;
+	case TextureFormat::BC5:
+		EncodeChannelBlock(pTexels, 0, pBlock);
+		EncodeChannelBlock(pTexels, 8, pBlock + 8);
+		break;
+	default:
+		std::copy(pTexels, pTexels + 16, reinterpret_cast<uint32_t*>(pBlock));
+		break;
+	}
+}
+
+void BlockCompression::DecodeBlock(TextureFormat format, const uint8_t* pBlock, uint32_t* pTexels)
+{
+	switch (format)
+	{
+	case TextureFormat::BC1:
+		DecodeColorBlock(pBlock, true, pTexels);
+		break;
+	case TextureFormat::BC3:
+	{
+		// The color block of BC3 always has the 4 color palette, the alpha comes out of its own block
+		uint32_t alphas[16];
+		DecodeChannelBlock(pBlock, alphas);
+		DecodeColorBlock(pBlock + 8, false, pTexels);
+		for (uint32_t i = 0; i < 16; ++i)
+			pTexels[i] = (pTexels[i] & 0x00FFFFFF) | (alphas[i] << 24);
+		break;
+	}
+	case TextureFormat::BC5:
+	{
+		// Rebuild the z of the unit length normal out of x and y (it always points out of the surface)
+		uint32_t reds[16], greens[16];
+		DecodeChannelBlock(pBlock, reds);
+		DecodeChannelBlock(pBlock + 8, greens);
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			const float x = static_cast<float>(reds[i]) * (2.f / 255.f) - 1.f;
+			const float y = static_cast<float>(greens[i]) * (2.f / 255.f) - 1.f;
+			const float z = sqrtf(std::max(1.f - x * x - y * y, 0.f));
+			const auto blue = static_cast<uint32_t>((z * 0.5f + 0.5f) * 255.f + 0.5f);
+			pTexels[i] = reds[i] | (greens[i] << 8) | (blue << 16) | 0xFF000000;
+		}
+		break;
+	}
+	default:
+		std::copy(reinterpret_cast<const uint32_t*>(pBlock), reinterpret_cast<const uint32_t*>(pBlock) + 16, pTexels);
+		break;
+	}
+}
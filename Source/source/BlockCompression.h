@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+
+// How a texture keeps its texels, both in video memory and in the Software Mode
+// The BCn formats compress every 4x4 block of texels into a fixed amount of bytes, which DirectX samples as they are
+enum class TextureFormat
+{
+	RGBA8,
+	BC1, // RGB in 8 bytes a block (4 bits per texel), for opaque color and single channel maps
+	BC3, // RGBA in 16 bytes a block (the color like BC1, plus its own block for the alpha)
+	BC5 // Only the red and green channels, each in its own 8 byte block, for normal maps (their z gets rebuilt out of x and y)
+};
+
+namespace BlockCompression
+{
+	uint32_t GetBlockBytes(TextureFormat format);
+	DXGI_FORMAT GetDXGIFormat(TextureFormat format);
+
+	// Compresses a 4x4 block of RGBA8 texels, given row by row
+	void EncodeBlock(TextureFormat format, const uint32_t* pTexels, uint8_t* pBlock);
+	// And turns a block back into its 16 RGBA8 texels, row by row (BC5 blocks get the rebuilt normal z in blue)
+	void DecodeBlock(TextureFormat format, const uint8_t* pBlock, uint32_t* pTexels);
+}
@@ -6,146 +6,179 @@
 
 //Project includes
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <unordered_map>
 
 #include "ETimer.h"
 #include "ERenderer.h"
 #include "ECamera.h"
 #include "Scene.h"
+#include "MappedFile.h"
 #include "Mesh.h"
+#include "MeshCache.h"
+#include "MeshSimplifier.h"
+#include "ObjParser.h"
+#include "VertexCache.h"
 #include "ShadedMaterial.h"
+#include "ThreadPool.h"
 #include "TransparentMaterial.h"
 
 #ifdef _DEBUG
 #include <vld.h>
 #endif
 
-Mesh* ParseOBJFile(const std::string& filePath, ID3D11Device* pDevice, BaseMaterial* pMaterial)
+// Parses the mapped obj file into its full detail geometry, followed by the simpler levels of detail made from it
+bool ParseOBJGeometry(const std::string& filePath, const MappedFile& file, ThreadPool& threadPool, std::vector<std::shared_ptr<const MeshGeometry>>& lods)
 {
-	std::vector<Elite::FPoint3> positions{};
-	std::vector<Elite::FVector2> uvs{};
-	std::vector<Elite::FVector3> normals{};
-
-	std::vector<int> vertexIndices{};
-	std::vector<int> uvIndices{};
-	std::vector<int> normalIndices{};
-
+	std::vector<VS_INPUT> vertexBuffer{};
+	std::vector<uint32_t> indexBuffer{};
 
-	// Open the file
-	std::ifstream in(filePath, std::ios::in);
-	if (!in)
+	// Parse it, spread over the threads
+	ObjData obj{};
+	if (ObjParser::Parse(file.GetData(), file.GetSize(), threadPool, obj) == false)
 	{
-		std::cout << "An error occurred while opening the obj file." << std::endl;
-		return new Mesh(pDevice, std::vector<VS_INPUT>(), std::vector<uint32_t>(), D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, pMaterial);
+		std::cout << "The obj file is not written in a readable format." << std::endl;
+		return false;
 	}
 
-	// Go over every line
-	std::string line;
-	while (std::getline(in, line))
+	// Set up the vertexBuffer and the indexBuffer, with a single vertex for every different position/uv/normal combination the faces use
+	// Each combination is looked up by its hash, and the first corner that had it (a hash collision just leaves the corner as a vertex of its own)
+	const auto& corners = obj.Corners;
+	std::unordered_map<uint64_t, uint32_t> firstVertexWithCorner{};
+	firstVertexWithCorner.reserve(corners.size());
+	std::vector<size_t> vertexCorners{};
+	indexBuffer.reserve(corners.size());
+	for (size_t i = 0; i < corners.size(); i++)
 	{
-		// Save the vertex positions
-		if (line.substr(0, 2) == "v ")
+		const ObjCorner& corner = corners[i];
+		const uint64_t hash = (uint64_t(uint32_t(corner.Position)) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(uint32_t(corner.UV)) * 0xC2B2AE3D27D4EB4Full)
+			^ (uint64_t(uint32_t(corner.Normal)) * 0x165667B19E3779F9ull);
+		const auto result = firstVertexWithCorner.emplace(hash, uint32_t(vertexBuffer.size()));
+		const uint32_t vertex = result.first->second;
+		const ObjCorner& firstCorner = corners[result.second ? i : vertexCorners[vertex]];
+		if (result.second == false && firstCorner.Position == corner.Position && firstCorner.UV == corner.UV && firstCorner.Normal == corner.Normal)
 		{
-			std::istringstream v(line.substr(2));
-			float x, y, z;
-			v >> x;
-			v >> y;
-			v >> z;
-			// Invert the z axis (since it's a Left-Handed Coord System)
-			Elite::FPoint3 vertex(x, y, -z);
-			positions.push_back(vertex);
+			indexBuffer.push_back(vertex);
+			continue;
 		}
 
-		// Save the indexes
-		else if (line.substr(0, 2) == "f ")
-		{
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			const char* chh = line.c_str();
-			sscanf_s(chh, "f %i/%i/%i %i/%i/%i %i/%i/%i", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2]);
-
-			vertexIndices.push_back(vertexIndex[0] - 1);
-			vertexIndices.push_back(vertexIndex[1] - 1);
-			vertexIndices.push_back(vertexIndex[2] - 1);
-			uvIndices.push_back(uvIndex[0] - 1);
-			uvIndices.push_back(uvIndex[1] - 1);
-			uvIndices.push_back(uvIndex[2] - 1);
-			normalIndices.push_back(normalIndex[0] - 1);
-			normalIndices.push_back(normalIndex[1] - 1);
-			normalIndices.push_back(normalIndex[2] - 1);
-		}
+		// (a corner without a uv gets the one that has the mesh use its vertex colors, and one without a normal starts at 0 and gets its faces' normals added up)
+		// (its tangent starts at 0 too, since it's the sum of the tangents of all the faces that share it)
+		const Elite::FVector2 uv = corner.UV != ObjParser::m_Missing ? obj.UVs[corner.UV] : Elite::FVector2{ -10.f, -10.f };
+		const Elite::FVector3 normal = corner.Normal != ObjParser::m_Missing ? obj.Normals[corner.Normal] : Elite::FVector3{};
+		indexBuffer.push_back(uint32_t(vertexBuffer.size()));
+		vertexCorners.push_back(i);
+		vertexBuffer.push_back(VS_INPUT(obj.Positions[corner.Position], Elite::RGBColor{ 1.f, 1.f, 1.f }, uv, normal, Elite::FVector3{}));
+	}
 
-		// Save the normals
-		else if (line.substr(0, 2) == "vn")
-		{
-			std::istringstream vn(line.substr(3));
-			float x, y, z;
-			vn >> x;
-			vn >> y;
-			vn >> z;
-			// Invert the z axis (since it's a Left-Handed Coord System)
-			normals.emplace_back(Elite::FVector3(x, y, -z));
-		}
+	// Add the normals the file left out (weighted by the area of each face, through the length of its cross product)
+	for (size_t i = 0; i < indexBuffer.size(); i += 3)
+	{
+		if (corners[i].Normal != ObjParser::m_Missing && corners[i + 1].Normal != ObjParser::m_Missing && corners[i + 2].Normal != ObjParser::m_Missing)
+			continue;
 
-		// Save the uvs
-		else if (line.substr(0, 2) == "vt")
+		const Elite::FPoint3& p0 = vertexBuffer[indexBuffer[i]].Position;
+		const Elite::FVector3 faceNormal = Elite::Cross(vertexBuffer[indexBuffer[i + 1]].Position - p0, vertexBuffer[indexBuffer[i + 2]].Position - p0);
+		for (size_t corner = i; corner < i + 3; ++corner)
 		{
-			std::istringstream vt(line.substr(3));
-			double u, v;
-			vt >> u;
-			vt >> v;
-			uvs.emplace_back(Elite::FVector2(float(u), float(1.0 - v)));
+			if (corners[corner].Normal == ObjParser::m_Missing)
+				vertexBuffer[indexBuffer[corner]].Normal += faceNormal;
 		}
 	}
+	for (size_t v = 0; v < vertexBuffer.size(); v++)
+	{
+		if (corners[vertexCorners[v]].Normal == ObjParser::m_Missing && Elite::SqrMagnitude(vertexBuffer[v].Normal) > 0.f)
+			Elite::Normalize(vertexBuffer[v].Normal);
+	}
 
-	std::vector<VS_INPUT> vertexBuffer{};
-	std::vector<uint32_t> indexBuffer{};
-
-	// If the file is in a valid format
-	if (vertexIndices.size() == uvIndices.size() && vertexIndices.size() == normalIndices.size())
+	// And add the tangents to the vertexBuffer - inspired in https://stackoverflow.com/questions/5255806/how-to-calculate-tangent-and-binormal
+	for (int i = 0; i < int(indexBuffer.size()); i += 3)
+	{
+		// (only the faces with uvs have any)
+		if (corners[i].UV == ObjParser::m_Missing || corners[size_t(i) + 1].UV == ObjParser::m_Missing || corners[size_t(i) + 2].UV == ObjParser::m_Missing)
+			continue;
+
+		int index0 = indexBuffer[i];
+		int index1 = indexBuffer[size_t(i) + 1];
+		int index2 = indexBuffer[size_t(i) + 2];
+
+		const Elite::FPoint4& p0 = vertexBuffer[index0].Position;
+		const Elite::FPoint4& p1 = vertexBuffer[index1].Position;
+		const Elite::FPoint4& p2 = vertexBuffer[index2].Position;
+		const Elite::FVector2& uv0 = vertexBuffer[index0].UVCoord;
+		const Elite::FVector2& uv1 = vertexBuffer[index1].UVCoord;
+		const Elite::FVector2& uv2 = vertexBuffer[index2].UVCoord;
+
+		const Elite::FVector4 edge0 = p1 - p0;
+		const Elite::FVector4 edge1 = p2 - p0;
+		const Elite::FVector2 diffX = Elite::FVector2(uv1.x - uv0.x, uv2.x - uv0.x);
+		const Elite::FVector2 diffY = Elite::FVector2(uv1.y - uv0.y, uv2.y - uv0.y);
+
+		// A face whose uvs don't cover any area doesn't have a tangent either (and its infinite one would spread to every face sharing its vertices)
+		const float uvArea = Cross(diffX, diffY);
+		if (std::abs(uvArea) < 1e-12f)
+			continue;
+		float r = 1.f / uvArea;
+
+		Elite::FVector4 tangent = (edge0 * diffY.y - edge1 * diffY.x) * r;
+		vertexBuffer[index0].Tangent += tangent.xyz;
+		vertexBuffer[index1].Tangent += tangent.xyz;
+		vertexBuffer[index2].Tangent += tangent.xyz;
+	}
+	for (auto& vertex : vertexBuffer)
 	{
-		// Set up the vertexBuffer
-		for (int i = 0; i < vertexIndices.size(); i++)
-			vertexBuffer.push_back(VS_INPUT(positions[vertexIndices[i]], Elite::RGBColor{ 1.f, 1.f, 1.f }, uvs[uvIndices[i]], normals[normalIndices[i]]));
+		// A vertex without uvs (or only on faces whose uvs have no area) gets any tangent at all, since its normal map can't be oriented anyway
+		if (Elite::SqrMagnitude(vertex.Tangent) == 0.f)
+			vertex.Tangent = Elite::Cross(vertex.Normal, (std::abs(vertex.Normal.x) < 0.9f) ? Elite::FVector3{ 1.f, 0.f, 0.f } : Elite::FVector3{ 0.f, 1.f, 0.f });
+		vertex.Tangent = Elite::GetNormalized(Elite::Reject(vertex.Tangent, vertex.Normal));
+	}
 
-		// Set up the indexBuffer
-		for (int i = 0; i < int(vertexBuffer.size()); i++)
-			indexBuffer.push_back(i);
+	// Hand the buffers over to the geometry (they're moved, not copied), which also reorders them for the vertex caches
+	const uint32_t amountVertices = uint32_t(vertexBuffer.size());
+	const float fileOrderACMR = VertexCache::GetACMR({ indexBuffer.data(), uint32_t(indexBuffer.size()) }, amountVertices);
+	const auto pGeometry = std::make_shared<const MeshGeometry>(std::move(vertexBuffer), std::move(indexBuffer));
+	lods.push_back(pGeometry);
 
-		// And add the tangents to the vertexBuffer - inspired in https://stackoverflow.com/questions/5255806/how-to-calculate-tangent-and-binormal
-		for (int i = 0; i < int(indexBuffer.size()); i += 3)
-		{
-			int index0 = indexBuffer[i];
-			int index1 = indexBuffer[size_t(i) + 1];
-			int index2 = indexBuffer[size_t(i) + 2];
-
-			const Elite::FPoint4& p0 = vertexBuffer[index0].Position;
-			const Elite::FPoint4& p1 = vertexBuffer[index1].Position;
-			const Elite::FPoint4& p2 = vertexBuffer[index2].Position;
-			const Elite::FVector2& uv0 = vertexBuffer[index0].UVCoord;
-			const Elite::FVector2& uv1 = vertexBuffer[index1].UVCoord;
-			const Elite::FVector2& uv2 = vertexBuffer[index2].UVCoord;
-
-			const Elite::FVector4 edge0 = p1 - p0;
-			const Elite::FVector4 edge1 = p2 - p0;
-			const Elite::FVector2 diffX = Elite::FVector2(uv1.x - uv0.x, uv2.x - uv0.x);
-			const Elite::FVector2 diffY = Elite::FVector2(uv1.y - uv0.y, uv2.y - uv0.y);
-			float r = 1.f / Cross(diffX, diffY);
-
-			Elite::FVector4 tangent = (edge0 * diffY.y - edge1 * diffY.x) * r;
-			vertexBuffer[index0].Tangent += tangent.xyz;
-			vertexBuffer[index1].Tangent += tangent.xyz;
-			vertexBuffer[index2].Tangent += tangent.xyz;
-		}
-		for (auto& vertex : vertexBuffer)
-			vertex.Tangent = Elite::GetNormalized(Elite::Reject(vertex.Tangent, vertex.Normal));
+	// Without welding every face corner would be a vertex of its own, and get transformed every time (an ACMR of 3)
+	std::cout << filePath << ": " << corners.size() << " face corners welded into " << amountVertices << " vertices, ACMR 3 -> "
+		<< fileOrderACMR << " (in file order) -> " << VertexCache::GetACMR(pGeometry->GetIndices(), amountVertices) << " (reordered)" << std::endl;
+
+	// And make its simpler levels of detail, to draw when it's small on screen (with the same material and textures)
+	for (auto& level : MeshSimplifier::BuildLodChain(pGeometry->GetVertices(), pGeometry->GetIndices(), Mesh::m_MaxLods - 1))
+		lods.push_back(std::make_shared<const MeshGeometry>(std::move(level.Vertices), std::move(level.Indices)));
+
+	return true;
+}
+
+Mesh* ParseOBJFile(const std::string& filePath, ID3D11Device* pDevice, const std::shared_ptr<BaseMaterial>& pMaterial, ThreadPool& threadPool)
+{
+	std::vector<std::shared_ptr<const MeshGeometry>> lods{};
+
+	// Map the file
+	MappedFile file{ filePath };
+	if (!file.IsOpen())
+		std::cout << "An error occurred while opening the obj file." << std::endl;
 
-		return new Mesh(pDevice, vertexBuffer, indexBuffer, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, pMaterial);
+	// Read its geometry straight out of its mesh cache, if there's one that was made from this very file
+	// Otherwise parse it, and cache it for the next launch
+	else
+	{
+		const uint64_t sourceHash = MeshCache::GetSourceHash(file.GetData(), file.GetSize());
+		const std::string cachePath = filePath + MeshCache::m_Extension;
+		lods = MeshCache::Load(cachePath, sourceHash);
+		if (!lods.empty())
+			std::cout << filePath << ": loaded from " << cachePath << std::endl;
+		else if (ParseOBJGeometry(filePath, file, threadPool, lods) && MeshCache::Save(cachePath, sourceHash, lods) == false)
+			std::cout << "An error occurred while writing the mesh cache " << cachePath << "." << std::endl;
 	}
 
-	// If it's not in a valid format
-	std::cout << "The obj file is not written in a readable format." << std::endl;
-	return new Mesh(pDevice, vertexBuffer, indexBuffer, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, pMaterial);
+	// A file that couldn't be read makes an empty mesh
+	if (lods.empty())
+		lods.push_back(std::make_shared<const MeshGeometry>(std::vector<VS_INPUT>(), std::vector<uint32_t>()));
+
+	auto* pMesh = new Mesh(pDevice, lods[0], D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, pMaterial);
+	for (size_t i = 1; i < lods.size(); ++i)
+		pMesh->AddLod(pDevice, lods[i]);
+	return pMesh;
 }
 
 
@@ -163,24 +196,26 @@ std::vector<Mesh*> InitializeVehicleScene(Scene* scene, ID3D11Device* pDevice)
 	// Set Up Background Color
 	scene->SetBackgroundColor(Elite::RGBColor(.1f, .1f, .1f));
 	
-	// Set Up Vehicle Mesh
+	// Set Up Vehicle Mesh (its maps get block compressed at load: BC5 for the normals, BC1 for the rest)
 	const std::wstring assetFile = L"Resources/PosCol3D.fx";
-	auto* pShadedMaterial = new ShadedMaterial(pDevice, assetFile);
-	auto* pVehicleMesh = ParseOBJFile("Resources/vehicle.obj", pDevice, pShadedMaterial);
-	pVehicleMesh->SetDiffuseTexture("Resources/vehicle_diffuse.png", pDevice);
-	pVehicleMesh->SetNormalTexture("Resources/vehicle_normal.png", pDevice);
-	pVehicleMesh->SetSpecularTexture("Resources/vehicle_specular.png", pDevice);
-	pVehicleMesh->SetGlossinessTexture("Resources/vehicle_gloss.png", pDevice);
+	auto pShadedMaterial = std::make_shared<ShadedMaterial>(pDevice, assetFile);
+	// (both obj files get parsed, and all their textures loaded, on the same threads)
+	ThreadPool threadPool{};
+	auto* pVehicleMesh = ParseOBJFile("Resources/vehicle.obj", pDevice, pShadedMaterial, threadPool);
+	pVehicleMesh->SetDiffuseTexture("Resources/vehicle_diffuse.png", pDevice, threadPool, TextureFormat::BC1);
+	pVehicleMesh->SetNormalTexture("Resources/vehicle_normal.png", pDevice, threadPool, TextureFormat::BC5);
+	pVehicleMesh->SetSpecularTexture("Resources/vehicle_specular.png", pDevice, threadPool, TextureFormat::BC1);
+	pVehicleMesh->SetGlossinessTexture("Resources/vehicle_gloss.png", pDevice, threadPool, TextureFormat::BC1);
 	pVehicleMesh->SetShininess(25.f);
 	auto transformMatrix = Elite::FMatrix4::Identity();
 	transformMatrix[3][2] = 50.f;
 	pVehicleMesh->SetTransformMatrix(transformMatrix);
 	scene->AddMesh(pVehicleMesh);
 	
-	// Set Up Fire Mesh
-	auto* pTransparentMaterial = new TransparentMaterial(pDevice, assetFile);
-	auto* pFireMesh = ParseOBJFile("Resources/fireFX.obj", pDevice, pTransparentMaterial);
-	pFireMesh->SetDiffuseTexture("Resources/fireFX_diffuse.png", pDevice);
+	// Set Up Fire Mesh (BC3, to keep the alpha)
+	auto pTransparentMaterial = std::make_shared<TransparentMaterial>(pDevice, assetFile);
+	auto* pFireMesh = ParseOBJFile("Resources/fireFX.obj", pDevice, pTransparentMaterial, threadPool);
+	pFireMesh->SetDiffuseTexture("Resources/fireFX_diffuse.png", pDevice, threadPool, TextureFormat::BC3);
 	pFireMesh->SetTransformMatrix(transformMatrix);
 	scene->AddMesh(pFireMesh);
 	
@@ -196,6 +231,77 @@ std::vector<Mesh*> InitializeVehicleScene(Scene* scene, ID3D11Device* pDevice)
 	return returnVector;
 }
 
+std::shared_ptr<const MeshGeometry> CreateCubeGeometry(const Elite::RGBColor& color)
+{
+	// A unit cube, with its own 4 vertices on each face (so each face can be shaded a bit darker than the last, without any texture)
+	const Elite::FVector3 faceNormals[6]{ { 1.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, -1.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f } };
+	const float faceShades[6]{ 0.8f, 0.6f, 1.f, 0.4f, 0.7f, 0.9f };
+
+	std::vector<VS_INPUT> vertices{};
+	std::vector<uint32_t> indices{};
+	for (int face = 0; face < 6; ++face)
+	{
+		// Get 2 axes along the face, so that going around it from the first to the second one winds it the same way the obj files are (once their z axis is inverted)
+		const Elite::FVector3& normal = faceNormals[face];
+		const Elite::FVector3 tangent = (normal.y != 0.f) ? Elite::FVector3{ 1.f, 0.f, 0.f } : Elite::FVector3{ 0.f, 1.f, 0.f };
+		const Elite::FVector3 bitangent = Elite::Cross(tangent, normal);
+
+		const uint32_t firstVertex = uint32_t(vertices.size());
+		const Elite::RGBColor faceColor = color * faceShades[face];
+		const float corners[4][2]{ { -1.f, -1.f }, { 1.f, -1.f }, { 1.f, 1.f }, { -1.f, 1.f } };
+		for (const auto& corner : corners)
+		{
+			const Elite::FVector3 offset = (normal + tangent * corner[0] + bitangent * corner[1]) * 0.5f;
+			vertices.push_back(VS_INPUT(Elite::FPoint3{ offset.x, offset.y, offset.z }, faceColor));
+		}
+
+		const uint32_t faceIndices[6]{ 0, 1, 2, 0, 2, 3 };
+		for (const uint32_t faceIndex : faceIndices)
+			indices.push_back(firstVertex + faceIndex);
+	}
+
+	return std::make_shared<const MeshGeometry>(std::move(vertices), std::move(indices));
+}
+
+void InitializeStressScene(Scene* scene, ID3D11Device* pDevice)
+{
+	// Set Up Camera
+	scene->AddCamera(new Elite::ECamera(Elite::FPoint3{ 0.f, 2.f, 0.f }, Elite::FVector3{ 0.f, 0.f, 1.f }, true, 45.f, 0.1f, 100.f));
+
+	// Set Up Background Color
+	scene->SetBackgroundColor(Elite::RGBColor(.1f, .1f, .1f));
+
+	// Set Up a 64x64 grid of cubes all around the camera, most of them out of its frustum (they all share the same few geometries and a single material)
+	const std::wstring assetFile = L"Resources/PosCol3D.fx";
+	auto pShadedMaterial = std::make_shared<ShadedMaterial>(pDevice, assetFile);
+	const std::shared_ptr<const MeshGeometry> pCubeGeometries[4]{
+		CreateCubeGeometry(Elite::RGBColor(1.f, .3f, .3f)),
+		CreateCubeGeometry(Elite::RGBColor(.3f, 1.f, .3f)),
+		CreateCubeGeometry(Elite::RGBColor(.3f, .3f, 1.f)),
+		CreateCubeGeometry(Elite::RGBColor(1.f, 1.f, .3f)) };
+
+	const int gridSize = 64;
+	const float cellSize = 4.f;
+	for (int z = 0; z < gridSize; ++z)
+	{
+		for (int x = 0; x < gridSize; ++x)
+		{
+			auto transformMatrix = Elite::FMatrix4::Identity();
+			transformMatrix[3][0] = (float(x) - float(gridSize - 1) * 0.5f) * cellSize;
+			transformMatrix[3][1] = float((x * 7 + z * 3) % 5) * 0.5f;
+			transformMatrix[3][2] = (float(z) - float(gridSize - 1) * 0.5f) * cellSize;
+
+			auto* pCubeMesh = new Mesh(pDevice, pCubeGeometries[(x + z) % 4], D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, pShadedMaterial, transformMatrix);
+			scene->AddMesh(pCubeMesh);
+		}
+	}
+
+	// Set Up Light
+	scene->SetAmbientLight({ 0.025f, 0.025f, 0.025f });
+	scene->SetLightDirection({ 0.577f, -0.577f, 0.577f });
+	scene->SetLightIntensity(7.f);
+}
+
 int main(int argc, char* args[])
 {
 	//Unreferenced parameters
@@ -226,17 +332,36 @@ int main(int argc, char* args[])
 	auto* pVehicleScene = new Scene();
 	auto vehicleMeshVector = InitializeVehicleScene(pVehicleScene, pRenderer->GetDevice());
 	scenes.push_back(pVehicleScene);
+	auto* pStressScene = new Scene();
+	InitializeStressScene(pStressScene, pRenderer->GetDevice());
+	scenes.push_back(pStressScene);
+
+#if defined(DEBUG) || defined(_DEBUG)
+	// Make sure the fast-math shading stays within one step of an 8 bit color channel of the exact shading, on the first frame of every scene
+	for (auto* pScene : scenes)
+	{
+		pScene->Update(0.f, false);
+		const uint32_t fastMathError = pRenderer->GetFastMathError(pScene, SAMPLER_FILTER::Point, CULL_MODE::Back, true, vehicleMeshVector[1]);
+		std::cout << "Fast-math shading check: largest channel difference of " << fastMathError << " (out of 255)\n";
+		assert((fastMathError <= 1) && "ERROR: the fast-math shading is more than one 8 bit step away from the exact shading!");
+	}
+#endif
 
 	//Print extra commands
 	std::cout << "\n----------------------------------------------------------------------------\n";
 	std::cout << "Commands:\n\n";
+	std::cout << "  B -----> Toggle the visibility buffer on and off (only in Software)\n";
 	std::cout << "  C -----> Toggle between cull modes\n";
 	std::cout << "  E -----> Switch between render modes\n";
-	std::cout << "  F -----> Switch between sampler filters (only in DirectX)\n";
+	std::cout << "  F -----> Switch between sampler filters\n";
+	std::cout << "  H -----> Toggle the Hi-Z block rejection on and off (only in Software)\n";
+	std::cout << "  K -----> Toggle the vectorized rasterizer on and off (only in Software)\n";
+	std::cout << "  M -----> Toggle the mipmaps on and off (only in Software)\n";
+	std::cout << "  P -----> Toggle the fast-math shading on and off (only in Software)\n";
 	std::cout << "  R -----> Toggle the mesh's rotation on and off\n";
 	std::cout << "  T -----> Hide/show the fireFX mesh\n";
 	std::cout << "  V -----> Restart the current camera to its original position and rotation\n";
-	std::cout << "  SPACE -> Switch between scenes (there's only one scene currently)\n\n\n";
+	std::cout << "  SPACE -> Switch between scenes (the vehicle, and a grid of 4096 cubes to stress the frustum culling)\n\n\n";
 	std::cout << "Extra Implementations:\n\n";
 	std::cout << "  - Transparency in Software Mode\n";
 	std::cout << "  - Editable single Directional Light through Scene class (not hardcoded values)\n";
@@ -298,13 +423,10 @@ int main(int argc, char* args[])
 					break;
 					// Toggle mesh rotation with R
 				case SDLK_r:
-					if (currentSceneIdx == 0)
-					{
-						meshRotation = !meshRotation;
-						std::cout << "Mesh rotation ";
-						if (meshRotation) std::cout << "on\n";
-						else std::cout << "off\n";
-					}
+					meshRotation = !meshRotation;
+					std::cout << "Mesh rotation ";
+					if (meshRotation) std::cout << "on\n";
+					else std::cout << "off\n";
 					break;
 					// Change render mode with E
 				case SDLK_e:
@@ -328,25 +450,57 @@ int main(int argc, char* args[])
 					break;
 					// Change pixel shading technique (samplerState) with F
 				case SDLK_f:
-					if (renderMode == RENDER_MODE::DirectX)
+					switch (samplerFilter)
 					{
-						switch (samplerFilter)
-						{
-						case SAMPLER_FILTER::Point:
-							samplerFilter = SAMPLER_FILTER::Linear;
-							std::cout << "Sampler Filter set to Linear\n";
-							break;
-						case SAMPLER_FILTER::Linear:
-							samplerFilter = SAMPLER_FILTER::Anisotropic;
-							std::cout << "Sampler Filter set to Anisotropic\n";
-							break;
-						case SAMPLER_FILTER::Anisotropic:
-							samplerFilter = SAMPLER_FILTER::Point;
-							std::cout << "Sampler Filter set to Point\n";
-							break;
-						}
+					case SAMPLER_FILTER::Point:
+						samplerFilter = SAMPLER_FILTER::Linear;
+						std::cout << "Sampler Filter set to Linear\n";
+						break;
+					case SAMPLER_FILTER::Linear:
+						samplerFilter = SAMPLER_FILTER::Anisotropic;
+						std::cout << "Sampler Filter set to Anisotropic\n";
+						break;
+					case SAMPLER_FILTER::Anisotropic:
+						samplerFilter = SAMPLER_FILTER::Point;
+						std::cout << "Sampler Filter set to Point\n";
+						break;
 					}
 					break;
+					// Toggle the visibility buffer with B (shades every visible pixel only once, instead of every fragment that passes the depth test)
+				case SDLK_b:
+					pRenderer->SetVisibilityBuffer(!pRenderer->IsVisibilityBufferOn());
+					std::cout << "Visibility buffer ";
+					if (pRenderer->IsVisibilityBufferOn()) std::cout << "on\n";
+					else std::cout << "off\n";
+					break;
+					// Toggle the Hi-Z block rejection with H
+				case SDLK_h:
+					pRenderer->SetHiZ(!pRenderer->IsHiZOn());
+					std::cout << "Hi-Z ";
+					if (pRenderer->IsHiZOn()) std::cout << "on\n";
+					else std::cout << "off\n";
+					break;
+					// Toggle the vectorized coverage and depth test kernel with K (the scalar one gives the same image, it's only there to compare)
+				case SDLK_k:
+					pRenderer->SetVectorizedRasterizer(!pRenderer->IsVectorizedRasterizerOn());
+					std::cout << "Vectorized rasterizer ";
+					if (pRenderer->IsVectorizedRasterizerOn()) std::cout << "on\n";
+					else std::cout << "off\n";
+					break;
+					// Toggle between filtering across the mip chains and only reading the full size textures with M
+				case SDLK_m:
+					pRenderer->SetMipmaps(!pRenderer->IsMipmapsOn());
+					std::cout << "Mipmaps ";
+					if (pRenderer->IsMipmapsOn()) std::cout << "on\n";
+					else std::cout << "off\n";
+					break;
+					// Toggle between the exact and the fast-math shading with P
+				case SDLK_p:
+					pRenderer->SetFastMath(!pRenderer->IsFastMathOn());
+					std::cout << "Fast-math shading ";
+					if (pRenderer->IsFastMathOn()) std::cout << "on\n";
+					else std::cout << "off\n";
+					break;
 					// Hide/show the FireFX mesh with T
 				case SDLK_t:
 					fireFXVisible = !fireFXVisible;
@@ -378,7 +532,7 @@ int main(int argc, char* args[])
 				Elite::FVector4(sinf(frameRotation), 0.f, cosf(frameRotation), 0.f),
 				Elite::FVector4(0.f, 0.f, 0.f, 1.f) };
 
-			for (auto* mesh : vehicleMeshVector)
+			for (auto* mesh : scenes[currentSceneIdx]->GetMeshes())
 				mesh->SetTransformMatrix(mesh->GetTransformMatrix(true) * rotationMatrix);
 		}
 
@@ -391,6 +545,29 @@ int main(int argc, char* args[])
 		{
 			printTimer = 0.f;
 			std::cout << "FPS: " << pTimer->GetFPS() << std::endl;
+
+			// How many meshes and meshlets got culled as a whole, in both modes
+			const auto& sceneCullStats = pRenderer->GetSceneCullStats();
+			std::cout << "  Meshes: " << sceneCullStats.AmountMeshes << ", frustum culled: " << sceneCullStats.AmountFrustumCulledMeshes
+				<< " (" << sceneCullStats.AmountVisitedNodes << " BVH nodes tested)" << std::endl;
+			const auto& meshletStats = pRenderer->GetMeshletStats();
+			std::cout << "  Meshlets: " << meshletStats.AmountMeshlets << ", frustum culled: " << meshletStats.AmountFrustumCulledMeshlets
+				<< ", back-face culled: " << meshletStats.AmountBackFaceCulledMeshlets << std::endl;
+			const auto& lodStats = pRenderer->GetLodStats();
+			std::cout << "  Triangles: " << lodStats.AmountLodTriangles << " of " << lodStats.AmountFullTriangles << " at full detail ("
+				<< lodStats.AmountFullTriangles - lodStats.AmountLodTriangles << " saved by the levels of detail)" << std::endl;
+
+			// And how many times each pixel got shaded, in Software Mode
+			if (renderMode == RENDER_MODE::Software)
+			{
+				const auto& stats = pRenderer->GetSoftwareStats();
+				const float overdraw = stats.AmountCoveredPixels > 0 ? float(stats.AmountShadedFragments) / stats.AmountCoveredPixels : 0.f;
+				std::cout << "  Fragments passing the depth test: " << stats.AmountFragments << ", shaded: " << stats.AmountShadedFragments
+					<< ", covered pixels: " << stats.AmountCoveredPixels << " (overdraw " << overdraw << "x)" << std::endl;
+				std::cout << "  Hi-Z rejected blocks: " << stats.AmountHiZRejectedBlocks << " (" << stats.AmountHiZRejectedPixels << " pixels)" << std::endl;
+				std::cout << "  Back-face culled triangles: " << stats.AmountBackFaceCulledTriangles << ", transformed vertices: " << stats.AmountTransformedVertices << std::endl;
+				std::cout << "  Frustum culled triangles: " << stats.AmountFrustumCulledTriangles << ", clipped triangles: " << stats.AmountClippedTriangles << std::endl;
+			}
 		}
 
 	}
@@ -11,7 +11,7 @@
 #include <d3d11.h>
 #include <d3dcompiler.h>
 #include <d3dx11effect.h>
-
+#include <immintrin.h>
 
 
 #include "TransparentMaterial.h"
@@ -19,7 +19,10 @@
 #include "Mesh.h"
 #include "Scene.h"
 #include "Texture.h"
+#include "MaterialTexture.h"
+#include "ThreadPool.h"
 #include "EMath.h"
+#include "FastMath.h"
 
 Elite::Renderer::Renderer(SDL_Window* pWindow)
 	: m_pWindow{ pWindow }
@@ -35,7 +38,42 @@ Elite::Renderer::Renderer(SDL_Window* pWindow)
 	, m_pDepthStencilView{ nullptr }
 	, m_pRenderTargetBuffer{ nullptr }
 	, m_pRenderTargetView{ nullptr }
-	, m_TransformedVerticesTriangle{} // This is a temporary vector to store whatever triangle is currently being calculated in Software Mode - it's stored as a member variable for optimization purposes
+	, m_pAccumulationTexture{ nullptr }
+	, m_pAccumulationTargetView{ nullptr }
+	, m_pAccumulationResourceView{ nullptr }
+	, m_pRevealageTexture{ nullptr }
+	, m_pRevealageTargetView{ nullptr }
+	, m_pRevealageResourceView{ nullptr }
+	, m_AmountVertices{}
+	, m_VertexStreams{}
+	, m_InvW{}
+	, m_NdcPositions{}
+	, m_WorldPositions{}
+	, m_RasterPositions{}
+	, m_ClipPositions{}
+	, m_ClipCodes{}
+	, m_VisibleTriangles{}
+	, m_UsedVertices{}
+	, m_AmountTilesX{}
+	, m_AmountTilesY{}
+	, m_pThreadPool{ nullptr }
+	, m_BinnedTriangles{}
+	, m_TileBinOffsets{}
+	, m_TileBinCursors{}
+	, m_TileBinTriangles{}
+	, m_VectorizedRasterizerOn{ true }
+	, m_VisibilityBufferOn{ false }
+	, m_HiZOn{ true }
+	, m_MipmapsOn{ true }
+	, m_FastMathOn{ false }
+	, m_SamplerFilter{ SAMPLER_FILTER::Point }
+	, m_TileStats{}
+	, m_TileClearColors{}
+	, m_SoftwareStats{}
+	, m_MeshletStats{}
+	, m_SceneCullStats{}
+	, m_LodStats{}
+	, m_VisibleMeshes{}
 {	
 	int width, height = 0;
 	SDL_GetWindowSize(pWindow, &width, &height);
@@ -59,6 +97,42 @@ Elite::Renderer::Renderer(SDL_Window* pWindow)
 
 Elite::Renderer::~Renderer()
 {
+	if (m_pAccumulationResourceView)
+	{
+		m_pAccumulationResourceView->Release();
+		m_pAccumulationResourceView = nullptr;
+	}
+
+	if (m_pAccumulationTargetView)
+	{
+		m_pAccumulationTargetView->Release();
+		m_pAccumulationTargetView = nullptr;
+	}
+
+	if (m_pAccumulationTexture)
+	{
+		m_pAccumulationTexture->Release();
+		m_pAccumulationTexture = nullptr;
+	}
+
+	if (m_pRevealageResourceView)
+	{
+		m_pRevealageResourceView->Release();
+		m_pRevealageResourceView = nullptr;
+	}
+
+	if (m_pRevealageTargetView)
+	{
+		m_pRevealageTargetView->Release();
+		m_pRevealageTargetView = nullptr;
+	}
+
+	if (m_pRevealageTexture)
+	{
+		m_pRevealageTexture->Release();
+		m_pRevealageTexture = nullptr;
+	}
+
 	if(m_pRenderTargetView)
 	{
 		m_pRenderTargetView->Release();
@@ -115,6 +189,36 @@ Elite::Renderer::~Renderer()
 		delete m_pDepthBuffer;
 		m_pDepthBuffer = nullptr;
 	}
+
+	if (m_pBackBuffer)
+	{
+		SDL_FreeSurface(m_pBackBuffer);
+		m_pBackBuffer = nullptr;
+	}
+
+	if (m_pVisibilityBuffer)
+	{
+		delete[] m_pVisibilityBuffer;
+		m_pVisibilityBuffer = nullptr;
+	}
+
+	if (m_pAccumulationBuffer)
+	{
+		delete[] m_pAccumulationBuffer;
+		m_pAccumulationBuffer = nullptr;
+	}
+
+	if (m_pRevealageBuffer)
+	{
+		delete[] m_pRevealageBuffer;
+		m_pRevealageBuffer = nullptr;
+	}
+
+	if (m_pThreadPool)
+	{
+		delete m_pThreadPool;
+		m_pThreadPool = nullptr;
+	}
 }
 
 void Elite::Renderer::Render(Scene* pScene, SAMPLER_FILTER samplerFilter, RENDER_MODE renderMode, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh)
@@ -122,53 +226,101 @@ void Elite::Renderer::Render(Scene* pScene, SAMPLER_FILTER samplerFilter, RENDER
 	if (renderMode == RENDER_MODE::DirectX)
 		RenderDirectX(pScene, samplerFilter, cullMode, fireFXVisible, pFireMesh);
 	else
-		RenderSoftware(pScene, cullMode, fireFXVisible, pFireMesh);
+		RenderSoftware(pScene, samplerFilter, cullMode, fireFXVisible, pFireMesh);
 }
 
-void Elite::Renderer::RenderDirectX(Scene* pScene, SAMPLER_FILTER samplerFilter, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh) const
+void Elite::Renderer::RenderDirectX(Scene* pScene, SAMPLER_FILTER samplerFilter, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh)
 {
 	if (!m_DirectXInitialized)
 		return;
 
+	m_MeshletStats = MeshletStats{};
+
 	// Clear Buffers
 	RGBColor clearColor = pScene->GetBackgroundColor();
 	m_pDeviceContext->ClearRenderTargetView(m_pRenderTargetView, &clearColor.r);
 	m_pDeviceContext->ClearDepthStencilView(m_pDepthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
 
-	// Render
+	// Only go over the meshes in the camera's frustum (the scene's BVH rejects the rest a whole branch at a time)
 	const auto aspectRatio = static_cast<float>(m_Width) / static_cast<float>(m_Height);
-	for (auto* mesh : pScene->GetMeshes())
+	pScene->GetVisibleMeshes(aspectRatio, true, m_VisibleMeshes, m_SceneCullStats);
+	SelectMeshLods(pScene->GetCurrentCamera(), true, (fireFXVisible ? nullptr : pFireMesh));
+
+	// Render the opaque meshes first, straight into the back buffer
+	const TransparentMaterial* pTransparentMaterial = nullptr;
+	for (auto* mesh : m_VisibleMeshes)
 	{
 		// Skip the FireFX, if fireFXVisible has been set to false
-		if(pFireMesh == nullptr || fireFXVisible || mesh != pFireMesh)
-			mesh->RenderDirectX(m_pDeviceContext, pScene->GetCurrentCamera(), aspectRatio, samplerFilter, cullMode, pScene->GetLightDirection(), pScene->GetLightIntensity(), pScene->GetAmbientLight());
+		if (pFireMesh != nullptr && fireFXVisible == false && mesh == pFireMesh)
+			continue;
+
+		if (dynamic_cast<TransparentMaterial*>(mesh->GetMaterial()) != nullptr)
+			pTransparentMaterial = static_cast<TransparentMaterial*>(mesh->GetMaterial());
+		else
+			mesh->RenderDirectX(m_pDeviceContext, pScene->GetCurrentCamera(), aspectRatio, samplerFilter, cullMode, pScene->GetLightDirection(), pScene->GetLightIntensity(), pScene->GetAmbientLight(),
+				m_MeshletStats);
 	}
+
+	// Then the transparent ones, in any order, into the accumulation and revealage targets (tested against the opaque depth, but without writing it)
+	// Their techniques never cull any faces, so neither do their meshlets
+	if (pTransparentMaterial != nullptr)
+	{
+		const float clearAccumulation[4]{ 0.f, 0.f, 0.f, 0.f };
+		const float clearRevealage[4]{ 1.f, 1.f, 1.f, 1.f };
+		m_pDeviceContext->ClearRenderTargetView(m_pAccumulationTargetView, clearAccumulation);
+		m_pDeviceContext->ClearRenderTargetView(m_pRevealageTargetView, clearRevealage);
+		ID3D11RenderTargetView* pTransparencyTargetViews[2]{ m_pAccumulationTargetView, m_pRevealageTargetView };
+		m_pDeviceContext->OMSetRenderTargets(2, pTransparencyTargetViews, m_pDepthStencilView);
+
+		for (auto* mesh : m_VisibleMeshes)
+		{
+			if (pFireMesh != nullptr && fireFXVisible == false && mesh == pFireMesh)
+				continue;
+
+			if (dynamic_cast<TransparentMaterial*>(mesh->GetMaterial()) != nullptr)
+				mesh->RenderDirectX(m_pDeviceContext, pScene->GetCurrentCamera(), aspectRatio, samplerFilter, CULL_MODE::None, pScene->GetLightDirection(), pScene->GetLightIntensity(),
+					pScene->GetAmbientLight(), m_MeshletStats);
+		}
+
+		// And composite them all at once on top of the back buffer
+		m_pDeviceContext->OMSetRenderTargets(1, &m_pRenderTargetView, m_pDepthStencilView);
+		pTransparentMaterial->Composite(m_pDeviceContext, m_pAccumulationResourceView, m_pRevealageResourceView);
+	}
+
 	// Present
 	m_pSwapChain->Present(0, 0);
 }
 
-void Elite::Renderer::RenderSoftware(Scene* pScene, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh)
+void Elite::Renderer::RenderSoftware(Scene* pScene, SAMPLER_FILTER samplerFilter, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh)
 {
 	if (!m_SoftwareInitialized)
 		return;
 
-	// Reset the depth buffer
-	for (uint32_t i = 0; i < m_Height * m_Width; i++)
-		m_pDepthBuffer[i] = FLT_MAX;
-	
-	// Reset the backbuffer pixels
-	auto sceneAmbient = pScene->GetBackgroundColor();
-	uint32_t backgroundColor = SDL_MapRGB(m_pBackBuffer->format, Uint8(sceneAmbient.r * 255.f), Uint8(sceneAmbient.g * 255.f), Uint8(sceneAmbient.b * 255.f));
-	SDL_FillRect(m_pBackBuffer, nullptr, backgroundColor);
+	// Every texture sample of this frame goes through the same filter as the DirectX samplers
+	m_SamplerFilter = samplerFilter;
+
+	// The depth buffer and the pixels aren't reset here, each tile gets cleared right before it's rasterized
+	// Render straight into the window surface, if it has the right format
+	SDL_Surface* pRenderTarget = m_pBackBuffer != nullptr ? m_pBackBuffer : m_pFrontBuffer;
+	SDL_LockSurface(pRenderTarget);
+	m_pBackBufferPixels = (uint32_t*)pRenderTarget->pixels;
 
-	SDL_LockSurface(m_pBackBuffer);
+	// Empty the bins and the post-transform vertices from the last frame (keeping their memory)
+	m_AmountVertices = 0;
+	m_SoftwareStats = RenderStats{};
+	m_MeshletStats = MeshletStats{};
+	m_BinnedTriangles.clear();
+	std::fill(m_TileBinOffsets.begin(), m_TileBinOffsets.end(), 0);
 
 	// Get the camera
 	ECamera* pCamera = pScene->GetCurrentCamera();
+	const auto cameraPos = pCamera->GetPosition();
+	const FPoint3 viewCameraPos{ pCamera->GetWorldMatrix()[3].xyz };
 
-	// Get the scene meshes and go over each one
-	const auto& sceneMeshes = pScene->GetMeshes();
-	for (auto* mesh : sceneMeshes)
+	// Get the scene meshes that are in the camera's frustum, and go over each one
+	pScene->GetVisibleMeshes(float(m_Width) / float(m_Height), false, m_VisibleMeshes, m_SceneCullStats);
+	SelectMeshLods(pCamera, false, (fireFXVisible ? nullptr : pFireMesh));
+	for (auto* mesh : m_VisibleMeshes)
 	{
 		// Skip the FireFX, if fireFXVisible has been set to false
 		if (pFireMesh != nullptr && fireFXVisible == false && mesh == pFireMesh)
@@ -176,176 +328,959 @@ void Elite::Renderer::RenderSoftware(Scene* pScene, CULL_MODE cullMode, bool fir
 		
 		// Get all the mesh's info
 		const auto& primTopology = mesh->GetPrimitiveTopology();
-		const auto& vertices = mesh->GetVertexVector();
-		const auto& indexes = mesh->GetIndexVector();
+		const auto vertices = mesh->GetVertices();
+		const auto indexes = mesh->GetIndices();
 		const auto* pDiffuseText = mesh->GetDiffuseTexture();
-		const auto* pNormalText = mesh->GetNormalTexture();
-		const auto* pSpecularText = mesh->GetSpecularTexture();
-		const auto* pGlossText = mesh->GetGlossinessTexture();
-		const auto shininess = mesh->GetShininess();
 
 		// Set the transparency bool depending on the Material type
 		bool transparencyOn = false;
 		if (dynamic_cast<TransparentMaterial*>(mesh->GetMaterial()) != nullptr && pDiffuseText)
 			transparencyOn = true;
 
-		// Define the increment for the next loop depending on topology
-		int increment, max;
+		// Meshlets and triangles are culled before any vertex gets transformed: back faces in object space, against the camera brought into the mesh's space
+		// (the FireFX needs NoCull, and the camera's real position is the one in its world matrix, which is mirrored in a right handed coordinate system)
+		const FMatrix4 transformMatrix = mesh->GetTransformMatrix(false);
+		const MeshletCuller culler(transformMatrix, pCamera->GetViewMatrix(), viewCameraPos, pCamera->GetFov(), float(m_Width) / float(m_Height), pCamera->GetNear(),
+			pCamera->GetFar(), false, mesh != pFireMesh ? cullMode : CULL_MODE::None);
+
+		// Keep only the triangles that face the right way, and mark the vertices they use
+		const auto facePlanes = mesh->GetLodGeometry()->GetFacePlanes();
+		m_VisibleTriangles.clear();
+		m_UsedVertices.assign(vertices.size(), 0);
+		auto addTriangle = [&](const uint32_t* pTriangleIdxs, const FVector4& facePlane)
+		{
+			if (culler.IsTriangleCulled(facePlane))
+			{
+				m_SoftwareStats.AmountBackFaceCulledTriangles++;
+				return;
+			}
+
+			for (int v = 0; v < 3; ++v)
+			{
+				m_SoftwareStats.AmountTransformedVertices += m_UsedVertices[pTriangleIdxs[v]] == 0;
+				m_UsedVertices[pTriangleIdxs[v]] = 1;
+			}
+			m_VisibleTriangles.insert(m_VisibleTriangles.end(), pTriangleIdxs, pTriangleIdxs + 3);
+		};
+
 		if (primTopology == D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST)
 		{
-			increment = 3;
-			max = int(indexes.size());
+			// A triangle list goes over its meshlets, and only looks at the triangles of the ones that are in the frustum and not facing away as a whole
+			for (const auto& meshlet : mesh->GetLodGeometry()->GetMeshlets())
+			{
+				m_MeshletStats.AmountMeshlets++;
+				const MESHLET_VISIBILITY visibility = culler.GetVisibility(meshlet);
+				if (visibility == MESHLET_VISIBILITY::OutsideFrustum)
+				{
+					m_MeshletStats.AmountFrustumCulledMeshlets++;
+					continue;
+				}
+				if (visibility == MESHLET_VISIBILITY::BackFacing)
+				{
+					m_MeshletStats.AmountBackFaceCulledMeshlets++;
+					continue;
+				}
+
+				// Its triangles have their planes ready
+				for (uint32_t i = meshlet.FirstIndex; i < meshlet.FirstIndex + meshlet.AmountIndices; i += 3)
+					addTriangle(&indexes[i], facePlanes[i / 3]);
+			}
 		}
 		else
 		{
-			increment = 1;
-			max = int(indexes.size()) - 2;
+			// A triangle strip has no meshlets, so its triangles get their planes on the spot
+			for (uint32_t i = 0; i + 2 < indexes.size(); ++i)
+			{
+				// If it's an odd i, invert the 2nd and 3rd vertex order
+				const uint32_t triangleIdxs[3]{ indexes[i], indexes[i % 2 != 0 ? i + 2 : i + 1], indexes[i % 2 != 0 ? i + 1 : i + 2] };
+				addTriangle(triangleIdxs, culler.IsFaceCullingOn() ? MeshGeometry::GetFacePlane(vertices[triangleIdxs[0]].Position, vertices[triangleIdxs[1]].Position,
+					vertices[triangleIdxs[2]].Position) : FVector4{});
+			}
 		}
 
-		// And loop over all the mesh's triangles
-		for (int i = 0; i < max; i += increment)
+		// Convert the vertices of the remaining triangles to NDC space at once (each vertex is only transformed once, no matter how many triangles share it)
+		// and only keep the attributes its shading is going to read
+		const uint32_t vertexStreams = GetVertexStreams(mesh, transparencyOn);
+		const uint32_t firstVertexIdx = ConvertVerticesScreenSpace(vertices, transformMatrix, pCamera->GetViewMatrix(), pCamera->GetFov(), pCamera->GetFar(), pCamera->GetNear(),
+			cameraPos, vertexStreams, m_UsedVertices.data());
+
+		// And loop over all the mesh's remaining triangles
+		for (size_t i = 0; i < m_VisibleTriangles.size(); i += 3)
 		{
-			// Get the triangle vertices
-			const VS_INPUT& v0 = vertices[indexes[i]];
-			VS_INPUT v1{ {0.f, 0.f, 0.f} };
-			VS_INPUT v2{ {0.f, 0.f, 0.f} };
+			// Get the indexes of the triangle vertices in the post-transform buffer
+			const uint32_t triangleIdxs[3]{ firstVertexIdx + m_VisibleTriangles[i], firstVertexIdx + m_VisibleTriangles[i + 1], firstVertexIdx + m_VisibleTriangles[i + 2] };
 
-			// If it's a TriangleStreep and it's an odd i, invert the 2nd and 3rd vertex order
-			if (primTopology == D3D10_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP && i % 2 != 0)
+			const uint16_t clipCode0 = m_ClipCodes[triangleIdxs[0]];
+			const uint16_t clipCode1 = m_ClipCodes[triangleIdxs[1]];
+			const uint16_t clipCode2 = m_ClipCodes[triangleIdxs[2]];
+
+			// Ignore triangles with all their vertexes outside the same plane of the camera frustum (frustum culling)
+			// This is done in clip space, before the perspective divide, so it also works for vertexes behind the camera
+			if ((clipCode0 & clipCode1 & clipCode2 & m_FrustumClipCodes) != 0)
 			{
-				v1 = vertices[indexes[size_t(i) + 2]];
-				v2 = vertices[indexes[size_t(i) + 1]];
+				m_SoftwareStats.AmountFrustumCulledTriangles++;
+				continue;
 			}
-			else
+
+			// Triangles crossing the near or far plane, or reaching out of the guard band, have to be clipped first
+			// The rest are rasterized as they are, even if they're partially off screen (their bounding box is clamped to the screen anyway)
+			if (((clipCode0 | clipCode1 | clipCode2) & m_ClippingClipCodes) != 0)
 			{
-				v1 = vertices[indexes[size_t(i) + 1]];
-				v2 = vertices[indexes[size_t(i) + 2]];
+				m_SoftwareStats.AmountClippedTriangles++;
+				ClipTriangle(mesh, triangleIdxs, transparencyOn, vertexStreams);
+				continue;
 			}
 
-			// And convert the vertices to NDC space (storing the transformed result in a separate container)
-			const auto& viewMatrix = pCamera->GetViewMatrix();
-			m_TransformedVerticesTriangle[0] = v0;
-			m_TransformedVerticesTriangle[1] = v1;
-			m_TransformedVerticesTriangle[2] = v2;
-			const auto cameraPos = pCamera->GetPosition();
-			ConvertVerticesScreenSpace(mesh->GetTransformMatrix(false), viewMatrix, pCamera->GetFov(), pCamera->GetFar(), pCamera->GetNear(), cameraPos);
+			// Set up the triangle's edge functions and hand it over to every tile it overlaps
+			BinTriangle(mesh, triangleIdxs, transparencyOn);
+		}
+	}
+
+	// Now that every tile knows how many triangles it has, hand them over to their bins
+	FillTileBins();
+
+	// Clear, rasterize and shade all the tiles in parallel - each tile only touches its own pixels, so they can be written without locking
+	const auto backgroundColor = pScene->GetBackgroundColor();
+	const auto lightDirection = pScene->GetLightDirection();
+	const auto lightIntensity = pScene->GetLightIntensity();
+	const auto ambientLight = pScene->GetAmbientLight();
+	m_pThreadPool->ParallelFor(m_AmountTilesX * m_AmountTilesY, [&](uint32_t tileIdx)
+	{
+		RenderTile(tileIdx, backgroundColor, lightDirection, lightIntensity, ambientLight, m_TileStats[tileIdx], m_TileClearColors[tileIdx]);
+	});
+
+	// Add up the statistics of all the tiles
+	for (const auto& tileStats : m_TileStats)
+	{
+		m_SoftwareStats.AmountFragments += tileStats.AmountFragments;
+		m_SoftwareStats.AmountShadedFragments += tileStats.AmountShadedFragments;
+		m_SoftwareStats.AmountCoveredPixels += tileStats.AmountCoveredPixels;
+		m_SoftwareStats.AmountHiZRejectedBlocks += tileStats.AmountHiZRejectedBlocks;
+		m_SoftwareStats.AmountHiZRejectedPixels += tileStats.AmountHiZRejectedPixels;
+	}
+
+	SDL_UnlockSurface(pRenderTarget);
+	if (m_pBackBuffer != nullptr)
+		SDL_BlitSurface(m_pBackBuffer, 0, m_pFrontBuffer, 0);
+	SDL_UpdateWindowSurface(m_pWindow);
+}
+
+uint32_t Elite::Renderer::GetFastMathError(Scene* pScene, SAMPLER_FILTER samplerFilter, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh)
+{
+	if (!m_SoftwareInitialized)
+		return 0;
+
+	// Render the frame both ways, keeping a copy of each one's pixels
+	const bool fastMathOn = m_FastMathOn;
+	SDL_Surface* pRenderTarget = m_pBackBuffer != nullptr ? m_pBackBuffer : m_pFrontBuffer;
+	std::vector<uint32_t> pixels[2]{};
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		m_FastMathOn = i == 1;
+		RenderSoftware(pScene, samplerFilter, cullMode, fireFXVisible, pFireMesh);
+		SDL_LockSurface(pRenderTarget);
+		const auto* pPixels = static_cast<const uint32_t*>(pRenderTarget->pixels);
+		pixels[i].assign(pPixels, pPixels + (m_Width * m_Height));
+		SDL_UnlockSurface(pRenderTarget);
+	}
+	m_FastMathOn = fastMathOn;
 
-			// Check for culling
-			if (cullMode != CULL_MODE::None && mesh != pFireMesh) //// If it's NoCull (or the it's the fireMesh, which requires NoCull), jump this portion of code
+	// And find the biggest difference, channel by channel
+	uint32_t maxError = 0;
+	for (uint32_t i = 0; i < m_Width * m_Height; ++i)
+	{
+		for (uint32_t shift = 0; shift < 24; shift += 8)
+		{
+			const auto exact = int32_t((pixels[0][i] >> shift) & 0xFF);
+			const auto fast = int32_t((pixels[1][i] >> shift) & 0xFF);
+			maxError = std::max(maxError, uint32_t(std::abs(exact - fast)));
+		}
+	}
+	return maxError;
+}
+
+// A vertex of a triangle that's being clipped (with its attributes not divided by w, since they're linear in clip space)
+struct ClipVertex
+{
+	Elite::FPoint4 ClipPosition;
+	Elite::FPoint3 WorldPosition;
+	float Attributes[Elite::AmountVertexStreams];
+};
+
+void Elite::Renderer::ClipTriangle(const Mesh* pMesh, const uint32_t* pVertexIdxs, bool transparencyOn, uint32_t vertexStreams)
+{
+	// Clip the triangle against one plane at a time (Sutherland-Hodgman), in clip space
+	// Every plane can add one vertex at most, so the polygon never gets bigger than the triangle plus one vertex per plane
+	const uint32_t maxAmountVertices = 3 + 6;
+	ClipVertex polygon[maxAmountVertices]{};
+	ClipVertex clippedPolygon[maxAmountVertices]{};
+	uint32_t amountVertices = 3;
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		polygon[i].ClipPosition = m_ClipPositions[pVertexIdxs[i]];
+		polygon[i].WorldPosition = m_WorldPositions[pVertexIdxs[i]];
+		for (uint32_t stream = 0; stream < AmountVertexStreams; ++stream)
+		{
+			if (vertexStreams & (1 << stream))
+				polygon[i].Attributes[stream] = m_VertexStreams[stream][pVertexIdxs[i]] * polygon[i].ClipPosition.w;
+		}
+	}
+
+	// Only the planes some vertex is actually outside of need to be checked
+	const uint16_t planesToClip = (m_ClipCodes[pVertexIdxs[0]] | m_ClipCodes[pVertexIdxs[1]] | m_ClipCodes[pVertexIdxs[2]]) & m_ClippingClipCodes;
+	for (uint16_t plane = 1; plane <= planesToClip; plane <<= 1)
+	{
+		if ((planesToClip & plane) == 0)
+			continue;
+
+		uint32_t amountClippedVertices = 0;
+		for (uint32_t i = 0; i < amountVertices; ++i)
+		{
+			const ClipVertex& current = polygon[i];
+			const ClipVertex& next = polygon[(i + 1) % amountVertices];
+			const float currentDistance = GetClipPlaneDistance(current.ClipPosition, plane);
+			const float nextDistance = GetClipPlaneDistance(next.ClipPosition, plane);
+
+			// Keep the vertexes on the inside, and add a new one wherever an edge crosses the plane
+			if (currentDistance >= 0.f)
+				clippedPolygon[amountClippedVertices++] = current;
+			if ((currentDistance >= 0.f) != (nextDistance >= 0.f))
 			{
-				//const auto triangleNormal = GetNormalized(m_TransformedVerticesTriangle[0].Normal + m_TransformedVerticesTriangle[1].Normal +
-				//	m_TransformedVerticesTriangle[2].Normal);
-				const auto triangleNormal = GetNormalized(Cross(m_TransformedVerticesTriangle[1].Position.xyz - m_TransformedVerticesTriangle[0].Position.xyz,
-					m_TransformedVerticesTriangle[2].Position.xyz - m_TransformedVerticesTriangle[0].Position.xyz));
-				
-				const auto triangleWorldPos = FPoint4(FVector4(m_TransformedVerticesTriangle[0].WorldPosition + FVector4(m_TransformedVerticesTriangle[1].WorldPosition) +
-					FVector4(m_TransformedVerticesTriangle[2].WorldPosition)) / 3.f);
-				
-				const FVector3 cameraToTriangle = GetNormalized(triangleWorldPos.xyz - cameraPos);
-				auto dotProd = Dot(triangleNormal, cameraToTriangle);
-				if (dotProd > 0.f) //// If the ray hits from the back
+				const float t = currentDistance / (currentDistance - nextDistance);
+				ClipVertex& newVertex = clippedPolygon[amountClippedVertices++];
+				newVertex.ClipPosition = current.ClipPosition + (next.ClipPosition - current.ClipPosition) * t;
+				newVertex.WorldPosition = current.WorldPosition + (next.WorldPosition - current.WorldPosition) * t;
+				for (uint32_t stream = 0; stream < AmountVertexStreams; ++stream)
+					newVertex.Attributes[stream] = current.Attributes[stream] + (next.Attributes[stream] - current.Attributes[stream]) * t;
+			}
+		}
+
+		amountVertices = amountClippedVertices;
+		for (uint32_t i = 0; i < amountVertices; ++i)
+			polygon[i] = clippedPolygon[i];
+
+		// Nothing left of the triangle on the inside
+		if (amountVertices < 3)
+			return;
+	}
+
+	// Add the polygon's vertexes at the end of the post-transform buffer (now all in front of the camera, so the perspective divide is safe)
+	const uint32_t firstVertexIdx = AddVertices(amountVertices);
+	for (uint32_t i = 0; i < amountVertices; ++i)
+	{
+		const uint32_t vertexIdx = firstVertexIdx + i;
+		const FPoint4& clipPos = polygon[i].ClipPosition;
+		const FPoint4 ndcPos = FPoint4(clipPos.x / clipPos.w, clipPos.y / clipPos.w, clipPos.z / clipPos.w, clipPos.w);
+		m_ClipPositions[vertexIdx] = clipPos;
+		m_ClipCodes[vertexIdx] = GetClipCode(clipPos);
+		m_NdcPositions[vertexIdx] = ndcPos.xyz;
+		m_WorldPositions[vertexIdx] = polygon[i].WorldPosition;
+		m_RasterPositions[vertexIdx] = GetRasterPosition(ndcPos);
+		m_InvW[vertexIdx] = 1.f / clipPos.w;
+		for (uint32_t stream = 0; stream < AmountVertexStreams; ++stream)
+		{
+			if (vertexStreams & (1 << stream))
+				m_VertexStreams[stream][vertexIdx] = polygon[i].Attributes[stream] * m_InvW[vertexIdx];
+		}
+	}
+
+	// And split it back into triangles (a fan keeps the original winding)
+	for (uint32_t i = 1; i + 1 < amountVertices; ++i)
+	{
+		const uint32_t triangleIdxs[3]{ firstVertexIdx, firstVertexIdx + i, firstVertexIdx + i + 1 };
+		BinTriangle(pMesh, triangleIdxs, transparencyOn);
+	}
+}
+
+uint16_t Elite::Renderer::GetClipCode(const FPoint4& clipPos) const
+{
+	uint16_t clipCode = 0;
+	for (uint16_t plane = 1; plane <= m_ClippingClipCodes; plane <<= 1)
+	{
+		if (GetClipPlaneDistance(clipPos, plane) < 0.f)
+			clipCode |= plane;
+	}
+	return clipCode;
+}
+
+float Elite::Renderer::GetClipPlaneDistance(const FPoint4& clipPos, uint16_t plane) const
+{
+	// Signed distance to the plane (up to a scale), which is positive on the inside
+	switch (plane)
+	{
+	case ClipLeft:
+		return clipPos.x + clipPos.w;
+	case ClipRight:
+		return clipPos.w - clipPos.x;
+	case ClipBottom:
+		return clipPos.y + clipPos.w;
+	case ClipTop:
+		return clipPos.w - clipPos.y;
+	case ClipNear:
+		return clipPos.z;
+	case ClipFar:
+		return clipPos.w - clipPos.z;
+	case ClipGuardBandLeft:
+		return clipPos.x + clipPos.w * m_GuardBandScale;
+	case ClipGuardBandRight:
+		return clipPos.w * m_GuardBandScale - clipPos.x;
+	case ClipGuardBandBottom:
+		return clipPos.y + clipPos.w * m_GuardBandScale;
+	case ClipGuardBandTop:
+		return clipPos.w * m_GuardBandScale - clipPos.y;
+	default:
+		return 0.f;
+	}
+}
+
+Elite::IPoint2 Elite::Renderer::GetRasterPosition(const FPoint4& ndcPos) const
+{
+	// Go to screenspace (raster space) and snap to the fixed-point sub-pixel grid
+	// (everything that gets rasterized is inside the guard band, the clamp is only there so vertexes that get clipped still convert safely)
+	const float rasterX = Clamp((ndcPos.x + 1.f) / 2.f * m_Width * m_SubPixelScale, -m_MaxRasterCoord, m_MaxRasterCoord);
+	const float rasterY = Clamp((1 - ndcPos.y) / 2.f * m_Height * m_SubPixelScale, -m_MaxRasterCoord, m_MaxRasterCoord);
+	return IPoint2(int32_t(std::floor(rasterX + 0.5f)), int32_t(std::floor(rasterY + 0.5f)));
+}
+
+void Elite::Renderer::SelectMeshLods(const ECamera* pCamera, bool leftHandCoordSystem, const Mesh* pHiddenMesh)
+{
+	// Pick the level of detail each visible mesh gets drawn at this frame, and count the triangles that saves
+	m_LodStats = LodStats{};
+	for (auto* mesh : m_VisibleMeshes)
+	{
+		if (mesh == pHiddenMesh)
+			continue;
+
+		mesh->SelectLod(pCamera, leftHandCoordSystem);
+		m_LodStats.AmountFullTriangles += uint32_t(mesh->GetGeometry()->GetIndices().size() / 3);
+		m_LodStats.AmountLodTriangles += uint32_t(mesh->GetIndices().size() / 3);
+	}
+}
+
+void Elite::Renderer::BinTriangle(const Mesh* pMesh, const uint32_t* pVertexIdxs, bool transparencyOn)
+{
+	// Get the vertices in (fixed-point) raster space
+	const IPoint2& p0 = m_RasterPositions[pVertexIdxs[0]];
+	const IPoint2& p1 = m_RasterPositions[pVertexIdxs[1]];
+	const IPoint2& p2 = m_RasterPositions[pVertexIdxs[2]];
+
+	// Calculate the (doubled) area, and skip degenerate triangles
+	int64_t totalArea = int64_t(p1.x - p0.x) * (p2.y - p0.y) - int64_t(p1.y - p0.y) * (p2.x - p0.x);
+	if (totalArea == 0)
+		return;
+
+	// Set up the edge functions - each one is opposite to the vertex whose weight it gives (so edge 0 goes from p1 to p2, and so on)
+	BinnedTriangle triangle{};
+	const IPoint2* pEdgeStarts[3]{ &p1, &p2, &p0 };
+	const IPoint2* pEdgeEnds[3]{ &p2, &p0, &p1 };
+	for (int i = 0; i < 3; ++i)
+	{
+		// Flip the edge if the triangle's winding is the other way around, so the inside is always where E(x, y) >= 0
+		int64_t edgeX = int64_t(pEdgeEnds[i]->x) - pEdgeStarts[i]->x;
+		int64_t edgeY = int64_t(pEdgeEnds[i]->y) - pEdgeStarts[i]->y;
+		if (totalArea < 0)
+		{
+			edgeX = -edgeX;
+			edgeY = -edgeY;
+		}
+
+		EdgeFunction& edge = triangle.Edges[i];
+		edge.A = -edgeY;
+		edge.B = edgeX;
+		edge.C = -(edge.A * pEdgeStarts[i]->x + edge.B * pEdgeStarts[i]->y);
+
+		// Top-left fill rule: pixels exactly on an edge only belong to the triangle if it's a top or left edge (y goes down in raster space)
+		const bool isTopLeft = (edgeY == 0 && edgeX > 0) || edgeY < 0;
+		edge.MinValue = isTopLeft ? 0 : 1;
+	}
+	// And normalize the barycentric weights only once, for the whole triangle
+	triangle.InvArea = 1.f / float(std::abs(totalArea));
+
+	// Calculate the bounding box of the pixels whose center (x + 0.5, y + 0.5) can be covered
+	const int32_t minX = std::min(p0.x, std::min(p1.x, p2.x));
+	const int32_t minY = std::min(p0.y, std::min(p1.y, p2.y));
+	const int32_t maxX = std::max(p0.x, std::max(p1.x, p2.x));
+	const int32_t maxY = std::max(p0.y, std::max(p1.y, p2.y));
+	const int32_t halfPixel = m_SubPixelScale / 2;
+	const int32_t firstX = (minX - halfPixel + m_SubPixelScale - 1) >> m_SubPixelBits;
+	const int32_t firstY = (minY - halfPixel + m_SubPixelScale - 1) >> m_SubPixelBits;
+	const int32_t lastX = (maxX - halfPixel) >> m_SubPixelBits;
+	const int32_t lastY = (maxY - halfPixel) >> m_SubPixelBits;
+
+	// Make sure the box doesn't exceed screen boundaries (and skip the triangle if nothing's left)
+	triangle.MinX = uint32_t(std::max(firstX, 0));
+	triangle.MinY = uint32_t(std::max(firstY, 0));
+	triangle.MaxX = uint32_t(Clamp(lastX + 1, 0, int32_t(m_Width)));
+	triangle.MaxY = uint32_t(Clamp(lastY + 1, 0, int32_t(m_Height)));
+	if (triangle.MinX >= triangle.MaxX || triangle.MinY >= triangle.MaxY)
+		return;
+
+	// Store the triangle (it only references its vertices in the post-transform buffer)
+	triangle.pMesh = pMesh;
+	triangle.VertexIdxs[0] = pVertexIdxs[0];
+	triangle.VertexIdxs[1] = pVertexIdxs[1];
+	triangle.VertexIdxs[2] = pVertexIdxs[2];
+	triangle.TransparencyOn = transparencyOn;
+
+	// Keep the closest depth the triangle can have, for the Hi-Z (with a bit of slack for the rounding in the per-pixel interpolation)
+	// The interpolated depth is a weighted average of the vertices' depths, so it never gets closer than the closest of them
+	const float minDepth = std::min(m_NdcPositions[pVertexIdxs[0]].z, std::min(m_NdcPositions[pVertexIdxs[1]].z, m_NdcPositions[pVertexIdxs[2]].z));
+	triangle.MinDepth = minDepth - 1e-6f;
+	m_BinnedTriangles.push_back(triangle);
+
+	// And count it in every tile its bounding box touches (it only gets added to their bins once all the triangles are in)
+	const uint32_t lastTileX = (triangle.MaxX - 1) / m_TileSize;
+	const uint32_t lastTileY = (triangle.MaxY - 1) / m_TileSize;
+	for (uint32_t tileY = triangle.MinY / m_TileSize; tileY <= lastTileY; ++tileY)
+	{
+		for (uint32_t tileX = triangle.MinX / m_TileSize; tileX <= lastTileX; ++tileX)
+			m_TileBinOffsets[tileX + (tileY * m_AmountTilesX) + 1]++;
+	}
+}
+
+void Elite::Renderer::FillTileBins()
+{
+	// Turn the triangle counts into where each tile's bin starts (bin i goes from offset i to offset i + 1)
+	const uint32_t amountTiles = m_AmountTilesX * m_AmountTilesY;
+	for (uint32_t i = 0; i < amountTiles; ++i)
+	{
+		m_TileBinOffsets[i + 1] += m_TileBinOffsets[i];
+		m_TileBinCursors[i] = m_TileBinOffsets[i];
+	}
+
+	// The packed bins only ever grow, so they stop allocating once they're big enough for the busiest frame
+	if (m_TileBinOffsets[amountTiles] > m_TileBinTriangles.size())
+		m_TileBinTriangles.resize(std::max(size_t(m_TileBinOffsets[amountTiles]), m_TileBinTriangles.size() * 2));
+
+	// And fill the bins in submission order, which keeps the result deterministic
+	const auto amountTriangles = uint32_t(m_BinnedTriangles.size());
+	for (uint32_t triangleIdx = 0; triangleIdx < amountTriangles; ++triangleIdx)
+	{
+		const BinnedTriangle& triangle = m_BinnedTriangles[triangleIdx];
+		const uint32_t lastTileX = (triangle.MaxX - 1) / m_TileSize;
+		const uint32_t lastTileY = (triangle.MaxY - 1) / m_TileSize;
+		for (uint32_t tileY = triangle.MinY / m_TileSize; tileY <= lastTileY; ++tileY)
+		{
+			for (uint32_t tileX = triangle.MinX / m_TileSize; tileX <= lastTileX; ++tileX)
+				m_TileBinTriangles[m_TileBinCursors[tileX + (tileY * m_AmountTilesX)]++] = triangleIdx;
+		}
+	}
+}
+
+void Elite::Renderer::RenderTile(uint32_t tileIdx, const RGBColor& backgroundColor, const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight,
+	RenderStats& tileStats, uint32_t& tileClearColor) const
+{
+	// Get the pixel bounds of the tile
+	TileContext tile{};
+	tile.MinX = (tileIdx % m_AmountTilesX) * m_TileSize;
+	tile.MinY = (tileIdx / m_AmountTilesX) * m_TileSize;
+	tile.MaxX = std::min(tile.MinX + m_TileSize, m_Width);
+	tile.MaxY = std::min(tile.MinY + m_TileSize, m_Height);
+
+	// If nothing got drawn on the tile last frame, its depth is still cleared, and so are its pixels (as long as the background didn't change)
+	const Span<const uint32_t> tileBin(m_TileBinTriangles.data() + m_TileBinOffsets[tileIdx], m_TileBinOffsets[tileIdx + 1] - m_TileBinOffsets[tileIdx]);
+	const uint32_t packedBackgroundColor = PackColor(backgroundColor.r, backgroundColor.g, backgroundColor.b);
+	const bool depthCleared = tileClearColor != m_DirtyTile;
+	const bool pixelsCleared = tileClearColor == packedBackgroundColor;
+
+	// Tiles without any triangles just need to be clear
+	if (tileBin.empty())
+	{
+		if (pixelsCleared == false)
+			ClearTile(tile, depthCleared == false, true, packedBackgroundColor);
+		tileClearColor = packedBackgroundColor;
+		tileStats = tile.Stats;
+		return;
+	}
+
+	// The rest get cleared right before they're rasterized, while this thread has them in its cache
+	// (with the visibility buffer, the resolve pass writes every pixel of the tile anyway, so the background goes in along with the shaded pixels)
+	ClearTile(tile, depthCleared == false, pixelsCleared == false && m_VisibilityBufferOn == false, packedBackgroundColor);
+	tileClearColor = m_DirtyTile;
+
+	// The depth buffer was just cleared, so every block of the tile starts out as far away as it gets
+	for (auto& maxDepth : tile.HiZMaxDepths)
+		maxDepth = FLT_MAX;
+
+	// Go over the tile's opaque triangles, in the order they were submitted
+	if (m_VisibilityBufferOn)
+	{
+		// 1st pass: rasterize only the opaque triangles, keeping just the closest one of each pixel in the visibility buffer
+		for (const auto triangleIdx : tileBin)
+		{
+			if (m_BinnedTriangles[triangleIdx].TransparencyOn == false)
+				RasterizeTriangle(triangleIdx, tile, true, lightDirection, lightIntensity, ambientLight);
+		}
+
+		// 2nd pass: shade every visible pixel exactly once
+		ResolveVisibilityTile(tile, backgroundColor, lightDirection, lightIntensity, ambientLight);
+	}
+	else
+	{
+		for (const auto triangleIdx : tileBin)
+		{
+			if (m_BinnedTriangles[triangleIdx].TransparencyOn == false)
+				RasterizeTriangle(triangleIdx, tile, false, lightDirection, lightIntensity, ambientLight);
+		}
+	}
+
+	// Then the transparent triangles only accumulate their fragments (tested against the opaque depth), in whatever order they come
+	bool hasTransparency = false;
+	for (const auto triangleIdx : tileBin)
+	{
+		if (m_BinnedTriangles[triangleIdx].TransparencyOn)
+		{
+			RasterizeTriangle(triangleIdx, tile, false, lightDirection, lightIntensity, ambientLight);
+			hasTransparency = true;
+		}
+	}
+
+	// And get composited on top of the opaque pixels in a single pass
+	if (hasTransparency)
+		CompositeTransparentTile(tile);
+
+	// Count the pixels that got covered
+	for (uint32_t r = 0; r < tile.MaxY - tile.MinY; ++r)
+	{
+		for (uint64_t rowMask = tile.CoveredRows[r]; rowMask != 0; rowMask &= rowMask - 1)
+			tile.Stats.AmountCoveredPixels++;
+	}
+	tileStats = tile.Stats;
+}
+
+void Elite::Renderer::ClearTile(const TileContext& tile, bool clearDepth, bool clearPixels, uint32_t packedBackgroundColor) const
+{
+	for (uint32_t r = tile.MinY; r < tile.MaxY; ++r)
+	{
+		if (clearDepth)
+			std::fill(m_pDepthBuffer + tile.MinX + (r * m_Width), m_pDepthBuffer + tile.MaxX + (r * m_Width), FLT_MAX);
+		if (clearPixels)
+			std::fill(m_pBackBufferPixels + tile.MinX + (r * m_Width), m_pBackBufferPixels + tile.MaxX + (r * m_Width), packedBackgroundColor);
+	}
+}
+
+void Elite::Renderer::RasterizeTriangle(uint32_t triangleIdx, TileContext& tile, bool toVisibilityBuffer, const FVector3& lightDirection, float lightIntensity,
+	const FVector3& ambientLight) const
+{
+	const BinnedTriangle& triangle = m_BinnedTriangles[triangleIdx];
+
+	// Loop over only the pixels inside both the bounding box and the tile
+	const uint32_t minX = std::max(triangle.MinX, tile.MinX);
+	const uint32_t minY = std::max(triangle.MinY, tile.MinY);
+	const uint32_t maxX = std::min(triangle.MaxX, tile.MaxX);
+	const uint32_t maxY = std::min(triangle.MaxY, tile.MaxY);
+	if (minX >= maxX || minY >= maxY)
+		return;
+
+	// Evaluate the edge functions once, at the center of the first pixel, and from there on just step them
+	const int64_t startX = (int64_t(minX) << m_SubPixelBits) + m_SubPixelScale / 2;
+	const int64_t startY = (int64_t(minY) << m_SubPixelBits) + m_SubPixelScale / 2;
+	int64_t rowEdges[3]{};
+	for (int i = 0; i < 3; ++i)
+		rowEdges[i] = triangle.Edges[i].A * startX + triangle.Edges[i].B * startY + triangle.Edges[i].C;
+
+	// The ndc depth is affine in screen space, so it's interpolated straight from the vertices' (which are never behind the near plane after clipping)
+	const float depths[3]{ m_NdcPositions[triangle.VertexIdxs[0]].z, m_NdcPositions[triangle.VertexIdxs[1]].z, m_NdcPositions[triangle.VertexIdxs[2]].z };
+
+	// The vectorized kernel works with 32-bit edge values, so it only takes the triangle if those fit for all its pixels in this tile
+	const bool useVectorized = m_VectorizedRasterizerOn && FitsVectorizedRasterizer(triangle, minX, minY, maxX, maxY);
+
+	// Only the textured triangles need UV derivatives (and only when they pick a mip level)
+	const bool needsUVDerivatives = m_MipmapsOn && triangle.pMesh->GetDiffuseTexture() != nullptr;
+
+	// Go over the triangle one band of Hi-Z blocks at a time
+	RowCoverage coverage{};
+	uint32_t bandMaxY = minY;
+	for (uint32_t bandMinY = minY; bandMinY < maxY; bandMinY = bandMaxY)
+	{
+		bandMaxY = std::min((bandMinY / m_HiZBlockSize + 1) * m_HiZBlockSize, maxY);
+
+		// Skip the blocks that are already closer than anything this triangle can put in them, and gather the rest in spans of consecutive blocks
+		uint32_t spanMinXs[m_TileSize / m_HiZBlockSize]{}, spanMaxXs[m_TileSize / m_HiZBlockSize]{};
+		uint32_t amountSpans = 0;
+		for (uint32_t blockX = minX / m_HiZBlockSize; blockX <= (maxX - 1) / m_HiZBlockSize; ++blockX)
+		{
+			const uint32_t blockMinX = std::max(blockX * m_HiZBlockSize, minX);
+			const uint32_t blockMaxX = std::min((blockX + 1) * m_HiZBlockSize, maxX);
+			if (m_HiZOn && triangle.MinDepth >= GetHiZMaxDepth(tile, blockX * m_HiZBlockSize, bandMinY))
+			{
+				tile.Stats.AmountHiZRejectedBlocks++;
+				tile.Stats.AmountHiZRejectedPixels += (blockMaxX - blockMinX) * (bandMaxY - bandMinY);
+				continue;
+			}
+
+			if (amountSpans > 0 && spanMaxXs[amountSpans - 1] == blockMinX)
+				spanMaxXs[amountSpans - 1] = blockMaxX;
+			else
+			{
+				spanMinXs[amountSpans] = blockMinX;
+				spanMaxXs[amountSpans] = blockMaxX;
+				amountSpans++;
+			}
+		}
+
+		for (uint32_t r = bandMinY; r < bandMaxY; ++r)
+		{
+			// Find which pixels of the row are inside the triangle and pass the depth test
+			coverage.Mask = 0;
+			for (uint32_t span = 0; span < amountSpans; ++span)
+			{
+				if (useVectorized)
+					CoverRowVectorized(triangle, rowEdges, depths, minX, spanMinXs[span], spanMaxXs[span], r, coverage);
+				else
+					CoverRowScalar(triangle, rowEdges, depths, minX, spanMinXs[span], spanMaxXs[span], r, coverage);
+			}
+			tile.CoveredRows[r - tile.MinY] |= coverage.Mask << (minX - tile.MinX);
+
+			// And shade them (or just leave them in the visibility buffer, to be shaded later)
+			// Textured triangles also need the UV derivatives for the mip levels, which are shared by each 2x2 quad of pixels
+			uint64_t shadedMask = 0;
+			uint32_t quadX = UINT32_MAX;
+			FVector2 uvDx{}, uvDy{};
+			for (uint32_t i = 0; i < maxX - minX; ++i)
+			{
+				if ((coverage.Mask & (uint64_t(1) << i)) == 0)
+					continue;
+
+				const uint32_t c = minX + i;
+				tile.Stats.AmountFragments++;
+
+				// Only replace the value in the buffer if it's not a material with transparency (and let the Hi-Z know that block changed)
+				if (triangle.TransparencyOn == false)
 				{
-					if (cullMode == CULL_MODE::Back) //// If it's BackFacing Mode, return false
-						continue;
+					m_pDepthBuffer[c + (r * m_Width)] = coverage.Depth[i];
+					tile.HiZDirtyBlocks |= uint64_t(1) << GetHiZBlockIdx(tile, c, r);
 				}
-				else //// If the ray hits from the front
+
+				if (toVisibilityBuffer)
 				{
-					if (cullMode == CULL_MODE::Front) //// If it's FrontFacing Mode, return false
-						continue;
+					m_pVisibilityBuffer[c + (r * m_Width)] = triangleIdx;
+					continue;
 				}
-			}
-			
-			// Ignore triangles with vertexes outside camera frustum (frustum culling)
-			bool shouldIgnore = true;
-			for (const auto& vertex : m_TransformedVerticesTriangle)
-			{
-				if (vertex.Position.x >= -1.f && vertex.Position.x <= 1.f && vertex.Position.y >= -1.f && vertex.Position.y <= 1.f && vertex.Position.z >= 0.f && vertex.Position.z <= 1.f)
+
+				if (needsUVDerivatives && (c & ~1u) != quadX)
 				{
-					shouldIgnore = false;
-					break;
+					quadX = c & ~1u;
+					GetQuadUVDerivatives(triangle, c, r, uvDx, uvDy);
 				}
+
+				tile.Stats.AmountShadedFragments++;
+				if (triangle.TransparencyOn)
+				{
+					AccumulateTransparentPixel(triangle, coverage.W0[i], coverage.W1[i], coverage.W2[i], uvDx, uvDy, c, r, tile);
+					continue;
+				}
+
+				const RGBColor finalColor = CalculatePixel(triangle, coverage.W0[i], coverage.W1[i], coverage.W2[i], uvDx, uvDy, lightDirection, lightIntensity, ambientLight);
+				tile.RowColorsR[i] = finalColor.r;
+				tile.RowColorsG[i] = finalColor.g;
+				tile.RowColorsB[i] = finalColor.b;
+				shadedMask |= uint64_t(1) << i;
 			}
-			if (shouldIgnore)
+
+			// Then put all the row's new colors in the back buffer at once
+			if (shadedMask != 0)
+				WriteRowColors(tile, shadedMask, minX, maxX - minX, r);
+
+			for (int i = 0; i < 3; ++i)
+				rowEdges[i] += triangle.Edges[i].B << m_SubPixelBits;
+		}
+	}
+}
+
+float Elite::Renderer::GetHiZMaxDepth(TileContext& tile, uint32_t x, uint32_t y) const
+{
+	// Only go over the block's depths again if any of them has been written since the last time
+	const uint32_t blockIdx = GetHiZBlockIdx(tile, x, y);
+	const uint64_t blockBit = uint64_t(1) << blockIdx;
+	if (tile.HiZDirtyBlocks & blockBit)
+	{
+		const uint32_t blockMinX = tile.MinX + (blockIdx % (m_TileSize / m_HiZBlockSize)) * m_HiZBlockSize;
+		const uint32_t blockMinY = tile.MinY + (blockIdx / (m_TileSize / m_HiZBlockSize)) * m_HiZBlockSize;
+		const uint32_t blockMaxX = std::min(blockMinX + m_HiZBlockSize, tile.MaxX);
+		const uint32_t blockMaxY = std::min(blockMinY + m_HiZBlockSize, tile.MaxY);
+
+		float maxDepth = -FLT_MAX;
+		for (uint32_t r = blockMinY; r < blockMaxY; ++r)
+		{
+			for (uint32_t c = blockMinX; c < blockMaxX; ++c)
+				maxDepth = std::max(maxDepth, m_pDepthBuffer[c + (r * m_Width)]);
+		}
+
+		tile.HiZMaxDepths[blockIdx] = maxDepth;
+		tile.HiZDirtyBlocks &= ~blockBit;
+	}
+	return tile.HiZMaxDepths[blockIdx];
+}
+
+uint32_t Elite::Renderer::GetHiZBlockIdx(const TileContext& tile, uint32_t x, uint32_t y) const
+{
+	return ((x - tile.MinX) / m_HiZBlockSize) + ((y - tile.MinY) / m_HiZBlockSize) * (m_TileSize / m_HiZBlockSize);
+}
+
+void Elite::Renderer::ResolveVisibilityTile(TileContext& tile, const RGBColor& backgroundColor, const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight) const
+{
+	for (uint32_t r = tile.MinY; r < tile.MaxY; ++r)
+	{
+		uint64_t shadedMask = 0;
+		uint32_t quadX = UINT32_MAX;
+		const BinnedTriangle* pQuadTriangle = nullptr;
+		FVector2 uvDx{}, uvDy{};
+		for (uint32_t c = tile.MinX; c < tile.MaxX; ++c)
+		{
+			// Pixels that no opaque triangle reached still have the cleared depth (and an outdated triangle in the visibility buffer), so they just get the background
+			const uint32_t pixelIdx = c + (r * m_Width);
+			const uint32_t i = c - tile.MinX;
+			shadedMask |= uint64_t(1) << i;
+			if ((m_pDepthBuffer[pixelIdx] < FLT_MAX) == false)
+			{
+				tile.RowColorsR[i] = backgroundColor.r;
+				tile.RowColorsG[i] = backgroundColor.g;
+				tile.RowColorsB[i] = backgroundColor.b;
 				continue;
+			}
+
+			const BinnedTriangle& triangle = m_BinnedTriangles[m_pVisibilityBuffer[pixelIdx]];
+
+			// Get the weights back from the edge functions at the pixel center (they're integers, so these are the exact same values the rasterizer had)
+			const int64_t pixelX = (int64_t(c) << m_SubPixelBits) + m_SubPixelScale / 2;
+			const int64_t pixelY = (int64_t(r) << m_SubPixelBits) + m_SubPixelScale / 2;
+			const float w0 = float(triangle.Edges[0].A * pixelX + triangle.Edges[0].B * pixelY + triangle.Edges[0].C) * triangle.InvArea;
+			const float w1 = float(triangle.Edges[1].A * pixelX + triangle.Edges[1].B * pixelY + triangle.Edges[1].C) * triangle.InvArea;
+			const float w2 = float(triangle.Edges[2].A * pixelX + triangle.Edges[2].B * pixelY + triangle.Edges[2].C) * triangle.InvArea;
 
-			// Convert the vertices from NDC space to screenspace (raster space)
-			for (auto& vertex : m_TransformedVerticesTriangle)
+			// The UV derivatives only have to be calculated again when the quad or the triangle changes
+			if (m_MipmapsOn && triangle.pMesh->GetDiffuseTexture() != nullptr && ((c & ~1u) != quadX || &triangle != pQuadTriangle))
 			{
-				vertex.Position.x = (vertex.Position.x + 1.f) / 2.f * m_Width;
-				vertex.Position.y = (1 - vertex.Position.y) / 2.f * m_Height;
+				quadX = c & ~1u;
+				pQuadTriangle = &triangle;
+				GetQuadUVDerivatives(triangle, c, r, uvDx, uvDy);
 			}
 
-			// Calculate the triangle edges and the area
-			FVector2 edgeA = m_TransformedVerticesTriangle[1].Position.xy - m_TransformedVerticesTriangle[0].Position.xy;
-			FVector2 edgeB = m_TransformedVerticesTriangle[2].Position.xy - m_TransformedVerticesTriangle[1].Position.xy;
-			FVector2 edgeC = m_TransformedVerticesTriangle[0].Position.xy - m_TransformedVerticesTriangle[2].Position.xy;
-			float totalArea = Cross(edgeA, edgeB);
-
-			// Calculate the bounding box
-			float minX = m_TransformedVerticesTriangle[0].Position.x;
-			if (m_TransformedVerticesTriangle[1].Position.x < minX) minX = m_TransformedVerticesTriangle[1].Position.x;
-			if (m_TransformedVerticesTriangle[2].Position.x < minX) minX = m_TransformedVerticesTriangle[2].Position.x;
-			float minY = m_TransformedVerticesTriangle[0].Position.y;
-			if (m_TransformedVerticesTriangle[1].Position.y < minY) minY = m_TransformedVerticesTriangle[1].Position.y;
-			if (m_TransformedVerticesTriangle[2].Position.y < minY) minY = m_TransformedVerticesTriangle[2].Position.y;
-			float maxX = m_TransformedVerticesTriangle[0].Position.x;
-			if (m_TransformedVerticesTriangle[1].Position.x > maxX) maxX = m_TransformedVerticesTriangle[1].Position.x;
-			if (m_TransformedVerticesTriangle[2].Position.x > maxX) maxX = m_TransformedVerticesTriangle[2].Position.x;
-			float maxY = m_TransformedVerticesTriangle[0].Position.y;
-			if (m_TransformedVerticesTriangle[1].Position.y > maxY) maxY = m_TransformedVerticesTriangle[1].Position.y;
-			if (m_TransformedVerticesTriangle[2].Position.y > maxY) maxY = m_TransformedVerticesTriangle[2].Position.y;
-			
-			// Turn the bounds into uint32_t, rounding them out with a pixel margin
-			auto iMinX = uint32_t(minX - 1.f);
-			auto iMinY = uint32_t(minY - 1.f);
-			auto iMaxX = uint32_t(maxX + 1.f);
-			auto iMaxY = uint32_t(maxY + 1.f);
-
-			// Make sure the box doesn't exceed screen boundaries
-			iMinX = std::max(iMinX, uint32_t(0));
-			iMinY = std::max(iMinY, uint32_t(0));
-			iMaxX = std::min(iMaxX, m_Width - 1);
-			iMaxY = std::min(iMaxY, m_Height - 1);
-
-			// Loop over only the pixels inside the bounding box
-			for (uint32_t r = iMinY; r < iMaxY; ++r)
+			tile.Stats.AmountShadedFragments++;
+			const RGBColor finalColor = CalculatePixel(triangle, w0, w1, w2, uvDx, uvDy, lightDirection, lightIntensity, ambientLight);
+			tile.RowColorsR[i] = finalColor.r;
+			tile.RowColorsG[i] = finalColor.g;
+			tile.RowColorsB[i] = finalColor.b;
+		}
+
+		WriteRowColors(tile, shadedMask, tile.MinX, tile.MaxX - tile.MinX, r);
+	}
+}
+
+bool Elite::Renderer::FitsVectorizedRasterizer(const BinnedTriangle& triangle, uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY) const
+{
+	// The edge functions are linear, so their extremes over a rectangle of pixels are always at its corners
+	const int64_t firstX = (int64_t(minX) << m_SubPixelBits) + m_SubPixelScale / 2;
+	const int64_t firstY = (int64_t(minY) << m_SubPixelBits) + m_SubPixelScale / 2;
+	const int64_t lastX = (int64_t(maxX - 1) << m_SubPixelBits) + m_SubPixelScale / 2;
+	const int64_t lastY = (int64_t(maxY - 1) << m_SubPixelBits) + m_SubPixelScale / 2;
+
+	for (const auto& edge : triangle.Edges)
+	{
+		for (const int64_t value : { edge.A * firstX + edge.B * firstY + edge.C, edge.A * lastX + edge.B * firstY + edge.C,
+			edge.A * firstX + edge.B * lastY + edge.C, edge.A * lastX + edge.B * lastY + edge.C })
+		{
+			if (value < INT32_MIN || value > INT32_MAX)
+				return false;
+		}
+	}
+	return true;
+}
+
+void Elite::Renderer::CoverRowScalar(const BinnedTriangle& triangle, const int64_t* pRowEdges, const float* pDepths, uint32_t minX, uint32_t startX, uint32_t maxX, uint32_t r,
+	RowCoverage& coverage) const
+{
+	const EdgeFunction& edge0 = triangle.Edges[0];
+	const EdgeFunction& edge1 = triangle.Edges[1];
+	const EdgeFunction& edge2 = triangle.Edges[2];
+	const int64_t stepX0 = edge0.A << m_SubPixelBits;
+	const int64_t stepX1 = edge1.A << m_SubPixelBits;
+	const int64_t stepX2 = edge2.A << m_SubPixelBits;
+
+	// Step the edge functions from the start of the row to the first pixel asked for
+	int64_t e0 = pRowEdges[0] + stepX0 * (startX - minX);
+	int64_t e1 = pRowEdges[1] + stepX1 * (startX - minX);
+	int64_t e2 = pRowEdges[2] + stepX2 * (startX - minX);
+	const float* pDepthRow = m_pDepthBuffer + (r * m_Width);
+
+	for (uint32_t c = startX; c < maxX; ++c)
+	{
+		// Check if the point is inside all the triangle edges
+		if (e0 >= edge0.MinValue && e1 >= edge1.MinValue && e2 >= edge2.MinValue)
+		{
+			const float w0 = float(e0) * triangle.InvArea;
+			const float w1 = float(e1) * triangle.InvArea;
+			const float w2 = float(e2) * triangle.InvArea;
+
+			// Calculate the depth of the hitpoint
+			const float zDepth = pDepths[0] * w0 + pDepths[1] * w1 + pDepths[2] * w2;
+
+			// And only keep the pixel if it's closer than the one saved in the Depth Buffer
+			if (zDepth < pDepthRow[c])
 			{
-				for (uint32_t c = iMinX; c < iMaxX; ++c)
-				{			
-					// Check if the point is inside all the triangle edges
-					FVector2 pixelCoordinates = { float(c), float(r) };
-						
-					const float w0 = Cross(edgeB, pixelCoordinates - FVector2(m_TransformedVerticesTriangle[1].Position.xy)) / totalArea;
-					const float w1 = Cross(edgeC, pixelCoordinates - FVector2(m_TransformedVerticesTriangle[2].Position.xy)) / totalArea;
-					const float w2 = Cross(edgeA, pixelCoordinates - FVector2(m_TransformedVerticesTriangle[0].Position.xy)) / totalArea;
-					if (w0 >= 0.f && w1 >= 0.f && w2 >= 0.f)
-					{
-						// Calculate the distance between the camera and the hitpoint
-						const float zDepth = 1.f / ((1.f / m_TransformedVerticesTriangle[0].Position.z) * w0 + (1.f / m_TransformedVerticesTriangle[1].Position.z) * w1 + (1.f / m_TransformedVerticesTriangle[2].Position.z) * w2);
-
-						// If the point is closer than the one saved in the Depth Buffer
-						if (zDepth < m_pDepthBuffer[c + (r * m_Width)])
-						{
-							// Only replace the value in the buffer if it's not a material with transparency
-							if (transparencyOn == false)
-								m_pDepthBuffer[c + (r * m_Width)] = zDepth;
-
-							// And calculate the pixel
-							CalculatePixel(pDiffuseText, pNormalText, pSpecularText, pGlossText, shininess, w0, w1, w2, c, r, cameraPos,
-								pScene->GetLightDirection(), pScene->GetLightIntensity(), pScene->GetAmbientLight(), transparencyOn);
-						}
-					}
-				}
+				const uint32_t i = c - minX;
+				coverage.Mask |= uint64_t(1) << i;
+				coverage.W0[i] = w0;
+				coverage.W1[i] = w1;
+				coverage.W2[i] = w2;
+				coverage.Depth[i] = zDepth;
 			}
 		}
+
+		e0 += stepX0;
+		e1 += stepX1;
+		e2 += stepX2;
 	}
+}
 
-	SDL_UnlockSurface(m_pBackBuffer);
-	SDL_BlitSurface(m_pBackBuffer, 0, m_pFrontBuffer, 0);
-	SDL_UpdateWindowSurface(m_pWindow);
+void Elite::Renderer::CoverRowVectorized(const BinnedTriangle& triangle, const int64_t* pRowEdges, const float* pDepths, uint32_t minX, uint32_t startX, uint32_t maxX,
+	uint32_t r, RowCoverage& coverage) const
+{
+	// Same math as CoverRowScalar, just for a whole group of pixels at once (so the results are bit-identical)
+	// The edge values are done in 32 bits: they're known to fit for every pixel in the row, so wrapping around on the way there doesn't matter
+	const float* pDepthRow = m_pDepthBuffer + (r * m_Width);
+	uint32_t c = startX;
+
+#if defined(__AVX2__)
+	// 8 pixels at once
+	const uint32_t amountLanes = 8;
+	__m256i edges[3]{}, edgeSteps[3]{}, minValues[3]{};
+	for (int i = 0; i < 3; ++i)
+	{
+		const int64_t stepX = triangle.Edges[i].A << m_SubPixelBits;
+		edges[i] = _mm256_add_epi32(_mm256_set1_epi32(int32_t(pRowEdges[i] + stepX * (startX - minX))), _mm256_setr_epi32(0, int32_t(stepX), int32_t(stepX * 2), int32_t(stepX * 3),
+			int32_t(stepX * 4), int32_t(stepX * 5), int32_t(stepX * 6), int32_t(stepX * 7)));
+		edgeSteps[i] = _mm256_set1_epi32(int32_t(stepX * amountLanes));
+		minValues[i] = _mm256_set1_epi32(int32_t(triangle.Edges[i].MinValue - 1));
+	}
+	const __m256 invArea = _mm256_set1_ps(triangle.InvArea);
+	const __m256 depth0 = _mm256_set1_ps(pDepths[0]);
+	const __m256 depth1 = _mm256_set1_ps(pDepths[1]);
+	const __m256 depth2 = _mm256_set1_ps(pDepths[2]);
+
+	for (; c + amountLanes <= maxX; c += amountLanes)
+	{
+		// Check which points are inside all the triangle edges
+		const __m256i inside = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(edges[0], minValues[0]), _mm256_cmpgt_epi32(edges[1], minValues[1])),
+			_mm256_cmpgt_epi32(edges[2], minValues[2]));
+		if (_mm256_movemask_epi8(inside) != 0)
+		{
+			const __m256 w0 = _mm256_mul_ps(_mm256_cvtepi32_ps(edges[0]), invArea);
+			const __m256 w1 = _mm256_mul_ps(_mm256_cvtepi32_ps(edges[1]), invArea);
+			const __m256 w2 = _mm256_mul_ps(_mm256_cvtepi32_ps(edges[2]), invArea);
+			const __m256 zDepth = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(depth0, w0), _mm256_mul_ps(depth1, w1)), _mm256_mul_ps(depth2, w2));
+
+			// And which of those are closer than the ones saved in the Depth Buffer
+			const __m256 passed = _mm256_and_ps(_mm256_castsi256_ps(inside), _mm256_cmp_ps(zDepth, _mm256_loadu_ps(pDepthRow + c), _CMP_LT_OQ));
+			const auto passedMask = uint64_t(_mm256_movemask_ps(passed));
+			if (passedMask != 0)
+			{
+				const uint32_t i = c - minX;
+				coverage.Mask |= passedMask << i;
+				_mm256_storeu_ps(coverage.W0 + i, w0);
+				_mm256_storeu_ps(coverage.W1 + i, w1);
+				_mm256_storeu_ps(coverage.W2 + i, w2);
+				_mm256_storeu_ps(coverage.Depth + i, zDepth);
+			}
+		}
+
+		for (int i = 0; i < 3; ++i)
+			edges[i] = _mm256_add_epi32(edges[i], edgeSteps[i]);
+	}
+#else
+	// 4 pixels at once (SSE2 is always there on x64)
+	const uint32_t amountLanes = 4;
+	__m128i edges[3]{}, edgeSteps[3]{}, minValues[3]{};
+	for (int i = 0; i < 3; ++i)
+	{
+		const int64_t stepX = triangle.Edges[i].A << m_SubPixelBits;
+		edges[i] = _mm_add_epi32(_mm_set1_epi32(int32_t(pRowEdges[i] + stepX * (startX - minX))), _mm_setr_epi32(0, int32_t(stepX), int32_t(stepX * 2), int32_t(stepX * 3)));
+		edgeSteps[i] = _mm_set1_epi32(int32_t(stepX * amountLanes));
+		minValues[i] = _mm_set1_epi32(int32_t(triangle.Edges[i].MinValue - 1));
+	}
+	const __m128 invArea = _mm_set1_ps(triangle.InvArea);
+	const __m128 depth0 = _mm_set1_ps(pDepths[0]);
+	const __m128 depth1 = _mm_set1_ps(pDepths[1]);
+	const __m128 depth2 = _mm_set1_ps(pDepths[2]);
+
+	for (; c + amountLanes <= maxX; c += amountLanes)
+	{
+		// Check which points are inside all the triangle edges
+		const __m128i inside = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(edges[0], minValues[0]), _mm_cmpgt_epi32(edges[1], minValues[1])),
+			_mm_cmpgt_epi32(edges[2], minValues[2]));
+		if (_mm_movemask_epi8(inside) != 0)
+		{
+			const __m128 w0 = _mm_mul_ps(_mm_cvtepi32_ps(edges[0]), invArea);
+			const __m128 w1 = _mm_mul_ps(_mm_cvtepi32_ps(edges[1]), invArea);
+			const __m128 w2 = _mm_mul_ps(_mm_cvtepi32_ps(edges[2]), invArea);
+			const __m128 zDepth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(depth0, w0), _mm_mul_ps(depth1, w1)), _mm_mul_ps(depth2, w2));
+
+			// And which of those are closer than the ones saved in the Depth Buffer
+			const __m128 passed = _mm_and_ps(_mm_castsi128_ps(inside), _mm_cmplt_ps(zDepth, _mm_loadu_ps(pDepthRow + c)));
+			const auto passedMask = uint64_t(_mm_movemask_ps(passed));
+			if (passedMask != 0)
+			{
+				const uint32_t i = c - minX;
+				coverage.Mask |= passedMask << i;
+				_mm_storeu_ps(coverage.W0 + i, w0);
+				_mm_storeu_ps(coverage.W1 + i, w1);
+				_mm_storeu_ps(coverage.W2 + i, w2);
+				_mm_storeu_ps(coverage.Depth + i, zDepth);
+			}
+		}
+
+		for (int i = 0; i < 3; ++i)
+			edges[i] = _mm_add_epi32(edges[i], edgeSteps[i]);
+	}
+#endif
+
+	// The last few pixels that don't fill a whole group go through the scalar kernel
+	if (c < maxX)
+		CoverRowScalar(triangle, pRowEdges, pDepths, minX, c, maxX, r, coverage);
+}
+
+uint32_t Elite::Renderer::GetVertexStreams(const Mesh* pMesh, bool transparencyOn) const
+{
+	// Transparent meshes only sample their diffuse texture
+	if (transparencyOn)
+		return StreamBitsUV;
+
+	// Meshes without a texture only interpolate their vertex colors
+	if (pMesh->GetDiffuseTexture() == nullptr)
+		return StreamBitsColor;
+
+	// And the rest only need the tangents for normal mapping, and the view direction for the specular
+	uint32_t vertexStreams = StreamBitsUV | StreamBitsNormal;
+	if (pMesh->GetNormalTexture() != nullptr)
+		vertexStreams |= StreamBitsTangent;
+	if (pMesh->GetSpecularTexture() != nullptr && pMesh->GetGlossinessTexture() != nullptr)
+		vertexStreams |= StreamBitsViewDirection;
+	return vertexStreams;
+}
+
+uint32_t Elite::Renderer::AddVertices(uint32_t amountVertices)
+{
+	// The buffers only ever grow, so after the first few frames adding vertices doesn't allocate (or touch any memory) anymore
+	const uint32_t firstVertexIdx = m_AmountVertices;
+	m_AmountVertices += amountVertices;
+	if (m_AmountVertices > m_InvW.size())
+	{
+		const size_t newSize = std::max(size_t(m_AmountVertices), m_InvW.size() * 2);
+		for (auto& vertexStream : m_VertexStreams)
+			vertexStream.resize(newSize);
+		m_InvW.resize(newSize);
+		m_NdcPositions.resize(newSize);
+		m_WorldPositions.resize(newSize);
+		m_RasterPositions.resize(newSize);
+		m_ClipPositions.resize(newSize);
+		m_ClipCodes.resize(newSize);
+	}
+	return firstVertexIdx;
 }
 
-void Elite::Renderer::ConvertVerticesScreenSpace(const FMatrix4& transformMatrix, const FMatrix4& viewMatrix, float fov, float farPlane, float nearPlane, const FPoint3& cameraPos)
+uint32_t Elite::Renderer::ConvertVerticesScreenSpace(Span<const VS_INPUT> vertices, const FMatrix4& transformMatrix, const FMatrix4& viewMatrix, float fov, float farPlane, float nearPlane,
+	const FPoint3& cameraPos, uint32_t vertexStreams, const uint8_t* pUsedVertices)
 {
 	const auto aspectRatio = static_cast<float>(m_Width) / static_cast<float>(m_Height);
 
@@ -358,173 +1293,434 @@ void Elite::Renderer::ConvertVerticesScreenSpace(const FMatrix4& transformMatrix
 		FVector4{0.f, 0.f, -(farPlane * nearPlane) / (farPlane - nearPlane), 0.f}
 	};
 
-	// Set up the worldViewProjectionMatrix matrix
+	// Set up the worldViewProjectionMatrix matrix (only once for the whole mesh)
 	const FMatrix4 worldViewProjectionMatrix = projectionMatrix * viewMatrix * transformMatrix;
 
-	// Transform each vertex of the triangle
-	for (auto& vertex : m_TransformedVerticesTriangle)
-	{
-		// First the world pos (we just adjust it according to the transformation matrix)
-		//vertex.WorldPosition = transformMatrix * FPoint4(vertex.Position.x, vertex.Position.y, vertex.Position.z, 1.f); // For some reason, the multiplication operator is not working
-		const auto worldPos = FPoint4(vertex.Position.x, vertex.Position.y, vertex.Position.z, 1.f);
-		vertex.WorldPosition = FPoint4(
-			transformMatrix(0, 0) * worldPos.x + transformMatrix(0, 1) * worldPos.y + transformMatrix(0, 2) * worldPos.z + transformMatrix(0, 3),
-			transformMatrix(1, 0) * worldPos.x + transformMatrix(1, 1) * worldPos.y + transformMatrix(1, 2) * worldPos.z + transformMatrix(1, 3),
-			transformMatrix(2, 0) * worldPos.x + transformMatrix(2, 1) * worldPos.y + transformMatrix(2, 2) * worldPos.z + transformMatrix(2, 3),
-			transformMatrix(3, 0) * worldPos.x + transformMatrix(3, 1) * worldPos.y + transformMatrix(3, 2) * worldPos.z + transformMatrix(3, 3));
-
-		// Then the position (with perspective divide)
-		//FPoint4 transformedPos = worldViewProjectionMatrix * vertex.Position; // For some reason, the multiplication operator is not working
-		FPoint4 transformedPos(
-			worldViewProjectionMatrix(0, 0) * vertex.Position.x + worldViewProjectionMatrix(0, 1) * vertex.Position.y + worldViewProjectionMatrix(0, 2) * vertex.Position.z + worldViewProjectionMatrix(0, 3),
-			worldViewProjectionMatrix(1, 0) * vertex.Position.x + worldViewProjectionMatrix(1, 1) * vertex.Position.y + worldViewProjectionMatrix(1, 2) * vertex.Position.z + worldViewProjectionMatrix(1, 3),
-			worldViewProjectionMatrix(2, 0) * vertex.Position.x + worldViewProjectionMatrix(2, 1) * vertex.Position.y + worldViewProjectionMatrix(2, 2) * vertex.Position.z + worldViewProjectionMatrix(2, 3),
-			worldViewProjectionMatrix(3, 0) * vertex.Position.x + worldViewProjectionMatrix(3, 1) * vertex.Position.y + worldViewProjectionMatrix(3, 2) * vertex.Position.z + worldViewProjectionMatrix(3, 3));
+	// Make room for the mesh's vertices at the end of the post-transform buffer
+	const uint32_t amountVertices = vertices.size();
+	const uint32_t firstVertexIdx = AddVertices(amountVertices);
 
-		
-		if (transformedPos.w != 0.f)
+	// Transform the vertices in batches, spread over all the threads
+	const uint32_t amountBatches = (amountVertices + m_VertexBatchSize - 1) / m_VertexBatchSize;
+	m_pThreadPool->ParallelFor(amountBatches, [&](uint32_t batchIdx)
+	{
+		const uint32_t lastVertexIdx = std::min((batchIdx + 1) * m_VertexBatchSize, amountVertices);
+		for (uint32_t i = batchIdx * m_VertexBatchSize; i < lastVertexIdx; ++i)
 		{
-			transformedPos.x /= transformedPos.w;
-			transformedPos.y /= transformedPos.w;
-			transformedPos.z /= transformedPos.w;
+			// Vertices only used by culled triangles are never read, so they're just left as they are
+			if (pUsedVertices != nullptr && pUsedVertices[i] == 0)
+				continue;
+
+			const VS_INPUT& vertex = vertices[i];
+			const uint32_t vertexIdx = firstVertexIdx + i;
+
+			// First the world pos (we just adjust it according to the transformation matrix)
+			//vertex.WorldPosition = transformMatrix * FPoint4(vertex.Position.x, vertex.Position.y, vertex.Position.z, 1.f); // For some reason, the multiplication operator is not working
+			const auto worldPos = FPoint4(vertex.Position.x, vertex.Position.y, vertex.Position.z, 1.f);
+			const FPoint3 transformedWorldPos(
+				transformMatrix(0, 0) * worldPos.x + transformMatrix(0, 1) * worldPos.y + transformMatrix(0, 2) * worldPos.z + transformMatrix(0, 3),
+				transformMatrix(1, 0) * worldPos.x + transformMatrix(1, 1) * worldPos.y + transformMatrix(1, 2) * worldPos.z + transformMatrix(1, 3),
+				transformMatrix(2, 0) * worldPos.x + transformMatrix(2, 1) * worldPos.y + transformMatrix(2, 2) * worldPos.z + transformMatrix(2, 3));
+			m_WorldPositions[vertexIdx] = transformedWorldPos;
+
+			// Then the position (with perspective divide)
+			//FPoint4 transformedPos = worldViewProjectionMatrix * vertex.Position; // For some reason, the multiplication operator is not working
+			FPoint4 transformedPos(
+				worldViewProjectionMatrix(0, 0) * vertex.Position.x + worldViewProjectionMatrix(0, 1) * vertex.Position.y + worldViewProjectionMatrix(0, 2) * vertex.Position.z + worldViewProjectionMatrix(0, 3),
+				worldViewProjectionMatrix(1, 0) * vertex.Position.x + worldViewProjectionMatrix(1, 1) * vertex.Position.y + worldViewProjectionMatrix(1, 2) * vertex.Position.z + worldViewProjectionMatrix(1, 3),
+				worldViewProjectionMatrix(2, 0) * vertex.Position.x + worldViewProjectionMatrix(2, 1) * vertex.Position.y + worldViewProjectionMatrix(2, 2) * vertex.Position.z + worldViewProjectionMatrix(2, 3),
+				worldViewProjectionMatrix(3, 0) * vertex.Position.x + worldViewProjectionMatrix(3, 1) * vertex.Position.y + worldViewProjectionMatrix(3, 2) * vertex.Position.z + worldViewProjectionMatrix(3, 3));
+
+			// Keep the clip space position, and which planes it's outside of, for the frustum culling and clipping
+			m_ClipPositions[vertexIdx] = transformedPos;
+			m_ClipCodes[vertexIdx] = GetClipCode(transformedPos);
+
+			if (transformedPos.w != 0.f)
+			{
+				transformedPos.x /= transformedPos.w;
+				transformedPos.y /= transformedPos.w;
+				transformedPos.z /= transformedPos.w;
+			}
+			m_NdcPositions[vertexIdx] = transformedPos.xyz;
+
+			// Also keep its screenspace (raster space) position for the rasterizer
+			m_RasterPositions[vertexIdx] = GetRasterPosition(transformedPos);
+
+			// The attributes are all stored already divided by w, so interpolating them is just a weighted sum (and 1/w is there to undo it)
+			const float invW = 1.f / transformedPos.w;
+			m_InvW[vertexIdx] = invW;
+
+			if (vertexStreams & StreamBitsUV)
+			{
+				m_VertexStreams[StreamU][vertexIdx] = vertex.UVCoord.x * invW;
+				m_VertexStreams[StreamV][vertexIdx] = vertex.UVCoord.y * invW;
+			}
+
+			if (vertexStreams & StreamBitsColor)
+			{
+				m_VertexStreams[StreamColorR][vertexIdx] = vertex.Color.r * invW;
+				m_VertexStreams[StreamColorG][vertexIdx] = vertex.Color.g * invW;
+				m_VertexStreams[StreamColorB][vertexIdx] = vertex.Color.b * invW;
+			}
+
+			if (vertexStreams & StreamBitsNormal)
+			{
+				// Then the normal (again, just the transformation matrix)
+				//FPoint4 transformedNorm = transformMatrix * FPoint4(vertex.Normal.x, vertex.Normal.y, vertex.Normal.z, 1.f); // For some reason, the multiplication operator is not working
+				const auto norm = FPoint4(vertex.Normal.x, vertex.Normal.y, vertex.Normal.z, 1.f);
+				const FPoint4 transformedNorm(
+					transformMatrix(0, 0) * norm.x + transformMatrix(0, 1) * norm.y + transformMatrix(0, 2) * norm.z + transformMatrix(0, 3),
+					transformMatrix(1, 0) * norm.x + transformMatrix(1, 1) * norm.y + transformMatrix(1, 2) * norm.z + transformMatrix(1, 3),
+					transformMatrix(2, 0) * norm.x + transformMatrix(2, 1) * norm.y + transformMatrix(2, 2) * norm.z + transformMatrix(2, 3),
+					transformMatrix(3, 0) * norm.x + transformMatrix(3, 1) * norm.y + transformMatrix(3, 2) * norm.z + transformMatrix(3, 3));
+				const FVector3 normal = GetNormalized(FVector3(transformedNorm.xyz));
+				m_VertexStreams[StreamNormalX][vertexIdx] = normal.x * invW;
+				m_VertexStreams[StreamNormalY][vertexIdx] = normal.y * invW;
+				m_VertexStreams[StreamNormalZ][vertexIdx] = normal.z * invW;
+			}
+
+			if (vertexStreams & StreamBitsTangent)
+			{
+				// And then the tangent (again, just the transformation matrix)
+				//FPoint4 transformedTangent = transformMatrix * FPoint4(vertex.Tangent.x, vertex.Tangent.y, vertex.Tangent.z, 1.f); // For some reason, the multiplication operator is not working
+				const auto tan = FPoint4(vertex.Tangent.x, vertex.Tangent.y, vertex.Tangent.z, 1.f);
+				const FPoint4 transformedTangent(
+					transformMatrix(0, 0) * tan.x + transformMatrix(0, 1) * tan.y + transformMatrix(0, 2) * tan.z + transformMatrix(0, 3),
+					transformMatrix(1, 0) * tan.x + transformMatrix(1, 1) * tan.y + transformMatrix(1, 2) * tan.z + transformMatrix(1, 3),
+					transformMatrix(2, 0) * tan.x + transformMatrix(2, 1) * tan.y + transformMatrix(2, 2) * tan.z + transformMatrix(2, 3),
+					transformMatrix(3, 0) * tan.x + transformMatrix(3, 1) * tan.y + transformMatrix(3, 2) * tan.z + transformMatrix(3, 3));
+				const FVector3 tangent = GetNormalized(FVector3(transformedTangent.xyz));
+				m_VertexStreams[StreamTangentX][vertexIdx] = tangent.x * invW;
+				m_VertexStreams[StreamTangentY][vertexIdx] = tangent.y * invW;
+				m_VertexStreams[StreamTangentZ][vertexIdx] = tangent.z * invW;
+			}
+
+			if (vertexStreams & StreamBitsViewDirection)
+			{
+				// And finally the direction from the camera to the vertex, for the specular
+				const FVector3 viewDir = transformedWorldPos - cameraPos;
+				m_VertexStreams[StreamViewDirectionX][vertexIdx] = viewDir.x * invW;
+				m_VertexStreams[StreamViewDirectionY][vertexIdx] = viewDir.y * invW;
+				m_VertexStreams[StreamViewDirectionZ][vertexIdx] = viewDir.z * invW;
+			}
 		}
-		vertex.Position = transformedPos;
-		
+	});
+
+	return firstVertexIdx;
+}
+
+Elite::FVector2 Elite::Renderer::GetInterpolatedUV(const BinnedTriangle& triangle, uint32_t x, uint32_t y) const
+{
+	// The weights straight from the edge functions, which also works for pixels outside the triangle
+	const int64_t pixelX = (int64_t(x) << m_SubPixelBits) + m_SubPixelScale / 2;
+	const int64_t pixelY = (int64_t(y) << m_SubPixelBits) + m_SubPixelScale / 2;
+	const float w0 = float(triangle.Edges[0].A * pixelX + triangle.Edges[0].B * pixelY + triangle.Edges[0].C) * triangle.InvArea;
+	const float w1 = float(triangle.Edges[1].A * pixelX + triangle.Edges[1].B * pixelY + triangle.Edges[1].C) * triangle.InvArea;
+	const float w2 = float(triangle.Edges[2].A * pixelX + triangle.Edges[2].B * pixelY + triangle.Edges[2].C) * triangle.InvArea;
+
+	const uint32_t idx0 = triangle.VertexIdxs[0];
+	const uint32_t idx1 = triangle.VertexIdxs[1];
+	const uint32_t idx2 = triangle.VertexIdxs[2];
+	const float wInterp = 1.f / (m_InvW[idx0] * w0 + m_InvW[idx1] * w1 + m_InvW[idx2] * w2);
+	const float* pU = m_VertexStreams[StreamU].data();
+	const float* pV = m_VertexStreams[StreamV].data();
+	return FVector2((pU[idx0] * w0 + pU[idx1] * w1 + pU[idx2] * w2) * wInterp, (pV[idx0] * w0 + pV[idx1] * w1 + pV[idx2] * w2) * wInterp);
+}
+
+void Elite::Renderer::GetQuadUVDerivatives(const BinnedTriangle& triangle, uint32_t x, uint32_t y, FVector2& uvDx, FVector2& uvDy) const
+{
+	// Like a GPU does, difference the UV across the 2x2 quad the pixel is in (the quad's pixels that are outside the triangle still get their UV extrapolated)
+	const uint32_t quadX = x & ~1u;
+	const uint32_t quadY = y & ~1u;
+	const FVector2 uv = GetInterpolatedUV(triangle, quadX, quadY);
+	uvDx = GetInterpolatedUV(triangle, quadX + 1, quadY) - uv;
+	uvDy = GetInterpolatedUV(triangle, quadX, quadY + 1) - uv;
+
+	// The extrapolation can blow up right at the horizon of a triangle, which then just gets the full size level
+	if (std::isfinite(uvDx.x + uvDx.y + uvDy.x + uvDy.y) == false)
+	{
+		uvDx = FVector2{};
+		uvDy = FVector2{};
+	}
+}
+
+Elite::FVector4 Elite::Renderer::SampleTexture(const Texture* pTexture, const FVector2& uv, const FVector2& uvDx, const FVector2& uvDy) const
+{
+	// With the mipmaps off, the derivatives are left at 0, so every filter only reads the full size level
+	switch (m_SamplerFilter)
+	{
+	case SAMPLER_FILTER::Linear:
+		return pTexture->SampleTrilinear(uv, uvDx, uvDy);
+	case SAMPLER_FILTER::Anisotropic:
+		return pTexture->SampleAnisotropic(uv, uvDx, uvDy);
+	default:
+		return pTexture->SamplePoint(uv, uvDx, uvDy);
+	}
+}
+
+MaterialSample Elite::Renderer::SampleMaterial(const MaterialTexture* pMaterialText, const FVector2& uv, const FVector2& uvDx, const FVector2& uvDy) const
+{
+	switch (m_SamplerFilter)
+	{
+	case SAMPLER_FILTER::Linear:
+		return pMaterialText->SampleTrilinear(uv, uvDx, uvDy);
+	case SAMPLER_FILTER::Anisotropic:
+		return pMaterialText->SampleAnisotropic(uv, uvDx, uvDy);
+	default:
+		return pMaterialText->SamplePoint(uv, uvDx, uvDy);
+	}
+}
+
+Elite::RGBColor Elite::Renderer::CalculatePixel(const BinnedTriangle& triangle, float w0, float w1, float w2, const FVector2& uvDx, const FVector2& uvDy,
+	const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight) const
+{
+	const uint32_t idx0 = triangle.VertexIdxs[0];
+	const uint32_t idx1 = triangle.VertexIdxs[1];
+	const uint32_t idx2 = triangle.VertexIdxs[2];
+
+	// Every attribute is already divided by w, so it's just a weighted sum of the 3 vertices, brought back out of NDC space with the interpolated w
+	const float wInterp = 1.f / (m_InvW[idx0] * w0 + m_InvW[idx1] * w1 + m_InvW[idx2] * w2);
+	auto interpolate = [&](uint32_t stream)
+	{
+		const float* pStream = m_VertexStreams[stream].data();
+		return (pStream[idx0] * w0 + pStream[idx1] * w1 + pStream[idx2] * w2) * wInterp;
+	};
 
-		// Then the normal (again, just the transformation matrix)
-		//FPoint4 transformedNorm = transformMatrix * FPoint4(vertex.Normal.x, vertex.Normal.y, vertex.Normal.z, 1.f); // For some reason, the multiplication operator is not working
-		const auto norm = FPoint4(vertex.Normal.x, vertex.Normal.y, vertex.Normal.z, 1.f);
-		const FPoint4 transformedNorm(
-			transformMatrix(0, 0) * norm.x + transformMatrix(0, 1) * norm.y + transformMatrix(0, 2) * norm.z + transformMatrix(0, 3),
-			transformMatrix(1, 0) * norm.x + transformMatrix(1, 1) * norm.y + transformMatrix(1, 2) * norm.z + transformMatrix(1, 3),
-			transformMatrix(2, 0) * norm.x + transformMatrix(2, 1) * norm.y + transformMatrix(2, 2) * norm.z + transformMatrix(2, 3),
-			transformMatrix(3, 0) * norm.x + transformMatrix(3, 1) * norm.y + transformMatrix(3, 2) * norm.z + transformMatrix(3, 3));
-		vertex.Normal = GetNormalized(FVector3(transformedNorm.xyz));
-
-		// And then the tangent (again, just the transformation matrix)
-		//FPoint4 transformedTangent = transformMatrix * FPoint4(vertex.Tangent.x, vertex.Tangent.y, vertex.Tangent.z, 1.f); // For some reason, the multiplication operator is not working
-		const auto tan = FPoint4(vertex.Tangent.x, vertex.Tangent.y, vertex.Tangent.z, 1.f);
-		const FPoint4 transformedTangent(
-			transformMatrix(0, 0) * tan.x + transformMatrix(0, 1) * tan.y + transformMatrix(0, 2) * tan.z + transformMatrix(0, 3),
-			transformMatrix(1, 0) * tan.x + transformMatrix(1, 1) * tan.y + transformMatrix(1, 2) * tan.z + transformMatrix(1, 3),
-			transformMatrix(2, 0) * tan.x + transformMatrix(2, 1) * tan.y + transformMatrix(2, 2) * tan.z + transformMatrix(2, 3),
-			transformMatrix(3, 0) * tan.x + transformMatrix(3, 1) * tan.y + transformMatrix(3, 2) * tan.z + transformMatrix(3, 3));
-		vertex.Tangent = GetNormalized(FVector3(transformedTangent.xyz));
-	}
-}
-
-void Elite::Renderer::CalculatePixel(const Texture* pDiffuseText, const Texture* pNormalText, const Texture* pSpecularText, const Texture* pGlossText,
-	float shininess, float w0, float w1, float w2, int c, int r, const FPoint3& cameraPos,
-	const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight, bool transparencyOn) const
-{
-	const float wInterp = 1.f / ((1.f / m_TransformedVerticesTriangle[0].Position.w) * w0 + (1.f / m_TransformedVerticesTriangle[1].Position.w) * w1 + (1.f / m_TransformedVerticesTriangle[2].Position.w) * w2);
-
-	// Interpolate the vertices normals, tangents, view direction, UV values and world position - not in NDC space (and normalize the first 3)
-	const auto interpNormal = GetNormalized(((m_TransformedVerticesTriangle[0].Normal / m_TransformedVerticesTriangle[0].Position.w) * w0 +
-		(m_TransformedVerticesTriangle[1].Normal / m_TransformedVerticesTriangle[1].Position.w) * w1 +
-		(m_TransformedVerticesTriangle[2].Normal / m_TransformedVerticesTriangle[2].Position.w) * w2) * wInterp);
-	const auto interpTangent = GetNormalized(((m_TransformedVerticesTriangle[0].Tangent / m_TransformedVerticesTriangle[0].Position.w) * w0 +
-		(m_TransformedVerticesTriangle[1].Tangent / m_TransformedVerticesTriangle[1].Position.w) * w1 +
-		(m_TransformedVerticesTriangle[2].Tangent / m_TransformedVerticesTriangle[2].Position.w) * w2) * wInterp);
-	const auto interpUV = ((m_TransformedVerticesTriangle[0].UVCoord / m_TransformedVerticesTriangle[0].Position.w) * w0 +
-		(m_TransformedVerticesTriangle[1].UVCoord / m_TransformedVerticesTriangle[1].Position.w) * w1 +
-		(m_TransformedVerticesTriangle[2].UVCoord / m_TransformedVerticesTriangle[2].Position.w) * w2) * wInterp;
-	const auto interpWorldPosition = ((FVector4(m_TransformedVerticesTriangle[0].WorldPosition) / m_TransformedVerticesTriangle[0].Position.w) * w0 +
-		(FVector4(m_TransformedVerticesTriangle[1].WorldPosition) / m_TransformedVerticesTriangle[1].Position.w) * w1 +
-		(FVector4(m_TransformedVerticesTriangle[2].WorldPosition) / m_TransformedVerticesTriangle[2].Position.w) * w2) * wInterp;
-
-	const auto viewDir0 = FVector3(m_TransformedVerticesTriangle[0].WorldPosition.xyz) - FVector3(cameraPos);
-	const auto viewDir1 = FVector3(m_TransformedVerticesTriangle[1].WorldPosition.xyz) - FVector3(cameraPos);
-	const auto viewDir2 = FVector3(m_TransformedVerticesTriangle[2].WorldPosition.xyz) - FVector3(cameraPos);
-	const auto interpViewDir = GetNormalized(((viewDir0 / m_TransformedVerticesTriangle[0].Position.w) * w0 +
-		(viewDir1 / m_TransformedVerticesTriangle[1].Position.w) * w1 +
-		(viewDir2 / m_TransformedVerticesTriangle[2].Position.w) * w2) * wInterp);
-
-	// Calculate the final color
+	// Calculate the final color (transparent triangles never get here, they're accumulated instead)
+	const Texture* pDiffuseText = triangle.pMesh->GetDiffuseTexture();
 	RGBColor finalColor{ 0.f, 0.f, 0.f };
 	
-	if (transparencyOn == false) // If it's not transparent, shade normally
+	if (pDiffuseText == nullptr) // If the mesh has no texture
 	{
-		if (pDiffuseText == nullptr) // If the mesh has no texture
+		// Interpolate the given colors
+		finalColor = RGBColor(interpolate(StreamColorR), interpolate(StreamColorG), interpolate(StreamColorB));
+	}
+	else // If it does
+	{
+		const Texture* pNormalText = triangle.pMesh->GetNormalTexture();
+		const Texture* pSpecularText = triangle.pMesh->GetSpecularTexture();
+		const Texture* pGlossText = triangle.pMesh->GetGlossinessTexture();
+
+		// Interpolate the UV values, and the normal, tangent and view direction (only the ones that get used, and normalize them)
+		// With fast math, the 3 get normalized together, one per SIMD lane
+		const FVector2 interpUV(interpolate(StreamU), interpolate(StreamV));
+		FVector3 interpNormal{ interpolate(StreamNormalX), interpolate(StreamNormalY), interpolate(StreamNormalZ) };
+		FVector3 interpTangent{};
+		if (pNormalText != nullptr)
+			interpTangent = FVector3(interpolate(StreamTangentX), interpolate(StreamTangentY), interpolate(StreamTangentZ));
+		FVector3 interpViewDir{};
+		if (pSpecularText != nullptr && pGlossText != nullptr)
+			interpViewDir = FVector3(interpolate(StreamViewDirectionX), interpolate(StreamViewDirectionY), interpolate(StreamViewDirectionZ));
+
+		if (m_FastMathOn)
+			FastMath::Normalize(interpNormal, interpTangent, interpViewDir);
+		else
 		{
-			// Interpolate the given colors
-			finalColor = ((m_TransformedVerticesTriangle[0].Color / m_TransformedVerticesTriangle[0].Position.w) * w0 +
-				(m_TransformedVerticesTriangle[1].Color / m_TransformedVerticesTriangle[1].Position.w) * w1 +
-				(m_TransformedVerticesTriangle[2].Color / m_TransformedVerticesTriangle[2].Position.w) * w2) * wInterp;
+			Normalize(interpNormal);
+			if (pNormalText != nullptr)
+				Normalize(interpTangent);
+			if (pSpecularText != nullptr && pGlossText != nullptr)
+				Normalize(interpViewDir);
 		}
-		else // If it does
+
+		// Sample all the maps according to the interpolated UV: when they've been baked together, that's just a single fetch
+		const bool hasSpecularMaps = pSpecularText != nullptr && pGlossText != nullptr;
+		const MaterialTexture* pMaterialText = triangle.pMesh->GetMaterialTexture();
+		MaterialSample materialSample{};
+		if (pMaterialText != nullptr)
+			materialSample = SampleMaterial(pMaterialText, interpUV, uvDx, uvDy);
+		else
 		{
-			// Just sample according to the interpolated UV
-			RGBColor pixelColor = pDiffuseText->Sample(interpUV);
+			const FVector4 diffuseSample = SampleTexture(pDiffuseText, interpUV, uvDx, uvDy);
+			materialSample.Diffuse = RGBColor{ diffuseSample.r, diffuseSample.g, diffuseSample.b };
 
-			// Use this new info to calculate the ouputVertex, and use it to shade the pixel
-			// The position in screen space irrelevant, so we can just pass a copy of the world position in its place
-			VS_OUTPUT outputVertex = { FPoint4(interpWorldPosition), FPoint4(interpWorldPosition), pixelColor, interpUV, interpNormal, interpTangent };
-			PixelShading(outputVertex, finalColor, pNormalText, pSpecularText, pGlossText, shininess, interpViewDir, lightDirection, lightIntensity, ambientLight);
+			// Remap the normal to the correct range [-1,1]
+			if (pNormalText != nullptr)
+			{
+				const FVector4 normalSample = SampleTexture(pNormalText, interpUV, uvDx, uvDy);
+				materialSample.Normal = FVector3(normalSample.r, normalSample.g, normalSample.b) * 2.f - FVector3{ 1.f, 1.f, 1.f };
+			}
+
+			if (hasSpecularMaps)
+			{
+				materialSample.Specular = SampleTexture(pSpecularText, interpUV, uvDx, uvDy).r;
+				materialSample.Glossiness = SampleTexture(pGlossText, interpUV, uvDx, uvDy).r;
+			}
 		}
+
+		// Use this new info to calculate the ouputVertex, and use it to shade the pixel
+		// The positions are irrelevant for the shading, so they're just left at their default
+		VS_OUTPUT outputVertex{};
+		outputVertex.Color = materialSample.Diffuse;
+		outputVertex.UVCoord = interpUV;
+		outputVertex.Normal = interpNormal;
+		outputVertex.Tangent = interpTangent;
+		PixelShading(outputVertex, finalColor, materialSample, pNormalText != nullptr, hasSpecularMaps, triangle.pMesh->GetShininess(), interpViewDir, lightDirection,
+			lightIntensity, ambientLight);
 	}
-	else // If it is transparent, calculate a blend between the old color in the BackBuffer and the new sampled one
+
+	// The caller puts it in the BackBuffer, along with the rest of the row
+	return finalColor;
+}
+
+void Elite::Renderer::AccumulateTransparentPixel(const BinnedTriangle& triangle, float w0, float w1, float w2, const FVector2& uvDx, const FVector2& uvDy, uint32_t c, uint32_t r,
+	TileContext& tile) const
+{
+	const uint32_t idx0 = triangle.VertexIdxs[0];
+	const uint32_t idx1 = triangle.VertexIdxs[1];
+	const uint32_t idx2 = triangle.VertexIdxs[2];
+
+	// Transparent meshes only sample their diffuse texture, so the UV is all that needs to be interpolated
+	const float wInterp = 1.f / (m_InvW[idx0] * w0 + m_InvW[idx1] * w1 + m_InvW[idx2] * w2);
+	const FVector2 interpUV((m_VertexStreams[StreamU][idx0] * w0 + m_VertexStreams[StreamU][idx1] * w1 + m_VertexStreams[StreamU][idx2] * w2) * wInterp,
+		(m_VertexStreams[StreamV][idx0] * w0 + m_VertexStreams[StreamV][idx1] * w1 + m_VertexStreams[StreamV][idx2] * w2) * wInterp);
+	const FVector4 sample = SampleTexture(triangle.pMesh->GetDiffuseTexture(), interpUV, uvDx, uvDy);
+	if (sample.w <= 0.f)
+		return;
+
+	// The first fragment of a pixel this frame starts its accumulation from scratch
+	const uint32_t pixelIdx = c + (r * m_Width);
+	float* pAccumulation = m_pAccumulationBuffer + size_t(pixelIdx) * 4;
+	const uint64_t pixelBit = uint64_t(1) << (c - tile.MinX);
+	uint64_t& transparentRow = tile.TransparentRows[r - tile.MinY];
+	if ((transparentRow & pixelBit) == 0)
+	{
+		transparentRow |= pixelBit;
+		pAccumulation[0] = pAccumulation[1] = pAccumulation[2] = pAccumulation[3] = 0.f;
+		m_pRevealageBuffer[pixelIdx] = 1.f;
+	}
+
+	// Add the premultiplied color, weighted by how close it is (wInterp is the view depth), and take its coverage out of what's left to see behind it
+	const float weight = GetTransparencyWeight(sample.w, wInterp);
+	pAccumulation[0] += sample.r * sample.w * weight;
+	pAccumulation[1] += sample.g * sample.w * weight;
+	pAccumulation[2] += sample.b * sample.w * weight;
+	pAccumulation[3] += sample.w * weight;
+	m_pRevealageBuffer[pixelIdx] *= 1.f - sample.w;
+}
+
+float Elite::Renderer::GetTransparencyWeight(float alpha, float viewDepth)
+{
+	// The depth weight from McGuire and Bavoil's weighted blended OIT (their equation 7), so closer fragments count for more of the average
+	// The clamp keeps the sum of many fragments in range of the DirectX half float accumulation target (which uses the exact same weight)
+	const float depthTerm = viewDepth / 5.f;
+	const float farDepthTerm = viewDepth / 200.f;
+	const float farDepthTermCubed = farDepthTerm * farDepthTerm * farDepthTerm;
+	return alpha * Clamp(10.f / (1e-5f + depthTerm * depthTerm + farDepthTermCubed * farDepthTermCubed), 1e-2f, 3e3f);
+}
+
+void Elite::Renderer::CompositeTransparentTile(TileContext& tile) const
+{
+	for (uint32_t r = tile.MinY; r < tile.MaxY; ++r)
 	{
-		// I don't understand why does this still shows artifacts
-		const FVector4 sample = pDiffuseText->SampleWTransparency(interpUV);
-		Uint8 oldRUint, oldGUint, oldBUint;
-		SDL_GetRGB(m_pBackBufferPixels[c + (r * m_Width)], m_pBackBuffer->format, &oldRUint, &oldGUint, &oldBUint);
-		float oldR = static_cast<float>(oldRUint) / 255.f;
-		float oldG = static_cast<float>(oldGUint) / 255.f;
-		float oldB = static_cast<float>(oldBUint) / 255.f;
+		const uint64_t transparentRow = tile.TransparentRows[r - tile.MinY];
+		if (transparentRow == 0)
+			continue;
 
-		finalColor.r = sample.r * sample.w + oldR * (1.f - sample.w);
-		finalColor.g = sample.g * sample.w + oldG * (1.f - sample.w);
-		finalColor.b = sample.b * sample.w + oldB * (1.f - sample.w);
+		// The average color of the fragments covers as much of the opaque color as the revealage took away from it
+		for (uint32_t i = 0; i < tile.MaxX - tile.MinX; ++i)
+		{
+			if ((transparentRow & (uint64_t(1) << i)) == 0)
+				continue;
+
+			const uint32_t pixelIdx = tile.MinX + i + (r * m_Width);
+			const float* pAccumulation = m_pAccumulationBuffer + size_t(pixelIdx) * 4;
+			const float revealage = m_pRevealageBuffer[pixelIdx];
+			const float coverage = (1.f - revealage) / std::max(pAccumulation[3], 1e-5f);
+
+			// The back buffer is always 0x00RRGGBB, so the opaque color can just be unpacked in place
+			const uint32_t opaquePixel = m_pBackBufferPixels[pixelIdx];
+			tile.RowColorsR[i] = pAccumulation[0] * coverage + static_cast<float>((opaquePixel >> 16) & 0xFF) / 255.f * revealage;
+			tile.RowColorsG[i] = pAccumulation[1] * coverage + static_cast<float>((opaquePixel >> 8) & 0xFF) / 255.f * revealage;
+			tile.RowColorsB[i] = pAccumulation[2] * coverage + static_cast<float>(opaquePixel & 0xFF) / 255.f * revealage;
+		}
+
+		WriteRowColors(tile, transparentRow, tile.MinX, tile.MaxX - tile.MinX, r);
 	}
+}
 
-	// Set the finalColor as the new pixel color in the BackBuffer
-	m_pBackBufferPixels[c + (r * m_Width)] = SDL_MapRGB(m_pBackBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255.f),
-		static_cast<uint8_t>(finalColor.g * 255.f),
-		static_cast<uint8_t>(finalColor.b * 255.f));
+void Elite::Renderer::WriteRowColors(const TileContext& tile, uint64_t mask, uint32_t minX, uint32_t amountPixels, uint32_t r) const
+{
+	uint32_t* pPixels = m_pBackBufferPixels + minX + (r * m_Width);
+
+	// Convert 4 pixels at a time to 8 bits per channel (truncating, like a cast does) and pack them as 0x00RRGGBB
+	const __m128 scale = _mm_set1_ps(255.f);
+	const __m128i channelMask = _mm_set1_epi32(0xFF);
+	const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+	uint32_t i = 0;
+	for (; i + 4 <= amountPixels; i += 4)
+	{
+		const uint32_t laneMask = uint32_t(mask >> i) & 0xF;
+		if (laneMask == 0)
+			continue;
+
+		const __m128i red = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(tile.RowColorsR + i), scale)), channelMask);
+		const __m128i green = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(tile.RowColorsG + i), scale)), channelMask);
+		const __m128i blue = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(tile.RowColorsB + i), scale)), channelMask);
+		const __m128i packed = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(red, 16), _mm_slli_epi32(green, 8)), blue);
+
+		// Only the shaded pixels get replaced, the rest keep what was already there
+		auto* pDestination = reinterpret_cast<__m128i*>(pPixels + i);
+		if (laneMask == 0xF)
+			_mm_storeu_si128(pDestination, packed);
+		else
+		{
+			const __m128i lanes = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(int(laneMask)), laneBits), laneBits);
+			_mm_storeu_si128(pDestination, _mm_or_si128(_mm_and_si128(lanes, packed), _mm_andnot_si128(lanes, _mm_loadu_si128(pDestination))));
+		}
+	}
+
+	// And the last few one by one
+	for (; i < amountPixels; ++i)
+	{
+		if (mask & (uint64_t(1) << i))
+			pPixels[i] = PackColor(tile.RowColorsR[i], tile.RowColorsG[i], tile.RowColorsB[i]);
+	}
 }
 
-void Elite::Renderer::PixelShading(const VS_OUTPUT& outputVertex, RGBColor& finalColor, const Texture* pNormalText, const Texture* pSpecularText, const Texture* pGlossText, float shininess, const FVector3& interpViewDir,
-	const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight) const
+uint32_t Elite::Renderer::PackColor(float r, float g, float b)
+{
+	// The back buffer is created as SDL_PIXELFORMAT_RGB888, so there's no need to go through SDL_MapRGB
+	return (uint32_t(static_cast<uint8_t>(r * 255.f)) << 16) | (uint32_t(static_cast<uint8_t>(g * 255.f)) << 8) | uint32_t(static_cast<uint8_t>(b * 255.f));
+}
+
+void Elite::Renderer::PixelShading(const VS_OUTPUT& outputVertex, RGBColor& finalColor, const MaterialSample& materialSample, bool hasNormalMap, bool hasSpecularMaps, float shininess,
+	const FVector3& interpViewDir, const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight) const
 {
 	finalColor = { 0.f, 0.f, 0.f };
 	auto mappedNormal = outputVertex.Normal;
 
-	if (pNormalText != nullptr) // If the mesh has a normal map
+	if (hasNormalMap) // If the mesh has a normal map
 	{
-		// Get the pixel sample from the Normal Map and remap it to the correct range [-1,1]
-		const auto normalMapSampleCol = pNormalText->Sample(outputVertex.UVCoord);
-		auto normalMapSampleVec = FVector3(normalMapSampleCol.r, normalMapSampleCol.g, normalMapSampleCol.b);
-		normalMapSampleVec = normalMapSampleVec * 2.f - FVector3{ 1.f, 1.f, 1.f };
-
-		// And put it in tangent space
+		// Put the normal map's sample in tangent space
+		const FVector3& normalMapSampleVec = materialSample.Normal;
 		const FVector3 binormal = Cross(outputVertex.Tangent, outputVertex.Normal);
 		const FMatrix3 tangentSpaceAxis = FMatrix3(outputVertex.Tangent, binormal, outputVertex.Normal);
 		//mappedNormal = GetNormalized(tangentSpaceAxis * normalMapSampleVec);  // For some reason, the multiplication operator is not working
 		mappedNormal = FVector3(tangentSpaceAxis(0, 0) * normalMapSampleVec.x + tangentSpaceAxis(0, 1) * normalMapSampleVec.y + tangentSpaceAxis(0, 2) * normalMapSampleVec.z,
 			tangentSpaceAxis(1, 0)* normalMapSampleVec.x + tangentSpaceAxis(1, 1) * normalMapSampleVec.y + tangentSpaceAxis(1, 2) * normalMapSampleVec.z,
 			tangentSpaceAxis(2, 0)* normalMapSampleVec.x + tangentSpaceAxis(2, 1) * normalMapSampleVec.y + tangentSpaceAxis(2, 2) * normalMapSampleVec.z);
-		Normalize(mappedNormal);
+		if (m_FastMathOn)
+			FastMath::Normalize(mappedNormal);
+		else
+			Normalize(mappedNormal);
 	}
 	
 	float specularColor = 0.f;
 	float glossiness = 0.f;
-	if (pSpecularText != nullptr && pGlossText != nullptr) // If the mesh has a specular and glossiness map
+	if (hasSpecularMaps) // If the mesh has a specular and glossiness map
 	{
 		// Get the pixel sample from the Specular Map
-		const auto specMapSampleCol = pSpecularText->Sample(outputVertex.UVCoord);
-		specularColor = specMapSampleCol.r;
+		specularColor = materialSample.Specular;
 
 		// Get the pixel sample from the Glossiness Map and multiply it by the shine variable
-		const auto glossMapSampleCol = pGlossText->Sample(outputVertex.UVCoord);
-		glossiness = glossMapSampleCol.r * shininess;
+		glossiness = materialSample.Glossiness * shininess;
 	}
 
 	// Calculate the PhongBRDF, if the maps the maps were provided (use inverted light direction, as to adjust for the coordinate system flip)
 	const Elite::FVector3 reflectedLightDir = Reflect(mappedNormal, -lightDirection);
 	auto phongBRDF = RGBColor{ 0.f, 0.f, 0.f };
-	if (pSpecularText != nullptr && pGlossText != nullptr)
+	if (hasSpecularMaps)
 	{
 		float specularStrength = std::max(0.0f, Dot(interpViewDir, reflectedLightDir));
 		specularStrength = powf(specularStrength, glossiness);
@@ -629,6 +1825,15 @@ HRESULT Elite::Renderer::InitializeDirectX()
 	if (FAILED(result))
 		return result;
 
+	// Create the targets the transparent meshes accumulate into: half floats for the weighted sums, which can go well past 1
+	// (the revealage is a product of values in [0, 1], but it still needs more precision than 8 bits to be multiplied that many times)
+	result = CreateTransparencyTarget(DXGI_FORMAT_R16G16B16A16_FLOAT, m_pAccumulationTexture, m_pAccumulationTargetView, m_pAccumulationResourceView);
+	if (FAILED(result))
+		return result;
+	result = CreateTransparencyTarget(DXGI_FORMAT_R16_FLOAT, m_pRevealageTexture, m_pRevealageTargetView, m_pRevealageResourceView);
+	if (FAILED(result))
+		return result;
+
 	// Bind the Views to the Output Merger Stage
 	m_pDeviceContext->OMSetRenderTargets(1, &m_pRenderTargetView, m_pDepthStencilView);
 
@@ -645,15 +1850,60 @@ HRESULT Elite::Renderer::InitializeDirectX()
 	return S_OK;
 }
 
+HRESULT Elite::Renderer::CreateTransparencyTarget(DXGI_FORMAT format, ID3D11Texture2D*& pTexture, ID3D11RenderTargetView*& pTargetView, ID3D11ShaderResourceView*& pResourceView)
+{
+	// A screen sized texture that can be rendered to, and then read by the composite pass
+	D3D11_TEXTURE2D_DESC textureDesc{};
+	textureDesc.Width = m_Width;
+	textureDesc.Height = m_Height;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = format;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+	textureDesc.CPUAccessFlags = 0;
+	textureDesc.MiscFlags = 0;
+
+	HRESULT result = m_pDevice->CreateTexture2D(&textureDesc, 0, &pTexture);
+	if (FAILED(result))
+		return result;
+	result = m_pDevice->CreateRenderTargetView(pTexture, 0, &pTargetView);
+	if (FAILED(result))
+		return result;
+	return m_pDevice->CreateShaderResourceView(pTexture, 0, &pResourceView);
+}
+
 bool Elite::Renderer::InitializeSoftware()
 {
+	// The pixels are always written as 0x00RRGGBB, which is what the window surface normally is already, so it can be rendered to directly
+	// Only if it's in any other format, the frames get rendered into a back buffer first, and then blitted (and converted) to the window surface
 	m_pFrontBuffer = SDL_GetWindowSurface(m_pWindow);
-	m_pBackBuffer = SDL_CreateRGBSurface(0, m_Width, m_Height, 32, 0, 0, 0, 0);
-	m_pBackBufferPixels = (uint32_t*)m_pBackBuffer->pixels;
+	if (m_pFrontBuffer == nullptr)
+		return false;
+	if (m_pFrontBuffer->format->format != SDL_PIXELFORMAT_RGB888 || m_pFrontBuffer->pitch != int(m_Width * sizeof(uint32_t)))
+	{
+		m_pBackBuffer = SDL_CreateRGBSurfaceWithFormat(0, m_Width, m_Height, 32, SDL_PIXELFORMAT_RGB888);
+		if (m_pBackBuffer == nullptr)
+			return false;
+	}
 	m_pDepthBuffer = new float[size_t(m_Width) * m_Height];
-	m_TransformedVerticesTriangle.resize(3);
+	m_pVisibilityBuffer = new uint32_t[size_t(m_Width) * m_Height];
+	m_pAccumulationBuffer = new float[size_t(m_Width) * m_Height * 4];
+	m_pRevealageBuffer = new float[size_t(m_Width) * m_Height];
+
+	// Set up the screen tiles and the threads that will rasterize them
+	m_AmountTilesX = (m_Width + m_TileSize - 1) / m_TileSize;
+	m_AmountTilesY = (m_Height + m_TileSize - 1) / m_TileSize;
+	m_TileBinOffsets.resize(size_t(m_AmountTilesX) * m_AmountTilesY + 1);
+	m_TileBinCursors.resize(size_t(m_AmountTilesX) * m_AmountTilesY);
+	m_TileStats.resize(size_t(m_AmountTilesX) * m_AmountTilesY);
+	const uint32_t dirtyTile = m_DirtyTile; // Every tile starts out needing a full clear
+	m_TileClearColors.resize(size_t(m_AmountTilesX) * m_AmountTilesY, dirtyTile);
+	m_pThreadPool = new ThreadPool();
 	
-	return (m_pFrontBuffer && m_pBackBuffer && m_pBackBufferPixels && m_pDepthBuffer);
+	return (m_pDepthBuffer && m_pVisibilityBuffer && m_pAccumulationBuffer && m_pRevealageBuffer);
 }
 
 
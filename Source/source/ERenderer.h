@@ -10,13 +10,21 @@
 #include <cstdint>
 #include <vector>
 
+#include "Meshlet.h"
+#include "MeshSimplifier.h"
+#include "SceneBVH.h"
+#include "Span.h"
+
 enum class SAMPLER_FILTER;
 enum class CULL_MODE;
 class Mesh;
 struct VS_INPUT;
 struct VS_OUTPUT;
 class Texture;
+class MaterialTexture;
+struct MaterialSample;
 class Scene;
+class ThreadPool;
 struct SDL_Window;
 struct SDL_Surface;
 
@@ -28,6 +36,106 @@ enum class RENDER_MODE
 
 namespace Elite
 {
+	// Planes of clip space a vertex can be outside of, as bits of its clip code
+	// (the guard band planes are the frustum's side planes scaled out, any triangle inside those can be rasterized without clipping)
+	enum ClipCode : uint16_t
+	{
+		ClipLeft = 1 << 0,
+		ClipRight = 1 << 1,
+		ClipBottom = 1 << 2,
+		ClipTop = 1 << 3,
+		ClipNear = 1 << 4,
+		ClipFar = 1 << 5,
+		ClipGuardBandLeft = 1 << 6,
+		ClipGuardBandRight = 1 << 7,
+		ClipGuardBandBottom = 1 << 8,
+		ClipGuardBandTop = 1 << 9
+	};
+
+	// Attribute streams of the post-transform vertices in Software Mode (structure of arrays: one float per vertex in each)
+	enum VertexStream
+	{
+		StreamU,
+		StreamV,
+		StreamNormalX,
+		StreamNormalY,
+		StreamNormalZ,
+		StreamTangentX,
+		StreamTangentY,
+		StreamTangentZ,
+		StreamViewDirectionX,
+		StreamViewDirectionY,
+		StreamViewDirectionZ,
+		StreamColorR,
+		StreamColorG,
+		StreamColorB,
+		AmountVertexStreams
+	};
+
+	// Sets of streams that make up each attribute, as bits
+	enum VertexStreamBits : uint32_t
+	{
+		StreamBitsUV = (1 << StreamU) | (1 << StreamV),
+		StreamBitsNormal = (1 << StreamNormalX) | (1 << StreamNormalY) | (1 << StreamNormalZ),
+		StreamBitsTangent = (1 << StreamTangentX) | (1 << StreamTangentY) | (1 << StreamTangentZ),
+		StreamBitsViewDirection = (1 << StreamViewDirectionX) | (1 << StreamViewDirectionY) | (1 << StreamViewDirectionZ),
+		StreamBitsColor = (1 << StreamColorR) | (1 << StreamColorG) | (1 << StreamColorB)
+	};
+
+	// Edge function of a triangle in fixed-point raster space: E(x, y) = A * x + B * y + C, which is >= MinValue on the inside of the edge
+	struct EdgeFunction
+	{
+		int64_t A, B, C;
+		int64_t MinValue; // 0 for top-left edges and 1 for the others, so pixels right on an edge shared by 2 triangles are only drawn once
+	};
+
+	// A triangle that survived culling in Software Mode, already set up for rasterization and waiting to be drawn by the tiles it overlaps
+	struct BinnedTriangle
+	{
+		const Mesh* pMesh;
+		uint32_t VertexIdxs[3]; // Indexes of its vertices in the post-transform buffer
+		EdgeFunction Edges[3]; // Edge i is the one opposite to vertex i, so its value is that vertex's (unnormalized) barycentric weight
+		float InvArea;
+		float MinDepth; // Closest depth any of its pixels can have
+		uint32_t MinX, MinY, MaxX, MaxY; // Bounding box, already clamped to the screen (max is exclusive)
+		bool TransparencyOn;
+	};
+
+	// Software Mode statistics of a frame, to measure the overdraw
+	struct RenderStats
+	{
+		uint32_t AmountFragments; // Fragments that passed the depth test at the moment they were rasterized
+		uint32_t AmountShadedFragments; // Fragments that went through the whole interpolation and shading
+		uint32_t AmountCoveredPixels; // Pixels that got at least one fragment
+		uint32_t AmountHiZRejectedBlocks; // 8x8 blocks of a triangle that the Hi-Z skipped as a whole
+		uint32_t AmountHiZRejectedPixels; // Pixels of a triangle's bounding box inside those blocks
+		uint32_t AmountBackFaceCulledTriangles; // Triangles facing away (or towards the camera, when culling the front faces), culled before their vertices got transformed
+		uint32_t AmountTransformedVertices; // Vertices used by at least one triangle that survived the back-face culling
+		uint32_t AmountFrustumCulledTriangles; // Triangles completely outside one of the frustum planes
+		uint32_t AmountClippedTriangles; // Triangles that crossed the near or far plane, or reached out of the guard band
+	};
+
+	// Everything a thread keeps track of while it renders a single tile
+	struct TileContext
+	{
+		uint32_t MinX, MinY, MaxX, MaxY; // Pixel bounds of the tile (max is exclusive)
+		uint64_t CoveredRows[64]; // Pixels that got at least one fragment, for the overdraw statistics
+		float HiZMaxDepths[64]; // Hi-Z: farthest depth of each 8x8 block of the tile, so a triangle can skip a whole block if it's behind all of it
+		uint64_t HiZDirtyBlocks; // Blocks whose depth got written since their farthest depth was last calculated
+		float RowColorsR[64], RowColorsG[64], RowColorsB[64]; // Shaded colors of the row being rendered, which get converted to the back buffer's format all at once
+		uint64_t TransparentRows[64]; // Pixels that got at least one transparent fragment, so only those get their accumulation cleared and composited
+		RenderStats Stats;
+	};
+
+	// Output of the coverage kernels for one row of a triangle inside a tile: the pixels that are inside and passed the depth test, with their weights and depth
+	// (a row inside a tile is never more than 64 pixels, so bit i of the mask and index i of the arrays are pixel minX + i)
+	struct RowCoverage
+	{
+		uint64_t Mask;
+		float W0[64], W1[64], W2[64];
+		float Depth[64];
+	};
+
 	class Renderer final
 	{
 	public:
@@ -40,23 +148,87 @@ namespace Elite
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
 		void Render(Scene* pScene, SAMPLER_FILTER samplerFilter, RENDER_MODE renderMode, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh = nullptr);
-		void RenderDirectX(Scene* pScene, SAMPLER_FILTER samplerFilter, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh) const;
-		void RenderSoftware(Scene* pScene, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh);
+		void RenderDirectX(Scene* pScene, SAMPLER_FILTER samplerFilter, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh);
+		void RenderSoftware(Scene* pScene, SAMPLER_FILTER samplerFilter, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh);
 
+		void SelectMeshLods(const ECamera* pCamera, bool leftHandCoordSystem, const Mesh* pHiddenMesh);
 
-		void ConvertVerticesScreenSpace(const FMatrix4& transformMatrix, const FMatrix4& viewMatrix, float fov, float farPlane, float nearPlane, const FPoint3& cameraPos);
-		void CalculatePixel(const Texture* pDiffuseText, const Texture* pNormalText, const Texture* pSpecularText, const Texture* pGlossText,
-			float shininess, float w0, float w1, float w2, int c, int r, const FPoint3& cameraPos,
-			const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight, bool transparencyOn) const;
-		void PixelShading(const VS_OUTPUT& outputVertex, RGBColor& finalColor, const Texture* pNormalText, const Texture* pSpecularText, const Texture* pGlossText, float shininess, const FVector3& interpViewDir,
+		uint32_t GetVertexStreams(const Mesh* pMesh, bool transparencyOn) const;
+		uint32_t AddVertices(uint32_t amountVertices);
+		uint32_t ConvertVerticesScreenSpace(Span<const VS_INPUT> vertices, const FMatrix4& transformMatrix, const FMatrix4& viewMatrix, float fov, float farPlane, float nearPlane,
+			const FPoint3& cameraPos, uint32_t vertexStreams, const uint8_t* pUsedVertices);
+		void ClipTriangle(const Mesh* pMesh, const uint32_t* pVertexIdxs, bool transparencyOn, uint32_t vertexStreams);
+		uint16_t GetClipCode(const FPoint4& clipPos) const;
+		float GetClipPlaneDistance(const FPoint4& clipPos, uint16_t plane) const;
+		IPoint2 GetRasterPosition(const FPoint4& ndcPos) const;
+		void BinTriangle(const Mesh* pMesh, const uint32_t* pVertexIdxs, bool transparencyOn);
+		void FillTileBins();
+		void RenderTile(uint32_t tileIdx, const RGBColor& backgroundColor, const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight,
+			RenderStats& tileStats, uint32_t& tileClearColor) const;
+		void ClearTile(const TileContext& tile, bool clearDepth, bool clearPixels, uint32_t packedBackgroundColor) const;
+		void RasterizeTriangle(uint32_t triangleIdx, TileContext& tile, bool toVisibilityBuffer, const FVector3& lightDirection, float lightIntensity,
+			const FVector3& ambientLight) const;
+		float GetHiZMaxDepth(TileContext& tile, uint32_t x, uint32_t y) const;
+		uint32_t GetHiZBlockIdx(const TileContext& tile, uint32_t x, uint32_t y) const;
+		void ResolveVisibilityTile(TileContext& tile, const RGBColor& backgroundColor, const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight) const;
+		bool FitsVectorizedRasterizer(const BinnedTriangle& triangle, uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY) const;
+		void CoverRowScalar(const BinnedTriangle& triangle, const int64_t* pRowEdges, const float* pDepths, uint32_t minX, uint32_t startX, uint32_t maxX, uint32_t r,
+			RowCoverage& coverage) const;
+		void CoverRowVectorized(const BinnedTriangle& triangle, const int64_t* pRowEdges, const float* pDepths, uint32_t minX, uint32_t startX, uint32_t maxX,
+			uint32_t r, RowCoverage& coverage) const;
+		FVector2 GetInterpolatedUV(const BinnedTriangle& triangle, uint32_t x, uint32_t y) const;
+		void GetQuadUVDerivatives(const BinnedTriangle& triangle, uint32_t x, uint32_t y, FVector2& uvDx, FVector2& uvDy) const;
+		RGBColor CalculatePixel(const BinnedTriangle& triangle, float w0, float w1, float w2, const FVector2& uvDx, const FVector2& uvDy,
 			const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight) const;
+		FVector4 SampleTexture(const Texture* pTexture, const FVector2& uv, const FVector2& uvDx, const FVector2& uvDy) const;
+		MaterialSample SampleMaterial(const MaterialTexture* pMaterialText, const FVector2& uv, const FVector2& uvDx, const FVector2& uvDy) const;
+		void AccumulateTransparentPixel(const BinnedTriangle& triangle, float w0, float w1, float w2, const FVector2& uvDx, const FVector2& uvDy, uint32_t c, uint32_t r,
+			TileContext& tile) const;
+		static float GetTransparencyWeight(float alpha, float viewDepth);
+		void CompositeTransparentTile(TileContext& tile) const;
+		void WriteRowColors(const TileContext& tile, uint64_t mask, uint32_t minX, uint32_t amountPixels, uint32_t r) const;
+		static uint32_t PackColor(float r, float g, float b);
+		void PixelShading(const VS_OUTPUT& outputVertex, RGBColor& finalColor, const MaterialSample& materialSample, bool hasNormalMap, bool hasSpecularMaps, float shininess,
+			const FVector3& interpViewDir, const FVector3& lightDirection, float lightIntensity, const FVector3& ambientLight) const;
 
 		
 		HRESULT InitializeDirectX();
 		bool InitializeSoftware();
+		HRESULT CreateTransparencyTarget(DXGI_FORMAT format, ID3D11Texture2D*& pTexture, ID3D11RenderTargetView*& pTargetView, ID3D11ShaderResourceView*& pResourceView);
 
 		ID3D11Device* GetDevice() const { return m_pDevice; }
 
+		// Switches Software Mode between the vectorized (SSE/AVX2) and the scalar coverage and depth test, which give the exact same image
+		void SetVectorizedRasterizer(bool isOn) { m_VectorizedRasterizerOn = isOn; }
+		bool IsVectorizedRasterizerOn() const { return m_VectorizedRasterizerOn; }
+
+		// Switches Software Mode to first rasterize only the closest triangle of each pixel (and its depth), and then shade every visible pixel just once
+		void SetVisibilityBuffer(bool isOn) { m_VisibilityBufferOn = isOn; }
+		bool IsVisibilityBufferOn() const { return m_VisibilityBufferOn; }
+
+		// Switches the Hi-Z block rejection in Software Mode (it never changes the image, only how much per-pixel work gets skipped)
+		void SetHiZ(bool isOn) { m_HiZOn = isOn; }
+		bool IsHiZOn() const { return m_HiZOn; }
+
+		// Switches Software Mode between filtering the textures across their mip chains (with the level picked per 2x2 pixel quad) and only ever reading their full size level
+		void SetMipmaps(bool isOn) { m_MipmapsOn = isOn; }
+		bool IsMipmapsOn() const { return m_MipmapsOn; }
+
+		// Switches Software Mode's pixel shading between the exact math and the fast approximations (rsqrt normalization)
+		void SetFastMath(bool isOn) { m_FastMathOn = isOn; }
+		bool IsFastMathOn() const { return m_FastMathOn; }
+		// Renders the scene in Software Mode with the exact shading and then with the fast math, and returns the largest difference of any color channel between the two
+		// (in 8 bit steps, so anything above 1 means the approximations got too far off)
+		uint32_t GetFastMathError(Scene* pScene, SAMPLER_FILTER samplerFilter, CULL_MODE cullMode, bool fireFXVisible, Mesh* pFireMesh);
+
+		const RenderStats& GetSoftwareStats() const { return m_SoftwareStats; }
+		// Meshlets culled last frame, in whichever mode it was rendered
+		const MeshletStats& GetMeshletStats() const { return m_MeshletStats; }
+		// And the meshes culled as a whole by the scene's BVH
+		const SceneCullStats& GetSceneCullStats() const { return m_SceneCullStats; }
+		// And how many triangles the levels of detail the visible meshes were drawn at saved
+		const LodStats& GetLodStats() const { return m_LodStats; }
+
 	private:
 		SDL_Window* m_pWindow;
 		uint32_t m_Width;
@@ -73,13 +245,80 @@ namespace Elite
 		ID3D11DepthStencilView* m_pDepthStencilView;
 		ID3D11Resource* m_pRenderTargetBuffer;
 		ID3D11RenderTargetView* m_pRenderTargetView;
+		// Weighted blended order-independent transparency: the transparent meshes add up their weighted colors in the accumulation target and multiply
+		// their coverage into the revealage target (in any order), and then a single full screen pass composites the average of them on top of the opaque ones
+		ID3D11Texture2D* m_pAccumulationTexture;
+		ID3D11RenderTargetView* m_pAccumulationTargetView;
+		ID3D11ShaderResourceView* m_pAccumulationResourceView;
+		ID3D11Texture2D* m_pRevealageTexture;
+		ID3D11RenderTargetView* m_pRevealageTargetView;
+		ID3D11ShaderResourceView* m_pRevealageResourceView;
 
 		SDL_Surface* m_pFrontBuffer = nullptr;
-		SDL_Surface* m_pBackBuffer = nullptr;
+		SDL_Surface* m_pBackBuffer = nullptr; // Only needed if the window surface isn't 0x00RRGGBB, otherwise Software Mode renders straight into it
 		float* m_pDepthBuffer = nullptr;
+		uint32_t* m_pVisibilityBuffer = nullptr; // Index of the binned triangle that's visible in each pixel
+		float* m_pAccumulationBuffer = nullptr; // Sum of the weighted, premultiplied RGBA of each pixel's transparent fragments (4 floats a pixel)
+		float* m_pRevealageBuffer = nullptr; // Product of (1 - alpha) of each pixel's transparent fragments: how much of the opaque color still shows through
 		uint32_t* m_pBackBufferPixels = nullptr;
 
-		std::vector<VS_OUTPUT> m_TransformedVerticesTriangle; // This is a temporary vector to store whatever triangle is currently being calculated in Software Mode - it's stored as a member variable for optimization purposes
+		// Every frame, each mesh's vertices are transformed once (in parallel batches) into the post-transform buffer, and the triangles just index into it
+		// The buffer is a structure of arrays, and only the attribute streams a mesh's shading reads get written for its vertices
+		static const uint32_t m_VertexBatchSize = 1024;
+		uint32_t m_AmountVertices;
+		std::vector<float> m_VertexStreams[AmountVertexStreams];
+		std::vector<float> m_InvW;
+		std::vector<FPoint3> m_NdcPositions;
+		std::vector<FPoint3> m_WorldPositions;
+		std::vector<IPoint2> m_RasterPositions;
+		std::vector<FPoint4> m_ClipPositions;
+		std::vector<uint16_t> m_ClipCodes;
+
+		// Triangles of the mesh being set up that survived the back-face culling (as indexes into the mesh's own vertices), and which of those vertices they use
+		std::vector<uint32_t> m_VisibleTriangles;
+		std::vector<uint8_t> m_UsedVertices;
+
+		// Triangles are culled against the frustum planes, but only clipped against the near and far planes and a guard band 16 times the size of the screen
+		static const uint16_t m_FrustumClipCodes = ClipLeft | ClipRight | ClipBottom | ClipTop | ClipNear | ClipFar;
+		static const uint16_t m_ClippingClipCodes = ClipNear | ClipFar | ClipGuardBandLeft | ClipGuardBandRight | ClipGuardBandBottom | ClipGuardBandTop;
+		static constexpr float m_GuardBandScale = 16.f;
+
+		// Raster positions are snapped to fixed-point with 8 bits of sub-pixel precision (and clamped to +-2^29, to keep the edge functions in 64 bits)
+		static const int32_t m_SubPixelBits = 8;
+		static const int32_t m_SubPixelScale = 1 << m_SubPixelBits;
+		static constexpr float m_MaxRasterCoord = float(1 << 29);
+
+		// Software Mode bins every triangle into the screen tiles it overlaps, and then each tile is rasterized by a single thread
+		// (so no locks are needed on the back/depth buffer, and the triangles keep their submission order inside each tile)
+		static const uint32_t m_TileSize = 64;
+		static_assert(m_TileSize <= 64, "RowCoverage can only hold rows of up to 64 pixels");
+		static const uint32_t m_HiZBlockSize = 8;
+		static_assert((m_TileSize / m_HiZBlockSize) * (m_TileSize / m_HiZBlockSize) <= 64, "TileContext can only hold up to 64 Hi-Z blocks");
+		uint32_t m_AmountTilesX;
+		uint32_t m_AmountTilesY;
+		ThreadPool* m_pThreadPool;
+		std::vector<BinnedTriangle> m_BinnedTriangles;
+		// The bins are all packed into one array (counted first, then filled), so binning doesn't allocate per tile
+		std::vector<uint32_t> m_TileBinOffsets;
+		std::vector<uint32_t> m_TileBinCursors;
+		std::vector<uint32_t> m_TileBinTriangles;
+		bool m_VectorizedRasterizerOn;
+		bool m_VisibilityBufferOn;
+		bool m_HiZOn;
+		bool m_MipmapsOn;
+		bool m_FastMathOn;
+		SAMPLER_FILTER m_SamplerFilter; // The filter of the frame being rendered in Software Mode
+		std::vector<RenderStats> m_TileStats;
+
+		// Tiles are cleared lazily, by the thread that renders them: this is the background color a tile was left filled with (with its depth cleared too)
+		// when nothing got drawn on it last frame, so it doesn't have to be touched at all this frame, or m_DirtyTile if it does need a full clear
+		static const uint32_t m_DirtyTile = 0xFFFFFFFF;
+		std::vector<uint32_t> m_TileClearColors;
+		RenderStats m_SoftwareStats;
+		MeshletStats m_MeshletStats;
+		SceneCullStats m_SceneCullStats;
+		LodStats m_LodStats;
+		std::vector<Mesh*> m_VisibleMeshes; // The scene's meshes that are in the frustum this frame
 	};
 }
 
@@ -0,0 +1,46 @@
+#pragma once
+#include <emmintrin.h>
+
+#include "EMath.h"
+
+// Approximations of the math the Software Mode's pixel shading spends the most time on (the sqrt and divide of its normalizations), for its fast-math shading
+// Each one is accurate to well under one step of an 8 bit color channel, which is all the back buffer keeps anyway
+// (powf isn't approximated: an exp2/log2 polynomial fit of it measured no faster than the CRT's own)
+namespace FastMath
+{
+	// Zero vectors get this squared length instead, which keeps the Newton-Raphson step's products well clear of the (very slow) denormal range
+	static const float m_MinSquaredLength = 1e-30f;
+
+	// 1 / sqrt(value): the SSE estimate (12 bits), refined with a Newton-Raphson step to ~22 bits
+	inline float InvSqrt(float value)
+	{
+		const __m128 valueSS = _mm_set_ss(std::max(value, m_MinSquaredLength));
+		const __m128 estimate = _mm_rsqrt_ss(valueSS);
+		const __m128 refinement = _mm_sub_ss(_mm_set_ss(1.5f), _mm_mul_ss(_mm_mul_ss(_mm_set_ss(0.5f), valueSS), _mm_mul_ss(estimate, estimate)));
+		return _mm_cvtss_f32(_mm_mul_ss(estimate, refinement));
+	}
+
+	inline void Normalize(Elite::FVector3& v)
+	{
+		v *= InvSqrt(Elite::Dot(v, v));
+	}
+
+	// Normalizes 3 vectors at once, each in its own SIMD lane (a zero vector stays zero)
+	inline void Normalize(Elite::FVector3& a, Elite::FVector3& b, Elite::FVector3& c)
+	{
+		const __m128 x = _mm_setr_ps(a.x, b.x, c.x, 1.f);
+		const __m128 y = _mm_setr_ps(a.y, b.y, c.y, 0.f);
+		const __m128 z = _mm_setr_ps(a.z, b.z, c.z, 0.f);
+		const __m128 squaredLength = _mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)), _mm_set1_ps(m_MinSquaredLength));
+		const __m128 estimate = _mm_rsqrt_ps(squaredLength);
+		const __m128 invLength = _mm_mul_ps(estimate, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), squaredLength), _mm_mul_ps(estimate, estimate))));
+
+		alignas(16) float scaled[3][4];
+		_mm_store_ps(scaled[0], _mm_mul_ps(x, invLength));
+		_mm_store_ps(scaled[1], _mm_mul_ps(y, invLength));
+		_mm_store_ps(scaled[2], _mm_mul_ps(z, invLength));
+		a = Elite::FVector3{ scaled[0][0], scaled[1][0], scaled[2][0] };
+		b = Elite::FVector3{ scaled[0][1], scaled[1][1], scaled[2][1] };
+		c = Elite::FVector3{ scaled[0][2], scaled[1][2], scaled[2][2] };
+	}
+}
@@ -0,0 +1,50 @@
+#include "pch.h"
+#include "MappedFile.h"
+
+#include <Windows.h>
+
+MappedFile::MappedFile(const std::string& filePath)
+	: m_FileHandle{ INVALID_HANDLE_VALUE }
+	, m_MappingHandle{ nullptr }
+	, m_pData{ nullptr }
+	, m_Size{}
+{
+	// Open the file
+	m_FileHandle = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_FileHandle == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER size{};
+	if (GetFileSizeEx(m_FileHandle, &size) == FALSE || size.QuadPart == 0)
+		return;
+
+	// And map all of it
+	m_MappingHandle = CreateFileMappingA(m_FileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_MappingHandle == nullptr)
+		return;
+
+	m_pData = static_cast<const char*>(MapViewOfFile(m_MappingHandle, FILE_MAP_READ, 0, 0, 0));
+	if (m_pData != nullptr)
+		m_Size = size_t(size.QuadPart);
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_pData)
+	{
+		UnmapViewOfFile(m_pData);
+		m_pData = nullptr;
+	}
+
+	if (m_MappingHandle)
+	{
+		CloseHandle(m_MappingHandle);
+		m_MappingHandle = nullptr;
+	}
+
+	if (m_FileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_FileHandle);
+		m_FileHandle = INVALID_HANDLE_VALUE;
+	}
+}
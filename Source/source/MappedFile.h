@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Read-only view of a whole file, mapped straight into memory (the OS pages it in as it gets read, instead of it being copied into a buffer first)
+class MappedFile final
+{
+public:
+	MappedFile(const std::string& filePath);
+	~MappedFile();
+
+	MappedFile(const MappedFile& other) = delete;
+	MappedFile(MappedFile&& other) noexcept = delete;
+	MappedFile& operator=(const MappedFile& other) = delete;
+	MappedFile& operator=(MappedFile&& other) noexcept = delete;
+
+	// An empty file can't be mapped, so it doesn't count as open either
+	bool IsOpen() const { return m_pData != nullptr; }
+	const char* GetData() const { return m_pData; }
+	size_t GetSize() const { return m_Size; }
+
+private:
+	void* m_FileHandle;
+	void* m_MappingHandle;
+	const char* m_pData;
+	size_t m_Size;
+};
@@ -0,0 +1,212 @@
+#include "pch.h"
+#include "MaterialTexture.h"
+
+#include <immintrin.h>
+
+MaterialTexture::MaterialTexture(const Texture& diffuseText, const Texture& normalText, const Texture& specularText, const Texture& glossText)
+	: m_BorderTexel{}
+	, m_MipLevels{}
+	, m_pTexels{}
+{
+	// Where the separate maps would read their border color, the baked one reads all 4 of them at once
+	const uint32_t borderTexel = Texture::GetBorderTexel();
+	m_BorderTexel = PackTexel(borderTexel, borderTexel, borderTexel, borderTexel);
+
+	// Use the same mip chain as the maps (so every filter picks the exact same texels out of it)
+	size_t amountTexels = 0;
+	for (uint32_t i = 0; i < diffuseText.GetAmountMipLevels(); ++i)
+	{
+		const MipLevel level{ diffuseText.GetWidth(i), diffuseText.GetHeight(i), (diffuseText.GetWidth(i) + m_BlockSize - 1) / m_BlockSize, nullptr };
+		m_MipLevels.push_back(level);
+		amountTexels += size_t(level.AmountBlocksX) * ((level.Height + m_BlockSize - 1) / m_BlockSize) * m_BlockSize * m_BlockSize;
+	}
+	m_pTexels = static_cast<uint64_t*>(_mm_malloc(amountTexels * sizeof(uint64_t), 64));
+	std::fill(m_pTexels, m_pTexels + amountTexels, uint64_t(0));
+
+	// And pack each level's texels, straight into their blocks
+	uint64_t* pLevelTexels = m_pTexels;
+	for (uint32_t i = 0; i < uint32_t(m_MipLevels.size()); ++i)
+	{
+		MipLevel& level = m_MipLevels[i];
+		level.pTexels = pLevelTexels;
+		for (uint32_t y = 0; y < level.Height; ++y)
+		{
+			for (uint32_t x = 0; x < level.Width; ++x)
+			{
+				level.pTexels[GetTexelIdx(level, x, y)] = PackTexel(diffuseText.GetLevelTexel(i, x, y), normalText.GetLevelTexel(i, x, y),
+					specularText.GetLevelTexel(i, x, y), glossText.GetLevelTexel(i, x, y));
+			}
+		}
+		pLevelTexels += size_t(level.AmountBlocksX) * ((level.Height + m_BlockSize - 1) / m_BlockSize) * m_BlockSize * m_BlockSize;
+	}
+}
+
+MaterialTexture::~MaterialTexture()
+{
+	if (m_pTexels)
+	{
+		_mm_free(m_pTexels);
+		m_pTexels = nullptr;
+	}
+}
+
+bool MaterialTexture::CanBake(const Texture& diffuseText, const Texture& normalText, const Texture& specularText, const Texture& glossText)
+{
+	// Every map needs to have loaded, and have the same size and mip chain as the diffuse one (a DDS keeps the amount of levels its file has)
+	const Texture* pMaps[]{ &diffuseText, &normalText, &specularText, &glossText };
+	for (const Texture* pMap : pMaps)
+	{
+		if (pMap->GetAmountMipLevels() == 0 || pMap->GetAmountMipLevels() != diffuseText.GetAmountMipLevels() || pMap->GetWidth() != diffuseText.GetWidth()
+			|| pMap->GetHeight() != diffuseText.GetHeight())
+			return false;
+	}
+	return true;
+}
+
+MaterialSample MaterialTexture::SamplePoint(const Elite::FVector2& uv, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy) const
+{
+	// Just the closest texel of the closest level
+	const auto amountMipLevels = uint32_t(m_MipLevels.size());
+	const MipLevel& level = m_MipLevels[Texture::GetPointFootprint(m_MipLevels[0].Width, m_MipLevels[0].Height, amountMipLevels, uvDx, uvDy).LevelIdx];
+	const float x = Elite::Clamp(uv.x * level.Width, -1.f, static_cast<float>(level.Width));
+	const float y = Elite::Clamp(uv.y * level.Height, -1.f, static_cast<float>(level.Height));
+	const uint64_t texel = GetTexel(level, static_cast<int>(floorf(x)), static_cast<int>(floorf(y)));
+
+	float channels[8];
+	for (uint32_t i = 0; i < 8; ++i)
+		channels[i] = static_cast<float>((texel >> (i * 8)) & 0xFF) / 255.f;
+	return UnpackChannels(channels);
+}
+
+MaterialSample MaterialTexture::SampleTrilinear(const Elite::FVector2& uv, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy) const
+{
+	const auto amountMipLevels = uint32_t(m_MipLevels.size());
+	return SampleFootprint(Texture::GetTrilinearFootprint(m_MipLevels[0].Width, m_MipLevels[0].Height, amountMipLevels, uvDx, uvDy), uv);
+}
+
+MaterialSample MaterialTexture::SampleAnisotropic(const Elite::FVector2& uv, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy) const
+{
+	const auto amountMipLevels = uint32_t(m_MipLevels.size());
+	return SampleFootprint(Texture::GetAnisotropicFootprint(m_MipLevels[0].Width, m_MipLevels[0].Height, amountMipLevels, uvDx, uvDy), uv);
+}
+
+uint64_t MaterialTexture::PackTexel(uint32_t diffuse, uint32_t normal, uint32_t specular, uint32_t gloss)
+{
+	// The normal map stores the normal remapped to [0, 1]
+	const Elite::FVector3 normalVec{ static_cast<float>(normal & 0xFF) / 255.f * 2.f - 1.f, static_cast<float>((normal >> 8) & 0xFF) / 255.f * 2.f - 1.f,
+		static_cast<float>((normal >> 16) & 0xFF) / 255.f * 2.f - 1.f };
+
+	// Only the red channel of the specular and glossiness maps gets used
+	return uint64_t(diffuse & 0xFFFFFF) | (uint64_t(specular & 0xFF) << 24) | (uint64_t(EncodeOctahedral(normalVec)) << 32) | (uint64_t(gloss & 0xFF) << 48);
+}
+
+uint32_t MaterialTexture::EncodeOctahedral(const Elite::FVector3& normal)
+{
+	// Project the direction onto the octahedron |x| + |y| + |z| = 1, and fold its bottom half over the top one, which flattens it into a square
+	const float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+	if (sum <= 0.f)
+		return 0x8080; // Straight up, for a texel that doesn't have a direction
+
+	float x = normal.x / sum;
+	float y = normal.y / sum;
+	if (normal.z < 0.f)
+	{
+		const float foldedX = (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f);
+		const float foldedY = (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	// And store that square in 8 bits per axis, rounded
+	const auto encodedX = static_cast<uint32_t>(Elite::Clamp(x * 0.5f + 0.5f, 0.f, 1.f) * 255.f + 0.5f);
+	const auto encodedY = static_cast<uint32_t>(Elite::Clamp(y * 0.5f + 0.5f, 0.f, 1.f) * 255.f + 0.5f);
+	return encodedX | (encodedY << 8);
+}
+
+Elite::FVector3 MaterialTexture::DecodeOctahedral(float x, float y)
+{
+	// Unfold the square back into the octahedron (the points outside its center diamond go to the bottom half), and push that out to the sphere
+	Elite::FVector3 normal{ x, y, 1.f - std::abs(x) - std::abs(y) };
+	const float fold = std::max(-normal.z, 0.f);
+	normal.x += (normal.x >= 0.f) ? -fold : fold;
+	normal.y += (normal.y >= 0.f) ? -fold : fold;
+	return Elite::GetNormalized(normal);
+}
+
+MaterialSample MaterialTexture::UnpackChannels(const float* pChannels)
+{
+	MaterialSample sample{};
+	sample.Diffuse = Elite::RGBColor{ pChannels[0], pChannels[1], pChannels[2] };
+	sample.Specular = pChannels[3];
+	sample.Normal = DecodeOctahedral(pChannels[4] * 2.f - 1.f, pChannels[5] * 2.f - 1.f);
+	sample.Glossiness = pChannels[6];
+	return sample;
+}
+
+uint64_t MaterialTexture::GetTexel(const MipLevel& level, int x, int y) const
+{
+	// AddressU = Border and AddressV = Clamp, just like Texture
+	if (static_cast<uint32_t>(x) >= level.Width)
+		return m_BorderTexel;
+
+	const int maxY = static_cast<int>(level.Height) - 1;
+	return level.pTexels[GetTexelIdx(level, x, Elite::Clamp(y, 0, maxY))];
+}
+
+uint32_t MaterialTexture::GetTexelIdx(const MipLevel& level, uint32_t x, uint32_t y) const
+{
+	// Find the block, and then the texel inside it
+	const uint32_t blockIdx = (x / m_BlockSize) + (y / m_BlockSize) * level.AmountBlocksX;
+	return blockIdx * (m_BlockSize * m_BlockSize) + (y % m_BlockSize) * m_BlockSize + (x % m_BlockSize);
+}
+
+void MaterialTexture::SampleBilinear(const MipLevel& level, const Elite::FVector2& uv, __m128i& lowChannels, __m128i& highChannels) const
+{
+	int x0{}, y0{};
+	__m128i topWeights{}, bottomWeights{};
+	Texture::GetBilinearWeights(level.Width, level.Height, uv, x0, y0, topWeights, bottomWeights);
+
+	// Same as Texture's kernel, only with 8 channels: interleave the left and right texel of a row byte by byte,
+	// and then the first and last 4 channels each take a single multiply-add per row
+	const uint64_t texels[4]{ GetTexel(level, x0, y0), GetTexel(level, x0 + 1, y0), GetTexel(level, x0, y0 + 1), GetTexel(level, x0 + 1, y0 + 1) };
+	const __m128i topRow = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&texels[0])), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&texels[1])));
+	const __m128i bottomRow = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&texels[2])), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&texels[3])));
+
+	const __m128i zero = _mm_setzero_si128();
+	lowChannels = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(topRow, zero), topWeights), _mm_madd_epi16(_mm_unpacklo_epi8(bottomRow, zero), bottomWeights));
+	highChannels = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi8(topRow, zero), topWeights), _mm_madd_epi16(_mm_unpackhi_epi8(bottomRow, zero), bottomWeights));
+}
+
+MaterialSample MaterialTexture::SampleFootprint(const Texture::Footprint& footprint, const Elite::FVector2& uv) const
+{
+	// Add up the probes' fixed point sums, for both levels
+	__m128i sums[2]{ _mm_setzero_si128(), _mm_setzero_si128() };
+	__m128i nextLevelSums[2]{ _mm_setzero_si128(), _mm_setzero_si128() };
+	for (uint32_t i = 0; i < footprint.AmountProbes; ++i)
+	{
+		const Elite::FVector2 probeUV = footprint.GetProbeUV(uv, i);
+		__m128i lowChannels{}, highChannels{};
+		SampleBilinear(m_MipLevels[footprint.LevelIdx], probeUV, lowChannels, highChannels);
+		sums[0] = _mm_add_epi32(sums[0], lowChannels);
+		sums[1] = _mm_add_epi32(sums[1], highChannels);
+		if (footprint.LevelBlend > 0.f)
+		{
+			SampleBilinear(m_MipLevels[footprint.LevelIdx + 1], probeUV, lowChannels, highChannels);
+			nextLevelSums[0] = _mm_add_epi32(nextLevelSums[0], lowChannels);
+			nextLevelSums[1] = _mm_add_epi32(nextLevelSums[1], highChannels);
+		}
+	}
+
+	// Blend the levels, and bring the sums back to [0, 1]
+	alignas(16) float channels[8];
+	const __m128 levelBlend = _mm_set1_ps(footprint.LevelBlend);
+	const __m128 sumScale = _mm_set1_ps(footprint.SumScale);
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		__m128 result = _mm_cvtepi32_ps(sums[i]);
+		if (footprint.LevelBlend > 0.f)
+			result = _mm_add_ps(result, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(nextLevelSums[i]), result), levelBlend));
+		_mm_store_ps(channels + i * 4, _mm_mul_ps(result, sumScale));
+	}
+	return UnpackChannels(channels);
+}
@@ -4,17 +4,85 @@
 #include "ECamera.h"
 #include "Scene.h"
 #include "Texture.h";
+#include "MappedFile.h"
+#include "MaterialTexture.h"
+#include "ThreadPool.h"
+#include "VertexCache.h"
+
+
+MeshGeometry::MeshGeometry(std::vector<VS_INPUT>&& vertices, std::vector<uint32_t>&& indices)
+	: m_Vertices{ std::move(vertices) }
+	, m_Indices{ std::move(indices) }
+	, m_Meshlets{}
+	, m_FacePlanes{}
+	, m_pMappedFile{}
+	, m_VerticesView{}
+	, m_IndicesView{}
+	, m_MeshletsView{}
+	, m_FacePlanesView{}
+	, m_Bounds{}
+{
+	// Group the triangles into meshlets first, since that puts them in a new order
+	m_Meshlets = Meshlets::Build({ m_Vertices.data(), uint32_t(m_Vertices.size()) }, m_Indices);
+
+	// Then order the triangles inside each meshlet for the post-transform cache, and the vertices in the order those triangles use them
+	VertexCache::OptimizeTriangleOrder({ m_Meshlets.data(), uint32_t(m_Meshlets.size()) }, uint32_t(m_Vertices.size()), m_Indices);
+	VertexCache::OptimizeVertexOrder(m_Vertices, m_Indices);
+
+	// Work out the plane of every triangle once, so back-face culling is just a dot product with the camera position
+	m_FacePlanes.reserve(m_Indices.size() / 3);
+	for (size_t i = 0; i + 2 < m_Indices.size(); i += 3)
+		m_FacePlanes.push_back(GetFacePlane(m_Vertices[m_Indices[i]].Position, m_Vertices[m_Indices[i + 1]].Position, m_Vertices[m_Indices[i + 2]].Position));
+
+	// The box around the vertices, for the scene's BVH (a mesh without any is just a point at its origin)
+	if (!m_Vertices.empty())
+	{
+		m_Bounds = AABB{ m_Vertices[0].Position, m_Vertices[0].Position };
+		for (const auto& vertex : m_Vertices)
+		{
+			for (uint8_t axis = 0; axis < 3; ++axis)
+			{
+				m_Bounds.Min[axis] = std::min(m_Bounds.Min[axis], vertex.Position[axis]);
+				m_Bounds.Max[axis] = std::max(m_Bounds.Max[axis], vertex.Position[axis]);
+			}
+		}
+	}
+
+	// And read it all from the arrays it owns
+	m_VerticesView = { m_Vertices.data(), uint32_t(m_Vertices.size()) };
+	m_IndicesView = { m_Indices.data(), uint32_t(m_Indices.size()) };
+	m_MeshletsView = { m_Meshlets.data(), uint32_t(m_Meshlets.size()) };
+	m_FacePlanesView = { m_FacePlanes.data(), uint32_t(m_FacePlanes.size()) };
+}
+
+MeshGeometry::MeshGeometry(const std::shared_ptr<const MappedFile>& pMappedFile, Span<const VS_INPUT> vertices, Span<const uint32_t> indices, Span<const Meshlet> meshlets,
+	Span<const Elite::FVector4> facePlanes, const AABB& bounds)
+	: m_Vertices{}
+	, m_Indices{}
+	, m_Meshlets{}
+	, m_FacePlanes{}
+	, m_pMappedFile{ pMappedFile }
+	, m_VerticesView{ vertices }
+	, m_IndicesView{ indices }
+	, m_MeshletsView{ meshlets }
+	, m_FacePlanesView{ facePlanes }
+	, m_Bounds{ bounds }
+{
+}
 
+Elite::FVector4 MeshGeometry::GetFacePlane(const Elite::FPoint3& p0, const Elite::FPoint3& p1, const Elite::FPoint3& p2)
+{
+	const Elite::FVector3 normal = Elite::Cross(p1 - p0, p2 - p0);
+	return Elite::FVector4(normal.x, normal.y, normal.z, -Elite::Dot(normal, Elite::FVector3(p0)));
+}
 
-Mesh::Mesh(ID3D11Device* pDevice, const std::vector<VS_INPUT>& vertices, const std::vector<uint32_t>& indices, D3D_PRIMITIVE_TOPOLOGY primTopology, BaseMaterial* pMaterial,
+Mesh::Mesh(ID3D11Device* pDevice, const std::shared_ptr<const MeshGeometry>& pGeometry, D3D_PRIMITIVE_TOPOLOGY primTopology, const std::shared_ptr<BaseMaterial>& pMaterial,
            const Elite::FMatrix4& transform, const char* diffuseTextPath, const char* normalTextPath, const char* specularTextPath, const char* glossTextPath)
-	: m_VertexVector{vertices}
-	, m_IndexVector{ indices }
+	: m_pGeometry{ pGeometry }
 	, m_pMaterial{ pMaterial }
 	, m_pVertexLayout{}
-	, m_pVertexBuffer{}
-	, m_pIndexBuffer{}
-	, m_AmountIndices{}
+	, m_Lods{}
+	, m_CurrentLod{}
 	, m_TransformMatrix{ transform }
 	, m_PrimTopology{ primTopology }
 	, m_Shininess{ 25.f }
@@ -22,18 +90,27 @@ Mesh::Mesh(ID3D11Device* pDevice, const std::vector<VS_INPUT>& vertices, const s
 	, m_pNormalText{}
 	, m_pSpecularText{}
 	, m_pGlossinessText{}
+	, m_pMaterialText{}
+	, m_pSceneBVH{}
+	, m_SceneBVHIdx{}
 {	
-	// Create Diffuse Texture (if a path was provided)
-	SetDiffuseTexture(diffuseTextPath, pDevice);
+	// Load the textures whose paths were provided (on threads of their own, only if there's any to load)
+	if (diffuseTextPath != nullptr || normalTextPath != nullptr || specularTextPath != nullptr || glossTextPath != nullptr)
+	{
+		ThreadPool threadPool{};
+
+		// Create Diffuse Texture (if a path was provided)
+		SetDiffuseTexture(diffuseTextPath, pDevice, threadPool);
 
-	// Create Normal Texture (if a path was provided)
-	SetNormalTexture(normalTextPath, pDevice);
+		// Create Normal Texture (if a path was provided)
+		SetNormalTexture(normalTextPath, pDevice, threadPool);
 
-	// Create Specular Texture (if a path was provided)
-	SetSpecularTexture(specularTextPath, pDevice);
+		// Create Specular Texture (if a path was provided)
+		SetSpecularTexture(specularTextPath, pDevice, threadPool);
 
-	// Create Gloss Texture (if a path was provided)
-	SetGlossinessTexture(glossTextPath, pDevice);
+		// Create Gloss Texture (if a path was provided)
+		SetGlossinessTexture(glossTextPath, pDevice, threadPool);
+	}
 	
 	// Create Vertex Layout
 	HRESULT result = S_OK;
@@ -77,31 +154,8 @@ Mesh::Mesh(ID3D11Device* pDevice, const std::vector<VS_INPUT>& vertices, const s
 		&m_pVertexLayout);
 
 
-	// Create Vertex Buffer
-	D3D11_BUFFER_DESC bd = {};
-	bd.Usage = D3D11_USAGE_IMMUTABLE;
-	bd.ByteWidth = sizeof(VS_INPUT) * (uint32_t)vertices.size();
-	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	bd.CPUAccessFlags = 0;
-	bd.MiscFlags = 0;
-	D3D11_SUBRESOURCE_DATA initData = { 0 };
-	initData.pSysMem = vertices.data();
-	result = pDevice->CreateBuffer(&bd, &initData, &m_pVertexBuffer);
-	if (FAILED(result))
-		return;
-
-
-	// Create Index Buffer
-	m_AmountIndices = (uint32_t)indices.size();
-	bd.Usage = D3D11_USAGE_IMMUTABLE;
-	bd.ByteWidth = sizeof(uint32_t) * m_AmountIndices;
-	bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	bd.CPUAccessFlags = 0;
-	bd.MiscFlags = 0;
-	initData.pSysMem = indices.data();
-	result = pDevice->CreateBuffer(&bd, &initData, &m_pIndexBuffer);
-	if (FAILED(result))
-		return;
+	// Create the Vertex and Index Buffers of the full detail level
+	AddLod(pDevice, m_pGeometry);
 }
 
 Mesh::~Mesh()
@@ -112,22 +166,19 @@ Mesh::~Mesh()
 		m_pVertexLayout = nullptr;
 	}
 
-	if(m_pVertexBuffer)
-	{
-		m_pVertexBuffer->Release();
-		m_pVertexBuffer = nullptr;
-	}
-	
-	if(m_pIndexBuffer)
+	for (auto& lod : m_Lods)
 	{
-		m_pIndexBuffer->Release();
-		m_pIndexBuffer = nullptr;
-	}
+		if (lod.pVertexBuffer)
+		{
+			lod.pVertexBuffer->Release();
+			lod.pVertexBuffer = nullptr;
+		}
 
-	if (m_pMaterial)
-	{
-		delete m_pMaterial;
-		m_pMaterial = nullptr;
+		if (lod.pIndexBuffer)
+		{
+			lod.pIndexBuffer->Release();
+			lod.pIndexBuffer = nullptr;
+		}
 	}
 
 	if(m_pDiffuseText)
@@ -153,10 +204,16 @@ Mesh::~Mesh()
 		delete m_pGlossinessText;
 		m_pGlossinessText = nullptr;
 	}
+
+	if (m_pMaterialText)
+	{
+		delete m_pMaterialText;
+		m_pMaterialText = nullptr;
+	}
 }
 
 void Mesh::RenderDirectX(ID3D11DeviceContext* pDeviceContext, Elite::ECamera* pCamera, float aspectRatio, SAMPLER_FILTER samplerFilter,
-	CULL_MODE cullMode, Elite::FVector3 lightDirection, float lightIntensity, Elite::FVector3 ambientLight) const
+	CULL_MODE cullMode, Elite::FVector3 lightDirection, float lightIntensity, Elite::FVector3 ambientLight, MeshletStats& meshletStats) const
 {
 	// Calculate the World View Projection Matrix
 	// And set it in the GPU (to convert the vertices to NDC space)
@@ -179,8 +236,12 @@ void Mesh::RenderDirectX(ID3D11DeviceContext* pDeviceContext, Elite::ECamera* pC
 		m_pMaterial->SetDiffuseMap(m_pDiffuseText->GetResourceView());
 
 	// Set the Normal Map in the GPU
+	// (along with whether it only has x and y, so the shader rebuilds z)
 	if (m_pNormalText != nullptr)
+	{
 		m_pMaterial->SetNormalMap(m_pNormalText->GetResourceView());
+		m_pMaterial->SetNormalMapTwoChannel(m_pNormalText->GetFormat() == TextureFormat::BC5);
+	}
 
 	// Set the Specular Map in the GPU
 	if (m_pSpecularText != nullptr)
@@ -204,10 +265,12 @@ void Mesh::RenderDirectX(ID3D11DeviceContext* pDeviceContext, Elite::ECamera* pC
 	// Set Vertex Buffer
 	UINT stride = sizeof(VS_INPUT);
 	UINT offset = 0;
-	pDeviceContext->IASetVertexBuffers(0, 1, &m_pVertexBuffer, &stride, &offset);
+	// (both of the level of detail picked for this frame)
+	const MeshLod& lod = m_Lods[m_CurrentLod];
+	pDeviceContext->IASetVertexBuffers(0, 1, &lod.pVertexBuffer, &stride, &offset);
 
 	// Set Index Buffer
-	pDeviceContext->IASetIndexBuffer(m_pIndexBuffer, DXGI_FORMAT_R32_UINT, 0);
+	pDeviceContext->IASetIndexBuffer(lod.pIndexBuffer, DXGI_FORMAT_R32_UINT, 0);
 
 	// Set Input Layout
 	pDeviceContext->IASetInputLayout(m_pVertexLayout);
@@ -231,15 +294,56 @@ void Mesh::RenderDirectX(ID3D11DeviceContext* pDeviceContext, Elite::ECamera* pC
 		break;
 	}
 
-	if (pCurrentTechnique)
+	if (pCurrentTechnique == nullptr)
+		return;
+
+	// Only draw the meshlets that survive the culling, merging the ones next to each other into a single draw
+	// (a triangle strip isn't split into meshlets, so it's always drawn whole)
+	const auto meshlets = lod.pGeometry->GetMeshlets();
+	const bool cullMeshlets = m_PrimTopology == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST && meshlets.empty() == false;
+	const MeshletCuller culler(m_TransformMatrix, pCamera->GetViewMatrix(), pCamera->GetPosition(), pCamera->GetFov(), aspectRatio, pCamera->GetNear(), pCamera->GetFar(),
+		true, cullMode);
+
+	D3DX11_TECHNIQUE_DESC techDesc;
+	pCurrentTechnique->GetDesc(&techDesc);
+	for (UINT p = 0; p < techDesc.Passes; ++p)
 	{
-		D3DX11_TECHNIQUE_DESC techDesc;
-		pCurrentTechnique->GetDesc(&techDesc);
-		for (UINT p = 0; p < techDesc.Passes; ++p)
+		pCurrentTechnique->GetPassByIndex(p)->Apply(0, pDeviceContext);
+		if (cullMeshlets == false)
+		{
+			pDeviceContext->DrawIndexed(lod.pGeometry->GetIndices().size(), 0, 0);
+			continue;
+		}
+
+		// Each merged range gets drawn as soon as the next visible meshlet doesn't continue it, so nothing has to be gathered first
+		uint32_t firstIndex = 0;
+		uint32_t amountIndices = 0;
+		for (const auto& meshlet : meshlets)
 		{
-			pCurrentTechnique->GetPassByIndex(p)->Apply(0, pDeviceContext);
-			pDeviceContext->DrawIndexed(m_AmountIndices, 0, 0);
+			const MESHLET_VISIBILITY visibility = culler.GetVisibility(meshlet);
+			if (p == 0)
+			{
+				meshletStats.AmountMeshlets++;
+				if (visibility == MESHLET_VISIBILITY::OutsideFrustum)
+					meshletStats.AmountFrustumCulledMeshlets++;
+				else if (visibility == MESHLET_VISIBILITY::BackFacing)
+					meshletStats.AmountBackFaceCulledMeshlets++;
+			}
+			if (visibility != MESHLET_VISIBILITY::Visible)
+				continue;
+
+			if (amountIndices > 0 && firstIndex + amountIndices == meshlet.FirstIndex)
+				amountIndices += meshlet.AmountIndices;
+			else
+			{
+				if (amountIndices > 0)
+					pDeviceContext->DrawIndexed(amountIndices, firstIndex, 0);
+				firstIndex = meshlet.FirstIndex;
+				amountIndices = meshlet.AmountIndices;
+			}
 		}
+		if (amountIndices > 0)
+			pDeviceContext->DrawIndexed(amountIndices, firstIndex, 0);
 	}
 }
 
@@ -263,31 +367,126 @@ float* Mesh::GetWorldViewProjMatrix(Elite::ECamera* pCamera, float aspectRatio)
 	return pReturnValue;
 }
 
-void Mesh::SetDiffuseTexture(const char* diffuseTextPath, ID3D11Device* pDevice)
+void Mesh::SetDiffuseTexture(const char* diffuseTextPath, ID3D11Device* pDevice, ThreadPool& threadPool, TextureFormat format)
 {
 	if (diffuseTextPath != nullptr)
-		m_pDiffuseText = new Texture(pDevice, diffuseTextPath);
+	{
+		m_pDiffuseText = new Texture(pDevice, diffuseTextPath, threadPool, format);
+		BakeMaterialTexture();
+	}
 }
 
-void Mesh::SetNormalTexture(const char* normalTextPath, ID3D11Device* pDevice)
+void Mesh::SetNormalTexture(const char* normalTextPath, ID3D11Device* pDevice, ThreadPool& threadPool, TextureFormat format)
 {
 	if (normalTextPath != nullptr)
-		m_pNormalText = new Texture(pDevice, normalTextPath);
+	{
+		m_pNormalText = new Texture(pDevice, normalTextPath, threadPool, format);
+		BakeMaterialTexture();
+	}
 }
 
-void Mesh::SetSpecularTexture(const char* specularTextPath, ID3D11Device* pDevice)
+void Mesh::SetSpecularTexture(const char* specularTextPath, ID3D11Device* pDevice, ThreadPool& threadPool, TextureFormat format)
 {
 	if (specularTextPath != nullptr)
-		m_pSpecularText = new Texture(pDevice, specularTextPath);
+	{
+		m_pSpecularText = new Texture(pDevice, specularTextPath, threadPool, format);
+		BakeMaterialTexture();
+	}
 }
 
-void Mesh::SetGlossinessTexture(const char* glossTextPath, ID3D11Device* pDevice)
+void Mesh::SetGlossinessTexture(const char* glossTextPath, ID3D11Device* pDevice, ThreadPool& threadPool, TextureFormat format)
 {
 	if (glossTextPath != nullptr)
-		m_pGlossinessText = new Texture(pDevice, glossTextPath);
+	{
+		m_pGlossinessText = new Texture(pDevice, glossTextPath, threadPool, format);
+		BakeMaterialTexture();
+	}
+}
+
+void Mesh::BakeMaterialTexture()
+{
+	// Throw away the old bake, since one of the maps just changed
+	if (m_pMaterialText)
+	{
+		delete m_pMaterialText;
+		m_pMaterialText = nullptr;
+	}
+
+	// And bake them again, once all 4 are there
+	if (m_pDiffuseText == nullptr || m_pNormalText == nullptr || m_pSpecularText == nullptr || m_pGlossinessText == nullptr)
+		return;
+
+	if (MaterialTexture::CanBake(*m_pDiffuseText, *m_pNormalText, *m_pSpecularText, *m_pGlossinessText))
+		m_pMaterialText = new MaterialTexture(*m_pDiffuseText, *m_pNormalText, *m_pSpecularText, *m_pGlossinessText);
+	else
+		std::cout << "The material's maps aren't all the same size, or don't have the same amount of mip levels, so they can't be baked together\n";
 }
 
 
+void Mesh::AddLod(ID3D11Device* pDevice, const std::shared_ptr<const MeshGeometry>& pGeometry)
+{
+	MeshLod lod{ pGeometry, nullptr, nullptr };
+
+	// Create Vertex Buffer (straight from the shared geometry, no copy needed)
+	const auto vertices = pGeometry->GetVertices();
+	const auto indices = pGeometry->GetIndices();
+	D3D11_BUFFER_DESC bd = {};
+	bd.Usage = D3D11_USAGE_IMMUTABLE;
+	bd.ByteWidth = sizeof(VS_INPUT) * vertices.size();
+	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	bd.CPUAccessFlags = 0;
+	bd.MiscFlags = 0;
+	D3D11_SUBRESOURCE_DATA initData = { 0 };
+	initData.pSysMem = vertices.data();
+	HRESULT result = pDevice->CreateBuffer(&bd, &initData, &lod.pVertexBuffer);
+
+	// Create Index Buffer
+	if (SUCCEEDED(result))
+	{
+		bd.Usage = D3D11_USAGE_IMMUTABLE;
+		bd.ByteWidth = sizeof(uint32_t) * indices.size();
+		bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		bd.CPUAccessFlags = 0;
+		bd.MiscFlags = 0;
+		initData.pSysMem = indices.data();
+		result = pDevice->CreateBuffer(&bd, &initData, &lod.pIndexBuffer);
+	}
+
+	// The level is kept even if its buffers couldn't be created (the Software Mode only needs its geometry), so the levels always line up in both modes
+	m_Lods.push_back(lod);
+}
+
+void Mesh::SelectLod(const Elite::ECamera* pCamera, bool leftHandCoordSystem)
+{
+	if (m_Lods.size() < 2)
+		return;
+
+	// Get the bounding sphere around the full detail box, in world space (the camera's real position is the one in its world matrix)
+	const AABB bounds = SceneBVH::TransformAABB(m_pGeometry->GetBounds(), GetTransformMatrix(leftHandCoordSystem));
+	const Elite::FPoint3 center{ (bounds.Min.x + bounds.Max.x) * 0.5f, (bounds.Min.y + bounds.Max.y) * 0.5f, (bounds.Min.z + bounds.Max.z) * 0.5f };
+	const float radius = Elite::Magnitude(bounds.Max - bounds.Min) * 0.5f;
+	const float distance = Elite::Magnitude(center - Elite::FPoint3{ pCamera->GetWorldMatrix()[3].xyz });
+
+	// How much of the screen's height its diameter covers (all of it once the camera is inside it)
+	const float screenSize = (distance > radius) ? radius / (distance * pCamera->GetFov()) : FLT_MAX;
+
+	// Only go to a coarser level once the size is clearly under its limit, and back to a finer one once it's clearly over the current one's
+	auto getLodScreenSize = [](uint32_t lod) { return m_FirstLodScreenSize / float(1u << (lod - 1)); };
+	while (m_CurrentLod + 1 < uint32_t(m_Lods.size()) && screenSize < getLodScreenSize(m_CurrentLod + 1) * (1.f - m_LodHysteresis))
+		m_CurrentLod++;
+	while (m_CurrentLod > 0 && screenSize > getLodScreenSize(m_CurrentLod) * (1.f + m_LodHysteresis))
+		m_CurrentLod--;
+}
+
+void Mesh::SetTransformMatrix(const Elite::FMatrix4& transform)
+{
+	m_TransformMatrix = transform;
+
+	// Let the scene's BVH know this mesh's box moved
+	if (m_pSceneBVH)
+		m_pSceneBVH->MarkDirty(m_SceneBVHIdx);
+}
+
 Elite::FMatrix4 Mesh::GetTransformMatrix(bool leftHandCoordSystem) const
 {
 	if(leftHandCoordSystem)
@@ -1,8 +1,17 @@
 #pragma once
+#include <memory>
 #include <vector>
 
+#include "BlockCompression.h"
+#include "Meshlet.h"
+#include "SceneBVH.h"
+#include "Span.h"
+
 class Texture;
+class MaterialTexture;
 class BaseMaterial;
+class MappedFile;
+class ThreadPool;
 
 namespace Elite
 {
@@ -83,10 +92,52 @@ struct VS_OUTPUT
 	}
 };
 
+// A mesh's vertices and indices, which never change once they've been loaded (they only get reordered for the meshlets and the caches, right at load)
+// Meshes share it, and both the DirectX upload and the Software renderer read it in place through spans
+// It either owns its arrays, or reads them straight out of a mapped mesh cache file (which it then keeps mapped)
+class MeshGeometry final
+{
+public:
+	MeshGeometry(std::vector<VS_INPUT>&& vertices, std::vector<uint32_t>&& indices);
+	// Everything has already been worked out, so nothing gets built or copied
+	MeshGeometry(const std::shared_ptr<const MappedFile>& pMappedFile, Span<const VS_INPUT> vertices, Span<const uint32_t> indices, Span<const Meshlet> meshlets,
+		Span<const Elite::FVector4> facePlanes, const AABB& bounds);
+
+	MeshGeometry(const MeshGeometry& other) = delete;
+	MeshGeometry(MeshGeometry&& other) noexcept = delete;
+	MeshGeometry& operator=(const MeshGeometry& other) = delete;
+	MeshGeometry& operator=(MeshGeometry&& other) noexcept = delete;
+
+	Span<const VS_INPUT> GetVertices() const { return m_VerticesView; }
+	Span<const uint32_t> GetIndices() const { return m_IndicesView; }
+	// Plane of each triangle of the index list, in object space: a point p is in front of triangle i when Dot(xyz, p) + w > 0
+	Span<const Elite::FVector4> GetFacePlanes() const { return m_FacePlanesView; }
+	// Clusters of up to 64 vertices and 124 triangles, which cover the whole index list in order
+	Span<const Meshlet> GetMeshlets() const { return m_MeshletsView; }
+	// Box around all the vertices, in object space
+	const AABB& GetBounds() const { return m_Bounds; }
+
+	// The plane through the 3 points, with the normal the way their counter-clockwise winding faces (not normalized, only its sign ever matters)
+	static Elite::FVector4 GetFacePlane(const Elite::FPoint3& p0, const Elite::FPoint3& p1, const Elite::FPoint3& p2);
+
+private:
+	std::vector<VS_INPUT> m_Vertices;
+	std::vector<uint32_t> m_Indices;
+	std::vector<Meshlet> m_Meshlets;
+	std::vector<Elite::FVector4> m_FacePlanes;
+	std::shared_ptr<const MappedFile> m_pMappedFile;
+	// The arrays everything reads, in whichever of the two they are
+	Span<const VS_INPUT> m_VerticesView;
+	Span<const uint32_t> m_IndicesView;
+	Span<const Meshlet> m_MeshletsView;
+	Span<const Elite::FVector4> m_FacePlanesView;
+	AABB m_Bounds;
+};
+
 class Mesh
 {
 public:
-	Mesh(ID3D11Device* pDevice, const std::vector<VS_INPUT>& vertices, const std::vector<uint32_t>& indices, D3D_PRIMITIVE_TOPOLOGY primTopology, BaseMaterial* pMaterial,
+	Mesh(ID3D11Device* pDevice, const std::shared_ptr<const MeshGeometry>& pGeometry, D3D_PRIMITIVE_TOPOLOGY primTopology, const std::shared_ptr<BaseMaterial>& pMaterial,
 		const Elite::FMatrix4& transform = Elite::FMatrix4::Identity(), const char* diffuseTextPath = nullptr, const char* normalTextPath = nullptr,
 		const char* specularTextPath = nullptr, const char* glossTextPath = nullptr);
 	~Mesh();
@@ -97,36 +148,66 @@ public:
 	Mesh& operator=(Mesh&& other) noexcept = delete;
 
 	void RenderDirectX(ID3D11DeviceContext* pDeviceContext, Elite::ECamera* pCamera, float aspectRatio, SAMPLER_FILTER samplerFilter,
-		CULL_MODE cullMode, Elite::FVector3 lightDirection, float lightIntensity, Elite::FVector3 ambientLight) const;
+		CULL_MODE cullMode, Elite::FVector3 lightDirection, float lightIntensity, Elite::FVector3 ambientLight, MeshletStats& meshletStats) const;
 	float* GetWorldViewProjMatrix(Elite::ECamera* pCamera, float aspectRatio) const;
 	Elite::FMatrix4 GetTransformMatrix(bool leftHandCoordSystem) const;
-	std::vector<VS_INPUT> GetVertexVector() const { return m_VertexVector; }
-	std::vector<uint32_t> GetIndexVector() const { return m_IndexVector; }
+	// The full detail geometry, and the one of the level of detail picked for this frame (which the vertices and indices come from)
+	const std::shared_ptr<const MeshGeometry>& GetGeometry() const { return m_pGeometry; }
+	const MeshGeometry* GetLodGeometry() const { return m_Lods[m_CurrentLod].pGeometry.get(); }
+	Span<const VS_INPUT> GetVertices() const { return GetLodGeometry()->GetVertices(); }
+	Span<const uint32_t> GetIndices() const { return GetLodGeometry()->GetIndices(); }
+	uint32_t GetCurrentLod() const { return m_CurrentLod; }
 	Texture* GetDiffuseTexture() const { return m_pDiffuseText; }
 	Texture* GetNormalTexture() const { return m_pNormalText; }
 	Texture* GetSpecularTexture() const { return m_pSpecularText; }
 	Texture* GetGlossinessTexture() const { return m_pGlossinessText; }
+	// All 4 maps baked together for the Software Mode (only there when the mesh has all of them)
+	MaterialTexture* GetMaterialTexture() const { return m_pMaterialText; }
 	float GetShininess() const { return m_Shininess; }
 	D3D_PRIMITIVE_TOPOLOGY GetPrimitiveTopology() const { return m_PrimTopology; }
 
-	BaseMaterial* GetMaterial() const { return m_pMaterial; }
+	BaseMaterial* GetMaterial() const { return m_pMaterial.get(); }
 
 	void SetShininess(float newValue) { m_Shininess = newValue; }
-	void SetDiffuseTexture(const char* diffuseTextPath, ID3D11Device* pDevice);
-	void SetNormalTexture(const char* normalTextPath, ID3D11Device* pDevice);
-	void SetSpecularTexture(const char* specularTextPath, ID3D11Device* pDevice);
-	void SetGlossinessTexture(const char* glossTextPath, ID3D11Device* pDevice);
-	void SetTransformMatrix(const Elite::FMatrix4& transform) { m_TransformMatrix = transform; }
+	void SetDiffuseTexture(const char* diffuseTextPath, ID3D11Device* pDevice, ThreadPool& threadPool, TextureFormat format = TextureFormat::RGBA8);
+	void SetNormalTexture(const char* normalTextPath, ID3D11Device* pDevice, ThreadPool& threadPool, TextureFormat format = TextureFormat::RGBA8);
+	void SetSpecularTexture(const char* specularTextPath, ID3D11Device* pDevice, ThreadPool& threadPool, TextureFormat format = TextureFormat::RGBA8);
+	void SetGlossinessTexture(const char* glossTextPath, ID3D11Device* pDevice, ThreadPool& threadPool, TextureFormat format = TextureFormat::RGBA8);
+	void SetTransformMatrix(const Elite::FMatrix4& transform);
+	// The scene's BVH, which gets told whenever the transform changes (so it can refit this mesh's box)
+	void SetSceneBVH(SceneBVH* pSceneBVH, uint32_t sceneBVHIdx) { m_pSceneBVH = pSceneBVH; m_SceneBVHIdx = sceneBVHIdx; }
+
+	// Adds a simpler version of the geometry as the next level of detail (drawn with the same material and textures)
+	void AddLod(ID3D11Device* pDevice, const std::shared_ptr<const MeshGeometry>& pGeometry);
+	// Picks this frame's level of detail, from how much of the screen's height the bounding sphere covers
+	void SelectLod(const Elite::ECamera* pCamera, bool leftHandCoordSystem);
+
+	static const uint32_t m_MaxLods = 4;
 
 private:
-	std::vector<VS_INPUT> m_VertexVector;
-	std::vector<uint32_t> m_IndexVector;
+	struct MeshLod
+	{
+		std::shared_ptr<const MeshGeometry> pGeometry;
+		ID3D11Buffer* pVertexBuffer;
+		ID3D11Buffer* pIndexBuffer;
+	};
+
+	void BakeMaterialTexture();
+
+	std::shared_ptr<const MeshGeometry> m_pGeometry;
 	
-	BaseMaterial* m_pMaterial;
+	// Shared between meshes, like the geometry (each one sets its own matrices and maps on it right before it's drawn)
+	std::shared_ptr<BaseMaterial> m_pMaterial;
 	ID3D11InputLayout* m_pVertexLayout;
-	ID3D11Buffer* m_pVertexBuffer;
-	ID3D11Buffer* m_pIndexBuffer;
-	uint32_t m_AmountIndices;
+
+	// Full detail first, and each one after it with about half the triangles of the one before
+	// The full detail level is drawn while the bounding sphere covers more than half the screen's height, and each next one down to half the size of the one before it
+	std::vector<MeshLod> m_Lods;
+	uint32_t m_CurrentLod;
+	static constexpr float m_FirstLodScreenSize = 0.5f;
+	// How far past a limit the size has to get before the level changes, so it doesn't keep popping back and forth right at the limit
+	static constexpr float m_LodHysteresis = 0.15f;
+
 	Elite::FMatrix4 m_TransformMatrix;
 	D3D_PRIMITIVE_TOPOLOGY m_PrimTopology;
 	float m_Shininess;
@@ -135,4 +216,8 @@ private:
 	Texture* m_pNormalText;
 	Texture* m_pSpecularText;
 	Texture* m_pGlossinessText;
+	MaterialTexture* m_pMaterialText;
+
+	SceneBVH* m_pSceneBVH;
+	uint32_t m_SceneBVHIdx;
 };
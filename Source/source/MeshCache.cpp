@@ -0,0 +1,170 @@
+#include "pch.h"
+#include "MeshCache.h"
+
+#include <cstring>
+#include <fstream>
+
+#include "MappedFile.h"
+#include "Mesh.h"
+
+namespace
+{
+	const char m_Magic[4]{ 'D', 'R', 'M', 'C' };
+	// Every array starts at a multiple of this, so it can be read in place
+	const uint64_t m_Alignment = 16;
+
+	struct FileHeader
+	{
+		char Magic[4];
+		uint32_t Version;
+		uint32_t VertexSize; // The sizes of the stored structs, so a cache from a build where they're laid out differently doesn't get read either
+		uint32_t MeshletSize;
+		uint64_t SourceHash;
+		uint64_t FileSize; // Only right once the whole file got written, so a cache that got cut off is never read
+		uint32_t AmountLods;
+		uint32_t Padding;
+	};
+
+	// Followed by one of these per level of detail
+	struct LodHeader
+	{
+		uint64_t VerticesOffset;
+		uint64_t IndicesOffset;
+		uint64_t MeshletsOffset;
+		uint64_t FacePlanesOffset;
+		uint32_t AmountVertices;
+		uint32_t AmountIndices;
+		uint32_t AmountMeshlets;
+		uint32_t AmountFacePlanes;
+		AABB Bounds;
+	};
+
+	uint64_t Align(uint64_t offset)
+	{
+		return (offset + m_Alignment - 1) & ~(m_Alignment - 1);
+	}
+
+	// Whether an array of amount elements fits in the file at offset
+	bool IsInFile(uint64_t offset, uint64_t elementSize, uint64_t amount, uint64_t fileSize)
+	{
+		return offset <= fileSize && amount <= (fileSize - offset) / elementSize;
+	}
+
+	bool IsArrayInFile(uint64_t offset, uint64_t elementSize, uint64_t amount, uint64_t fileSize)
+	{
+		return offset % m_Alignment == 0 && IsInFile(offset, elementSize, amount, fileSize);
+	}
+}
+
+uint64_t MeshCache::GetSourceHash(const char* pData, size_t size)
+{
+	// FNV-1a, 8 bytes at a time (with an extra shift to mix the high bits back down), so hashing even a big file takes next to nothing
+	uint64_t hash = 14695981039346656037ull ^ size;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word{};
+		memcpy(&word, pData + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ull;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; ++i)
+		hash = (hash ^ uint8_t(pData[i])) * 1099511628211ull;
+	return hash;
+}
+
+std::vector<std::shared_ptr<const MeshGeometry>> MeshCache::Load(const std::string& cachePath, uint64_t sourceHash)
+{
+	std::vector<std::shared_ptr<const MeshGeometry>> lods{};
+	const auto pFile = std::make_shared<const MappedFile>(cachePath);
+	if (!pFile->IsOpen() || pFile->GetSize() < sizeof(FileHeader))
+		return lods;
+
+	// Check it's a whole cache, of this version and layout, made from this very source
+	const char* pData = pFile->GetData();
+	const uint64_t fileSize = pFile->GetSize();
+	FileHeader header{};
+	memcpy(&header, pData, sizeof(header));
+	if (memcmp(header.Magic, m_Magic, sizeof(m_Magic)) != 0 || header.Version != m_Version || header.VertexSize != sizeof(VS_INPUT) || header.MeshletSize != sizeof(Meshlet)
+		|| header.SourceHash != sourceHash || header.FileSize != fileSize || header.AmountLods == 0 || !IsInFile(sizeof(FileHeader), sizeof(LodHeader), header.AmountLods, fileSize))
+		return lods;
+
+	// And point every level's geometry straight at its arrays in the file (which stays mapped for as long as any of them is around)
+	for (uint32_t i = 0; i < header.AmountLods; ++i)
+	{
+		LodHeader lod{};
+		memcpy(&lod, pData + sizeof(FileHeader) + sizeof(LodHeader) * i, sizeof(lod));
+		if (!IsArrayInFile(lod.VerticesOffset, sizeof(VS_INPUT), lod.AmountVertices, fileSize) || !IsArrayInFile(lod.IndicesOffset, sizeof(uint32_t), lod.AmountIndices, fileSize)
+			|| !IsArrayInFile(lod.MeshletsOffset, sizeof(Meshlet), lod.AmountMeshlets, fileSize)
+			|| !IsArrayInFile(lod.FacePlanesOffset, sizeof(Elite::FVector4), lod.AmountFacePlanes, fileSize) || lod.AmountFacePlanes != lod.AmountIndices / 3)
+		{
+			lods.clear();
+			return lods;
+		}
+
+		lods.push_back(std::make_shared<const MeshGeometry>(pFile,
+			Span<const VS_INPUT>{ reinterpret_cast<const VS_INPUT*>(pData + lod.VerticesOffset), lod.AmountVertices },
+			Span<const uint32_t>{ reinterpret_cast<const uint32_t*>(pData + lod.IndicesOffset), lod.AmountIndices },
+			Span<const Meshlet>{ reinterpret_cast<const Meshlet*>(pData + lod.MeshletsOffset), lod.AmountMeshlets },
+			Span<const Elite::FVector4>{ reinterpret_cast<const Elite::FVector4*>(pData + lod.FacePlanesOffset), lod.AmountFacePlanes }, lod.Bounds));
+	}
+	return lods;
+}
+
+bool MeshCache::Save(const std::string& cachePath, uint64_t sourceHash, const std::vector<std::shared_ptr<const MeshGeometry>>& lods)
+{
+	// Lay the arrays out after the headers
+	FileHeader header{};
+	memcpy(header.Magic, m_Magic, sizeof(m_Magic));
+	header.Version = m_Version;
+	header.VertexSize = sizeof(VS_INPUT);
+	header.MeshletSize = sizeof(Meshlet);
+	header.SourceHash = sourceHash;
+	header.AmountLods = uint32_t(lods.size());
+
+	std::vector<LodHeader> lodHeaders(lods.size());
+	uint64_t offset = sizeof(FileHeader) + sizeof(LodHeader) * lods.size();
+	for (size_t i = 0; i < lods.size(); ++i)
+	{
+		const MeshGeometry& geometry = *lods[i];
+		LodHeader& lod = lodHeaders[i];
+		lod.AmountVertices = geometry.GetVertices().size();
+		lod.AmountIndices = geometry.GetIndices().size();
+		lod.AmountMeshlets = geometry.GetMeshlets().size();
+		lod.AmountFacePlanes = geometry.GetFacePlanes().size();
+		lod.Bounds = geometry.GetBounds();
+
+		lod.VerticesOffset = Align(offset);
+		lod.IndicesOffset = Align(lod.VerticesOffset + sizeof(VS_INPUT) * lod.AmountVertices);
+		lod.MeshletsOffset = Align(lod.IndicesOffset + sizeof(uint32_t) * lod.AmountIndices);
+		lod.FacePlanesOffset = Align(lod.MeshletsOffset + sizeof(Meshlet) * lod.AmountMeshlets);
+		offset = lod.FacePlanesOffset + sizeof(Elite::FVector4) * lod.AmountFacePlanes;
+	}
+	header.FileSize = offset;
+
+	// And write it all, padding every array up to where it starts
+	std::ofstream out(cachePath, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+
+	uint64_t amountWritten = 0;
+	auto write = [&](uint64_t offset, const void* pData, uint64_t size)
+	{
+		const char padding[m_Alignment]{};
+		out.write(padding, std::streamsize(offset - amountWritten));
+		out.write(static_cast<const char*>(pData), std::streamsize(size));
+		amountWritten = offset + size;
+	};
+	write(0, &header, sizeof(header));
+	write(sizeof(FileHeader), lodHeaders.data(), sizeof(LodHeader) * lodHeaders.size());
+	for (size_t i = 0; i < lods.size(); ++i)
+	{
+		const MeshGeometry& geometry = *lods[i];
+		const LodHeader& lod = lodHeaders[i];
+		write(lod.VerticesOffset, geometry.GetVertices().data(), sizeof(VS_INPUT) * lod.AmountVertices);
+		write(lod.IndicesOffset, geometry.GetIndices().data(), sizeof(uint32_t) * lod.AmountIndices);
+		write(lod.MeshletsOffset, geometry.GetMeshlets().data(), sizeof(Meshlet) * lod.AmountMeshlets);
+		write(lod.FacePlanesOffset, geometry.GetFacePlanes().data(), sizeof(Elite::FVector4) * lod.AmountFacePlanes);
+	}
+	return bool(out);
+}
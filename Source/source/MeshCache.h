@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MeshGeometry;
+
+// Binary cache of a loaded mesh: the welded and reordered vertices and indices (tangents included), the meshlets, the face planes
+// and the bounds of every level of detail, laid out so the file can just be mapped and read in place on the next launch
+namespace MeshCache
+{
+	// Bump it whenever what gets stored, or how any of it gets worked out, changes (older caches then get rebuilt)
+	static const uint32_t m_Version = 2;
+	static const char* const m_Extension = ".meshcache";
+
+	// Hash of the source file, which the cache has to match to be used
+	uint64_t GetSourceHash(const char* pData, size_t size);
+
+	// Maps the cache file and reads its levels of detail straight out of it (full detail first)
+	// Comes back empty if there's no cache, or it's from another version, another vertex layout or another source
+	std::vector<std::shared_ptr<const MeshGeometry>> Load(const std::string& cachePath, uint64_t sourceHash);
+	bool Save(const std::string& cachePath, uint64_t sourceHash, const std::vector<std::shared_ptr<const MeshGeometry>>& lods);
+}
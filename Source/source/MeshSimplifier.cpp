@@ -0,0 +1,461 @@
+#include "pch.h"
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+
+#include "Mesh.h"
+
+namespace
+{
+	// Open borders get planes through them, perpendicular to their triangle, weighted up so they hardly ever move
+	const double m_BorderWeight = 10.0;
+	// A collapse can't turn a triangle more than ~75 degrees (it would fold over, or come close to it)
+	const double m_MinNormalCos = 0.25;
+
+	// Sum of squared distances to a set of planes (each one weighted by its triangle's area), as a symmetric 4x4 matrix
+	struct Quadric
+	{
+		double A2, AB, AC, AD, B2, BC, BD, C2, CD, D2;
+
+		void AddPlane(double a, double b, double c, double d, double weight)
+		{
+			A2 += weight * a * a; AB += weight * a * b; AC += weight * a * c; AD += weight * a * d;
+			B2 += weight * b * b; BC += weight * b * c; BD += weight * b * d;
+			C2 += weight * c * c; CD += weight * c * d;
+			D2 += weight * d * d;
+		}
+
+		void Add(const Quadric& other)
+		{
+			A2 += other.A2; AB += other.AB; AC += other.AC; AD += other.AD;
+			B2 += other.B2; BC += other.BC; BD += other.BD;
+			C2 += other.C2; CD += other.CD;
+			D2 += other.D2;
+		}
+
+		double GetError(const Elite::FPoint3& p) const
+		{
+			const double x = p.x, y = p.y, z = p.z;
+			return A2 * x * x + 2.0 * AB * x * y + 2.0 * AC * x * z + 2.0 * AD * x
+				+ B2 * y * y + 2.0 * BC * y * z + 2.0 * BD * y
+				+ C2 * z * z + 2.0 * CD * z
+				+ D2;
+		}
+	};
+
+	// Moving every vertex at one position onto the vertices at a neighboring position
+	struct Collapse
+	{
+		double Error;
+		uint32_t From;
+		uint32_t To;
+		uint32_t FromVersion;
+		uint32_t ToVersion;
+
+		bool operator>(const Collapse& other) const { return Error > other.Error; }
+	};
+
+	// Hash of a fixed amount of floats, by their bits
+	template<size_t N>
+	struct FloatBitsHash
+	{
+		size_t operator()(const std::array<uint32_t, N>& bits) const
+		{
+			uint64_t hash = 0xCBF29CE484222325ull;
+			for (const uint32_t value : bits)
+				hash = (hash ^ value) * 0x100000001B3ull;
+			return size_t(hash);
+		}
+	};
+
+	template<size_t N>
+	std::array<uint32_t, N> GetBits(const float* pValues)
+	{
+		std::array<uint32_t, N> bits{};
+		memcpy(bits.data(), pValues, sizeof(uint32_t) * N);
+		return bits;
+	}
+
+	class Simplifier final
+	{
+	public:
+		Simplifier(Span<const VS_INPUT> vertices, Span<const uint32_t> indices);
+
+		Simplifier(const Simplifier& other) = delete;
+		Simplifier(Simplifier&& other) noexcept = delete;
+		Simplifier& operator=(const Simplifier& other) = delete;
+		Simplifier& operator=(Simplifier&& other) noexcept = delete;
+
+		// Keeps collapsing the cheapest edges until there's no more than the target triangles left (or nothing left that can be collapsed)
+		void Simplify(uint32_t targetTriangles);
+		uint32_t GetAmountTriangles() const { return m_AmountLiveTriangles; }
+		MeshSimplifier::SimplifiedMesh GetMesh() const;
+
+	private:
+		void PushCollapses(uint32_t position);
+		bool CanCollapse(uint32_t from, uint32_t to, std::vector<std::pair<uint32_t, uint32_t>>& wedges);
+		void ApplyCollapse(uint32_t from, uint32_t to, const std::vector<std::pair<uint32_t, uint32_t>>& wedges);
+		Elite::FVector3 GetTriangleNormal(uint32_t triangle, uint32_t movedPosition, const Elite::FPoint3& newPoint) const;
+		void GetNeighbors(uint32_t position, std::vector<uint32_t>& neighbors);
+
+		std::vector<VS_INPUT> m_Vertices; // Welded: corners with the same position, color, uv and normal are a single vertex
+		std::vector<uint32_t> m_VertexPositions; // Which position each vertex is at
+		std::vector<Elite::FPoint3> m_Positions;
+		std::vector<Quadric> m_Quadrics;
+		std::vector<uint32_t> m_Versions; // Goes up every time a position's quadric (or its neighborhood) changes, so older collapses of it get skipped
+		std::vector<uint8_t> m_Removed;
+		std::vector<std::vector<uint32_t>> m_PositionTriangles; // The (live, or not yet cleaned up) triangles around each position
+
+		std::vector<uint32_t> m_Triangles;
+		std::vector<uint8_t> m_TriangleAlive;
+		uint32_t m_AmountLiveTriangles;
+
+		std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> m_Collapses;
+		std::vector<uint32_t> m_Neighbors, m_OtherNeighbors;
+		std::vector<std::pair<uint32_t, uint32_t>> m_Wedges;
+	};
+
+	Simplifier::Simplifier(Span<const VS_INPUT> vertices, Span<const uint32_t> indices)
+		: m_Vertices{}
+		, m_VertexPositions{}
+		, m_Positions{}
+		, m_Quadrics{}
+		, m_Versions{}
+		, m_Removed{}
+		, m_PositionTriangles{}
+		, m_Triangles{}
+		, m_TriangleAlive{}
+		, m_AmountLiveTriangles{}
+		, m_Collapses{}
+		, m_Neighbors{}
+		, m_OtherNeighbors{}
+		, m_Wedges{}
+	{
+		// Weld the corners that only differ by their tangent (which gets averaged), and give each distinct position an index of its own
+		static const size_t amountKeyFloats = 11; // Position, color, uv and normal
+		static_assert(offsetof(VS_INPUT, Tangent) == sizeof(float) * amountKeyFloats, "The tangent has to come right after the attributes that make a vertex unique");
+		std::unordered_map<std::array<uint32_t, amountKeyFloats>, uint32_t, FloatBitsHash<amountKeyFloats>> vertexIdxs{};
+		std::unordered_map<std::array<uint32_t, 3>, uint32_t, FloatBitsHash<3>> positionIdxs{};
+		std::vector<uint32_t> remap(vertices.size());
+		for (uint32_t v = 0; v < vertices.size(); ++v)
+		{
+			const auto result = vertexIdxs.emplace(GetBits<amountKeyFloats>(&vertices[v].Position.x), uint32_t(m_Vertices.size()));
+			remap[v] = result.first->second;
+			if (result.second == false)
+			{
+				m_Vertices[remap[v]].Tangent += vertices[v].Tangent;
+				continue;
+			}
+
+			m_Vertices.push_back(vertices[v]);
+			const auto positionResult = positionIdxs.emplace(GetBits<3>(&vertices[v].Position.x), uint32_t(m_Positions.size()));
+			if (positionResult.second)
+				m_Positions.push_back(vertices[v].Position);
+			m_VertexPositions.push_back(positionResult.first->second);
+		}
+		for (auto& vertex : m_Vertices)
+			vertex.Tangent = Elite::GetNormalized(Elite::Reject(vertex.Tangent, vertex.Normal));
+
+		m_Quadrics.resize(m_Positions.size(), Quadric{});
+		m_Versions.resize(m_Positions.size(), 0);
+		m_Removed.resize(m_Positions.size(), 0);
+		m_PositionTriangles.resize(m_Positions.size());
+
+		// Keep the triangles that have 3 different positions (the rest have no area, and can only get in the way of the collapses)
+		for (uint32_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			const uint32_t v0 = remap[indices[i]], v1 = remap[indices[i + 1]], v2 = remap[indices[i + 2]];
+			const uint32_t p0 = m_VertexPositions[v0], p1 = m_VertexPositions[v1], p2 = m_VertexPositions[v2];
+			if (p0 == p1 || p1 == p2 || p2 == p0)
+				continue;
+
+			const uint32_t triangle = uint32_t(m_Triangles.size() / 3);
+			m_Triangles.insert(m_Triangles.end(), { v0, v1, v2 });
+			m_PositionTriangles[p0].push_back(triangle);
+			m_PositionTriangles[p1].push_back(triangle);
+			m_PositionTriangles[p2].push_back(triangle);
+		}
+		m_TriangleAlive.resize(m_Triangles.size() / 3, 1);
+		m_AmountLiveTriangles = uint32_t(m_TriangleAlive.size());
+
+		// Every position starts out with the planes of the triangles around it
+		for (uint32_t t = 0; t < m_AmountLiveTriangles; ++t)
+		{
+			const Elite::FPoint3& p0 = m_Positions[m_VertexPositions[m_Triangles[t * 3]]];
+			const Elite::FPoint3& p1 = m_Positions[m_VertexPositions[m_Triangles[t * 3 + 1]]];
+			const Elite::FPoint3& p2 = m_Positions[m_VertexPositions[m_Triangles[t * 3 + 2]]];
+			const Elite::FVector3 cross = Elite::Cross(p1 - p0, p2 - p0);
+			const double length = Elite::Magnitude(cross);
+			if (length <= 0.0)
+				continue;
+
+			const double a = cross.x / length, b = cross.y / length, c = cross.z / length;
+			const double d = -(a * p0.x + b * p0.y + c * p0.z);
+			for (int corner = 0; corner < 3; ++corner)
+				m_Quadrics[m_VertexPositions[m_Triangles[t * 3 + corner]]].AddPlane(a, b, c, d, length * 0.5);
+		}
+
+		// And the open borders (edges with a single triangle) the planes through them too
+		std::unordered_map<uint64_t, uint32_t> edgeTriangles{};
+		auto getEdgeKey = [](uint32_t a, uint32_t b) { return (uint64_t(std::min(a, b)) << 32) | std::max(a, b); };
+		for (uint32_t t = 0; t < m_AmountLiveTriangles; ++t)
+		{
+			for (int corner = 0; corner < 3; ++corner)
+				edgeTriangles[getEdgeKey(m_VertexPositions[m_Triangles[t * 3 + corner]], m_VertexPositions[m_Triangles[t * 3 + (corner + 1) % 3]])]++;
+		}
+		for (uint32_t t = 0; t < m_AmountLiveTriangles; ++t)
+		{
+			const Elite::FPoint3& p0 = m_Positions[m_VertexPositions[m_Triangles[t * 3]]];
+			const Elite::FPoint3& p1 = m_Positions[m_VertexPositions[m_Triangles[t * 3 + 1]]];
+			const Elite::FPoint3& p2 = m_Positions[m_VertexPositions[m_Triangles[t * 3 + 2]]];
+			const Elite::FVector3 normal = Elite::Cross(p1 - p0, p2 - p0);
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t a = m_VertexPositions[m_Triangles[t * 3 + corner]];
+				const uint32_t b = m_VertexPositions[m_Triangles[t * 3 + (corner + 1) % 3]];
+				if (edgeTriangles[getEdgeKey(a, b)] != 1)
+					continue;
+
+				const Elite::FVector3 edge = m_Positions[b] - m_Positions[a];
+				const Elite::FVector3 borderNormal = Elite::Cross(edge, normal);
+				const double length = Elite::Magnitude(borderNormal);
+				if (length <= 0.0)
+					continue;
+
+				const double nx = borderNormal.x / length, ny = borderNormal.y / length, nz = borderNormal.z / length;
+				const double d = -(nx * m_Positions[a].x + ny * m_Positions[a].y + nz * m_Positions[a].z);
+				const double weight = m_BorderWeight * Elite::SqrMagnitude(edge);
+				m_Quadrics[a].AddPlane(nx, ny, nz, d, weight);
+				m_Quadrics[b].AddPlane(nx, ny, nz, d, weight);
+			}
+		}
+
+		// Queue up every edge, both ways
+		for (uint32_t p = 0; p < uint32_t(m_Positions.size()); ++p)
+			PushCollapses(p);
+	}
+
+	void Simplifier::Simplify(uint32_t targetTriangles)
+	{
+		while (m_AmountLiveTriangles > targetTriangles && m_Collapses.empty() == false)
+		{
+			const Collapse collapse = m_Collapses.top();
+			m_Collapses.pop();
+
+			// Skip the collapses that are out of date
+			if (m_Removed[collapse.From] || m_Removed[collapse.To] || m_Versions[collapse.From] != collapse.FromVersion || m_Versions[collapse.To] != collapse.ToVersion)
+				continue;
+
+			if (CanCollapse(collapse.From, collapse.To, m_Wedges))
+				ApplyCollapse(collapse.From, collapse.To, m_Wedges);
+		}
+	}
+
+	MeshSimplifier::SimplifiedMesh Simplifier::GetMesh() const
+	{
+		// Only keep the vertices the live triangles still use
+		MeshSimplifier::SimplifiedMesh mesh{};
+		std::vector<uint32_t> newVertexIdxs(m_Vertices.size(), UINT32_MAX);
+		for (uint32_t t = 0; t < uint32_t(m_TriangleAlive.size()); ++t)
+		{
+			if (m_TriangleAlive[t] == 0)
+				continue;
+
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t v = m_Triangles[t * 3 + corner];
+				if (newVertexIdxs[v] == UINT32_MAX)
+				{
+					newVertexIdxs[v] = uint32_t(mesh.Vertices.size());
+					mesh.Vertices.push_back(m_Vertices[v]);
+				}
+				mesh.Indices.push_back(newVertexIdxs[v]);
+			}
+		}
+		return mesh;
+	}
+
+	void Simplifier::PushCollapses(uint32_t position)
+	{
+		GetNeighbors(position, m_Neighbors);
+		for (const uint32_t neighbor : m_Neighbors)
+		{
+			Quadric quadric = m_Quadrics[position];
+			quadric.Add(m_Quadrics[neighbor]);
+			m_Collapses.push(Collapse{ quadric.GetError(m_Positions[neighbor]), position, neighbor, m_Versions[position], m_Versions[neighbor] });
+			m_Collapses.push(Collapse{ quadric.GetError(m_Positions[position]), neighbor, position, m_Versions[neighbor], m_Versions[position] });
+		}
+	}
+
+	bool Simplifier::CanCollapse(uint32_t from, uint32_t to, std::vector<std::pair<uint32_t, uint32_t>>& wedges)
+	{
+		// The triangles on the edge tell which vertex at "to" each vertex at "from" turns into (a vertex that would have to turn into 2 different ones has a seam
+		// or a hard edge going through "to" but not "from", which would get lost)
+		wedges.clear();
+		uint32_t amountEdgeTriangles = 0;
+		for (const uint32_t t : m_PositionTriangles[from])
+		{
+			if (m_TriangleAlive[t] == 0)
+				continue;
+
+			uint32_t fromVertex = UINT32_MAX, toVertex = UINT32_MAX;
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t v = m_Triangles[t * 3 + corner];
+				if (m_VertexPositions[v] == from)
+					fromVertex = v;
+				else if (m_VertexPositions[v] == to)
+					toVertex = v;
+			}
+			if (toVertex == UINT32_MAX)
+				continue;
+
+			amountEdgeTriangles++;
+			const auto wedge = std::find_if(wedges.begin(), wedges.end(), [fromVertex](const std::pair<uint32_t, uint32_t>& w) { return w.first == fromVertex; });
+			if (wedge == wedges.end())
+				wedges.emplace_back(fromVertex, toVertex);
+			else if (wedge->second != toVertex)
+				return false;
+		}
+
+		// Both positions can only share the neighbors across the edge, otherwise the collapse would pinch the surface into a non-manifold one
+		GetNeighbors(from, m_Neighbors);
+		GetNeighbors(to, m_OtherNeighbors);
+		uint32_t amountSharedNeighbors = 0;
+		for (const uint32_t neighbor : m_Neighbors)
+			amountSharedNeighbors += std::find(m_OtherNeighbors.begin(), m_OtherNeighbors.end(), neighbor) != m_OtherNeighbors.end();
+		if (amountSharedNeighbors > amountEdgeTriangles)
+			return false;
+
+		// Every other triangle around "from" needs a vertex to move onto (if one of its vertices isn't on the edge, there's a seam or a hard edge crossing it),
+		// and can't be turned around too far
+		for (const uint32_t t : m_PositionTriangles[from])
+		{
+			if (m_TriangleAlive[t] == 0)
+				continue;
+
+			bool hasTo = false;
+			uint32_t fromVertex = UINT32_MAX;
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t v = m_Triangles[t * 3 + corner];
+				hasTo |= m_VertexPositions[v] == to;
+				if (m_VertexPositions[v] == from)
+					fromVertex = v;
+			}
+			if (hasTo)
+				continue;
+
+			if (std::find_if(wedges.begin(), wedges.end(), [fromVertex](const std::pair<uint32_t, uint32_t>& w) { return w.first == fromVertex; }) == wedges.end())
+				return false;
+
+			const Elite::FVector3 oldNormal = GetTriangleNormal(t, from, m_Positions[from]);
+			const Elite::FVector3 newNormal = GetTriangleNormal(t, from, m_Positions[to]);
+			const double cos = Elite::Dot(oldNormal, newNormal);
+			if (cos <= m_MinNormalCos * Elite::Magnitude(oldNormal) * Elite::Magnitude(newNormal))
+				return false;
+		}
+
+		return amountEdgeTriangles > 0;
+	}
+
+	void Simplifier::ApplyCollapse(uint32_t from, uint32_t to, const std::vector<std::pair<uint32_t, uint32_t>>& wedges)
+	{
+		// The triangles on the edge go away, and the rest move their vertex over
+		for (const uint32_t t : m_PositionTriangles[from])
+		{
+			if (m_TriangleAlive[t] == 0)
+				continue;
+
+			bool hasTo = false;
+			for (int corner = 0; corner < 3; ++corner)
+				hasTo |= m_VertexPositions[m_Triangles[t * 3 + corner]] == to;
+			if (hasTo)
+			{
+				m_TriangleAlive[t] = 0;
+				m_AmountLiveTriangles--;
+				continue;
+			}
+
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				uint32_t& v = m_Triangles[t * 3 + corner];
+				if (m_VertexPositions[v] == from)
+					v = std::find_if(wedges.begin(), wedges.end(), [v](const std::pair<uint32_t, uint32_t>& w) { return w.first == v; })->second;
+			}
+			m_PositionTriangles[to].push_back(t);
+		}
+		m_PositionTriangles[from].clear();
+		m_Removed[from] = 1;
+
+		// Clean up the triangles that went away around "to"
+		auto& toTriangles = m_PositionTriangles[to];
+		toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(), [this](uint32_t t) { return m_TriangleAlive[t] == 0; }), toTriangles.end());
+
+		// "to" now carries the error of both, so all its collapses get worked out again
+		m_Quadrics[to].Add(m_Quadrics[from]);
+		m_Versions[to]++;
+		GetNeighbors(to, m_Neighbors);
+		for (const uint32_t neighbor : m_Neighbors)
+			m_Versions[neighbor]++;
+		PushCollapses(to);
+		const std::vector<uint32_t> neighbors = m_Neighbors;
+		for (const uint32_t neighbor : neighbors)
+			PushCollapses(neighbor);
+	}
+
+	Elite::FVector3 Simplifier::GetTriangleNormal(uint32_t triangle, uint32_t movedPosition, const Elite::FPoint3& newPoint) const
+	{
+		Elite::FPoint3 points[3]{};
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			const uint32_t position = m_VertexPositions[m_Triangles[triangle * 3 + corner]];
+			points[corner] = (position == movedPosition) ? newPoint : m_Positions[position];
+		}
+		return Elite::Cross(points[1] - points[0], points[2] - points[0]);
+	}
+
+	void Simplifier::GetNeighbors(uint32_t position, std::vector<uint32_t>& neighbors)
+	{
+		neighbors.clear();
+		for (const uint32_t t : m_PositionTriangles[position])
+		{
+			if (m_TriangleAlive[t] == 0)
+				continue;
+
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t neighbor = m_VertexPositions[m_Triangles[t * 3 + corner]];
+				if (neighbor != position && std::find(neighbors.begin(), neighbors.end(), neighbor) == neighbors.end())
+					neighbors.push_back(neighbor);
+			}
+		}
+	}
+}
+
+std::vector<MeshSimplifier::SimplifiedMesh> MeshSimplifier::BuildLodChain(Span<const VS_INPUT> vertices, Span<const uint32_t> indices, uint32_t amountLevels)
+{
+	std::vector<SimplifiedMesh> levels{};
+	if (indices.size() / 3 < m_MinTriangles)
+		return levels;
+
+	// A single run of collapses goes through all the levels, taking a copy of the mesh every time it gets down to the next one's triangles
+	Simplifier simplifier{ vertices, indices };
+	uint32_t amountTriangles = indices.size() / 3;
+	for (uint32_t level = 0; level < amountLevels && amountTriangles >= m_MinTriangles; ++level)
+	{
+		simplifier.Simplify(amountTriangles / 2);
+
+		// Stop once it can't get much simpler anymore (most of what's left are seams and borders)
+		if (simplifier.GetAmountTriangles() > amountTriangles * 3 / 4)
+			break;
+
+		amountTriangles = simplifier.GetAmountTriangles();
+		levels.push_back(simplifier.GetMesh());
+	}
+	return levels;
+}
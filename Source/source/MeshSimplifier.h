@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Span.h"
+
+struct VS_INPUT;
+
+// How many triangles the meshes drawn in a frame have at the level of detail they were drawn at, and how many they have at full detail
+struct LodStats
+{
+	uint32_t AmountFullTriangles;
+	uint32_t AmountLodTriangles;
+};
+
+namespace MeshSimplifier
+{
+	// Meshes smaller than this aren't worth simplifying (they're cheap to draw at any size)
+	static const uint32_t m_MinTriangles = 256;
+
+	struct SimplifiedMesh
+	{
+		std::vector<VS_INPUT> Vertices;
+		std::vector<uint32_t> Indices;
+	};
+
+	// Simplifies a triangle list into a chain of levels of detail, each with about half the triangles of the one before it
+	// Edges are collapsed onto one of their vertices, cheapest quadric error first, so every vertex keeps its own attributes (and the mesh its textures)
+	// UV seams, hard edges and open borders are kept in place. Fewer levels come back if the mesh can't be simplified that far
+	std::vector<SimplifiedMesh> BuildLodChain(Span<const VS_INPUT> vertices, Span<const uint32_t> indices, uint32_t amountLevels);
+}
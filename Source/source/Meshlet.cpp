@@ -0,0 +1,247 @@
+#include "pch.h"
+#include "Meshlet.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#include "Mesh.h"
+
+namespace
+{
+	// Works out a meshlet's bounding sphere and normal cone, out of its triangles
+	void SetMeshletBounds(Meshlet& meshlet, Span<const VS_INPUT> vertices, const std::vector<uint32_t>& indices)
+	{
+		// The sphere is centered on the bounding box, and reaches out to the farthest vertex
+		Elite::FPoint3 minPos{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Elite::FPoint3 maxPos{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t i = meshlet.FirstIndex; i < meshlet.FirstIndex + meshlet.AmountIndices; ++i)
+		{
+			const Elite::FPoint3& position = vertices[indices[i]].Position;
+			minPos = Elite::FPoint3{ std::min(minPos.x, position.x), std::min(minPos.y, position.y), std::min(minPos.z, position.z) };
+			maxPos = Elite::FPoint3{ std::max(maxPos.x, position.x), std::max(maxPos.y, position.y), std::max(maxPos.z, position.z) };
+		}
+		meshlet.Center = Elite::FPoint3{ (minPos.x + maxPos.x) * 0.5f, (minPos.y + maxPos.y) * 0.5f, (minPos.z + maxPos.z) * 0.5f };
+		float sqrRadius = 0.f;
+		for (uint32_t i = meshlet.FirstIndex; i < meshlet.FirstIndex + meshlet.AmountIndices; ++i)
+			sqrRadius = std::max(sqrRadius, Elite::SqrMagnitude(vertices[indices[i]].Position - meshlet.Center));
+		meshlet.Radius = sqrtf(sqrRadius);
+
+		// The cone's axis is the average of the triangles' normals, and its angle reaches the one that's farthest from it
+		Elite::FVector3 normalSum{};
+		for (uint32_t i = meshlet.FirstIndex; i < meshlet.FirstIndex + meshlet.AmountIndices; i += 3)
+		{
+			const Elite::FVector4 facePlane = MeshGeometry::GetFacePlane(vertices[indices[i]].Position, vertices[indices[i + 1]].Position, vertices[indices[i + 2]].Position);
+			normalSum += Elite::GetNormalized(Elite::FVector3{ facePlane.x, facePlane.y, facePlane.z });
+		}
+		meshlet.ConeAxis = Elite::GetNormalized(normalSum);
+
+		float minDot = 1.f;
+		for (uint32_t i = meshlet.FirstIndex; i < meshlet.FirstIndex + meshlet.AmountIndices; i += 3)
+		{
+			const Elite::FVector4 facePlane = MeshGeometry::GetFacePlane(vertices[indices[i]].Position, vertices[indices[i + 1]].Position, vertices[indices[i + 2]].Position);
+			const Elite::FVector3 normal{ facePlane.x, facePlane.y, facePlane.z };
+			// Degenerate triangles have no facing, and never get drawn anyway
+			if (Elite::SqrMagnitude(normal) > 0.f)
+				minDot = std::min(minDot, Elite::Dot(meshlet.ConeAxis, Elite::GetNormalized(normal)));
+		}
+
+		// A cone wider than ~84 degrees (or with no axis at all) can only be back-facing from so few places, that it's not worth testing
+		const bool hasAxis = Elite::SqrMagnitude(meshlet.ConeAxis) > 0.f;
+		meshlet.ConeCutoff = (hasAxis && minDot > 0.1f) ? sqrtf(1.f - minDot * minDot) : 1.f;
+	}
+}
+
+std::vector<Meshlet> Meshlets::Build(Span<const VS_INPUT> vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<Meshlet> meshlets{};
+	const uint32_t amountTriangles = uint32_t(indices.size() / 3);
+	if (amountTriangles == 0)
+		return meshlets;
+
+	// Triangles that touch the same position count as neighbors, even when their vertices aren't shared (because of a different UV or normal)
+	// so every vertex gets the index of the first vertex at its exact position
+	std::vector<uint32_t> positionIdxs(vertices.size());
+	std::unordered_map<uint64_t, uint32_t> firstVertexAtPosition{};
+	firstVertexAtPosition.reserve(vertices.size());
+	for (uint32_t v = 0; v < vertices.size(); ++v)
+	{
+		uint32_t bits[3]{};
+		memcpy(bits, &vertices[v].Position, sizeof(bits));
+		const uint64_t hash = (uint64_t(bits[0]) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(bits[1]) * 0xC2B2AE3D27D4EB4Full) ^ (uint64_t(bits[2]) * 0x165667B19E3779F9ull);
+		const auto result = firstVertexAtPosition.emplace(hash, v);
+		const uint32_t firstVertex = result.first->second;
+		// A hash collision between different positions just leaves the vertex on its own
+		positionIdxs[v] = (memcmp(&vertices[firstVertex].Position, &vertices[v].Position, sizeof(bits)) == 0) ? firstVertex : v;
+	}
+
+	// List the triangles around each position (counted first, then filled, all in one array)
+	std::vector<uint32_t> adjacencyOffsets(size_t(vertices.size()) + 1, 0);
+	for (const uint32_t index : indices)
+		adjacencyOffsets[positionIdxs[index] + 1]++;
+	for (size_t i = 1; i < adjacencyOffsets.size(); ++i)
+		adjacencyOffsets[i] += adjacencyOffsets[i - 1];
+	std::vector<uint32_t> adjacencyCursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	std::vector<uint32_t> adjacentTriangles(indices.size());
+	for (uint32_t t = 0; t < amountTriangles; ++t)
+	{
+		for (uint32_t corner = 0; corner < 3; ++corner)
+			adjacentTriangles[adjacencyCursors[positionIdxs[indices[size_t(t) * 3 + corner]]]++] = t;
+	}
+
+	// Grow each meshlet greedily from the first triangle that's still left: keep adding the neighbor that brings the fewest new vertices,
+	// until it's full or has no more neighbors
+	std::vector<uint32_t> reorderedIndices{};
+	reorderedIndices.reserve(indices.size());
+	std::vector<bool> triangleUsed(amountTriangles, false);
+	std::vector<uint32_t> vertexMeshlet(vertices.size(), UINT32_MAX); // Last meshlet each vertex was added to
+	std::vector<uint32_t> meshletPositions{};
+	uint32_t seedTriangle = 0;
+	while (true)
+	{
+		while (seedTriangle < amountTriangles && triangleUsed[seedTriangle])
+			seedTriangle++;
+		if (seedTriangle == amountTriangles)
+			break;
+
+		const uint32_t meshletIdx = uint32_t(meshlets.size());
+		Meshlet meshlet{};
+		meshlet.FirstIndex = uint32_t(reorderedIndices.size());
+		uint32_t amountVertices = 0;
+		meshletPositions.clear();
+
+		auto getNewVertices = [&](uint32_t t)
+		{
+			uint32_t amountNew = 0;
+			for (uint32_t corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t index = indices[size_t(t) * 3 + corner];
+				// (a triangle can use the same vertex twice, so only count it once)
+				const bool repeated = (corner > 0 && indices[size_t(t) * 3] == index) || (corner > 1 && indices[size_t(t) * 3 + 1] == index);
+				amountNew += (vertexMeshlet[index] != meshletIdx && repeated == false) ? 1 : 0;
+			}
+			return amountNew;
+		};
+
+		uint32_t triangle = seedTriangle;
+		while (triangle != UINT32_MAX)
+		{
+			// Add the triangle
+			triangleUsed[triangle] = true;
+			amountVertices += getNewVertices(triangle);
+			for (uint32_t corner = 0; corner < 3; ++corner)
+			{
+				const uint32_t index = indices[size_t(triangle) * 3 + corner];
+				vertexMeshlet[index] = meshletIdx;
+				reorderedIndices.push_back(index);
+				if (std::find(meshletPositions.begin(), meshletPositions.end(), positionIdxs[index]) == meshletPositions.end())
+					meshletPositions.push_back(positionIdxs[index]);
+			}
+			if ((reorderedIndices.size() - meshlet.FirstIndex) / 3 == m_MaxTriangles)
+				break;
+
+			// And look for the best next one around the meshlet's positions (ties go to the triangle that came first)
+			triangle = UINT32_MAX;
+			uint32_t bestNewVertices = UINT32_MAX;
+			for (const uint32_t position : meshletPositions)
+			{
+				for (uint32_t a = adjacencyOffsets[position]; a < adjacencyOffsets[position + 1]; ++a)
+				{
+					const uint32_t candidate = adjacentTriangles[a];
+					if (triangleUsed[candidate])
+						continue;
+
+					const uint32_t newVertices = getNewVertices(candidate);
+					if (amountVertices + newVertices > m_MaxVertices)
+						continue;
+					if (newVertices < bestNewVertices || (newVertices == bestNewVertices && candidate < triangle))
+					{
+						triangle = candidate;
+						bestNewVertices = newVertices;
+					}
+				}
+			}
+		}
+
+		meshlet.AmountIndices = uint32_t(reorderedIndices.size()) - meshlet.FirstIndex;
+		meshlets.push_back(meshlet);
+	}
+
+	// Put the triangles in meshlet order, and only then work out the bounds (they read the indices)
+	indices.swap(reorderedIndices);
+	for (auto& meshlet : meshlets)
+		SetMeshletBounds(meshlet, vertices, indices);
+
+	return meshlets;
+}
+
+MeshletCuller::MeshletCuller(const Elite::FMatrix4& transformMatrix, const Elite::FMatrix4& viewMatrix, const Elite::FPoint3& cameraPos, float fov, float aspectRatio,
+	float nearPlane, float farPlane, bool leftHandCoordSystem, CULL_MODE cullMode)
+	: m_WorldViewMatrix{ viewMatrix * transformMatrix }
+	, m_MaxScale{}
+	, m_DepthSign{ leftHandCoordSystem ? 1.f : -1.f }
+	, m_TanHalfFovX{ fov * aspectRatio }
+	, m_TanHalfFovY{ fov }
+	, m_NearPlane{ nearPlane }
+	, m_FarPlane{ farPlane }
+	, m_ObjectCameraPos{}
+	, m_FaceCullingOn{ cullMode != CULL_MODE::None }
+	, m_CullFrontFacing{ false }
+{
+	// The view matrix is rigid, so the transform's columns are all that can scale the spheres
+	for (int column = 0; column < 3; ++column)
+	{
+		const Elite::FVector3 axis{ m_WorldViewMatrix(0, column), m_WorldViewMatrix(1, column), m_WorldViewMatrix(2, column) };
+		m_MaxScale = std::max(m_MaxScale, Elite::Magnitude(axis));
+	}
+
+	// Bring the camera into the mesh's space
+	const Elite::FMatrix4 invTransformMatrix = Elite::Inverse(transformMatrix);
+	m_ObjectCameraPos = Elite::FPoint3(
+		invTransformMatrix(0, 0) * cameraPos.x + invTransformMatrix(0, 1) * cameraPos.y + invTransformMatrix(0, 2) * cameraPos.z + invTransformMatrix(0, 3),
+		invTransformMatrix(1, 0) * cameraPos.x + invTransformMatrix(1, 1) * cameraPos.y + invTransformMatrix(1, 2) * cameraPos.z + invTransformMatrix(1, 3),
+		invTransformMatrix(2, 0) * cameraPos.x + invTransformMatrix(2, 1) * cameraPos.y + invTransformMatrix(2, 2) * cameraPos.z + invTransformMatrix(2, 3));
+
+	// A counter-clockwise triangle faces the camera when the camera is in front of its plane, in a right handed coordinate system
+	// A mirroring transform and a left handed coordinate system each flip that
+	m_CullFrontFacing = ((cullMode == CULL_MODE::Front) != (Elite::Determinant(transformMatrix) < 0.f)) != leftHandCoordSystem;
+}
+
+MESHLET_VISIBILITY MeshletCuller::GetVisibility(const Meshlet& meshlet) const
+{
+	// Frustum: bring the sphere into view space, and check it against the near and far planes, and the 4 side planes
+	const Elite::FPoint3& center = meshlet.Center;
+	const Elite::FPoint3 viewCenter(
+		m_WorldViewMatrix(0, 0) * center.x + m_WorldViewMatrix(0, 1) * center.y + m_WorldViewMatrix(0, 2) * center.z + m_WorldViewMatrix(0, 3),
+		m_WorldViewMatrix(1, 0) * center.x + m_WorldViewMatrix(1, 1) * center.y + m_WorldViewMatrix(1, 2) * center.z + m_WorldViewMatrix(1, 3),
+		m_WorldViewMatrix(2, 0) * center.x + m_WorldViewMatrix(2, 1) * center.y + m_WorldViewMatrix(2, 2) * center.z + m_WorldViewMatrix(2, 3));
+	const float radius = meshlet.Radius * m_MaxScale;
+	const float depth = viewCenter.z * m_DepthSign;
+	if (depth + radius < m_NearPlane || depth - radius > m_FarPlane)
+		return MESHLET_VISIBILITY::OutsideFrustum;
+	if (std::abs(viewCenter.x) - m_TanHalfFovX * depth > radius * sqrtf(1.f + m_TanHalfFovX * m_TanHalfFovX))
+		return MESHLET_VISIBILITY::OutsideFrustum;
+	if (std::abs(viewCenter.y) - m_TanHalfFovY * depth > radius * sqrtf(1.f + m_TanHalfFovY * m_TanHalfFovY))
+		return MESHLET_VISIBILITY::OutsideFrustum;
+
+	// Normal cone: every triangle faces the culled way when the direction to the sphere is close enough to the cone's axis (pointing away from the camera
+	// for the back faces) for the whole sphere (the same conservative test meshoptimizer does)
+	if (m_FaceCullingOn && meshlet.ConeCutoff < 1.f)
+	{
+		const Elite::FVector3 cameraToCenter = center - m_ObjectCameraPos;
+		const Elite::FVector3 culledAxis = m_CullFrontFacing ? -meshlet.ConeAxis : meshlet.ConeAxis;
+		if (Elite::Dot(cameraToCenter, culledAxis) >= meshlet.ConeCutoff * Elite::Magnitude(cameraToCenter) + meshlet.Radius)
+			return MESHLET_VISIBILITY::BackFacing;
+	}
+
+	return MESHLET_VISIBILITY::Visible;
+}
+
+bool MeshletCuller::IsTriangleCulled(const Elite::FVector4& facePlane) const
+{
+	if (m_FaceCullingOn == false)
+		return false;
+
+	const bool frontFacing = facePlane.x * m_ObjectCameraPos.x + facePlane.y * m_ObjectCameraPos.y + facePlane.z * m_ObjectCameraPos.z + facePlane.w > 0.f;
+	return frontFacing == m_CullFrontFacing;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Span.h"
+
+struct VS_INPUT;
+enum class CULL_MODE;
+
+// A cluster of nearby triangles, which are consecutive in its mesh's index list, so it can be culled (and drawn) as a whole
+struct Meshlet
+{
+	uint32_t FirstIndex;
+	uint32_t AmountIndices;
+	Elite::FPoint3 Center; // Bounding sphere of its vertices, in object space
+	float Radius;
+	Elite::FVector3 ConeAxis; // Normal cone: the average direction its triangles face (the way their counter-clockwise winding does)
+	float ConeCutoff; // Sine of the cone's half angle, or 1 when its triangles face too many ways to ever all be back-facing
+};
+
+// How many meshlets a frame went over, and how many of them it culled as a whole
+struct MeshletStats
+{
+	uint32_t AmountMeshlets;
+	uint32_t AmountFrustumCulledMeshlets;
+	uint32_t AmountBackFaceCulledMeshlets;
+};
+
+enum class MESHLET_VISIBILITY
+{
+	Visible,
+	OutsideFrustum,
+	BackFacing
+};
+
+namespace Meshlets
+{
+	// Small enough for a cluster's vertices to stay in cache while its triangles are set up
+	static const uint32_t m_MaxVertices = 64;
+	static const uint32_t m_MaxTriangles = 124;
+
+	// Groups a triangle list into meshlets, reordering the indices so each meshlet's triangles are consecutive
+	std::vector<Meshlet> Build(Span<const VS_INPUT> vertices, std::vector<uint32_t>& indices);
+}
+
+// Everything needed to cull one mesh's meshlets (and triangles) this frame, worked out once per mesh
+// Culling happens in object space for the normal cones and the face planes, and in view space for the frustum
+class MeshletCuller final
+{
+public:
+	MeshletCuller(const Elite::FMatrix4& transformMatrix, const Elite::FMatrix4& viewMatrix, const Elite::FPoint3& cameraPos, float fov, float aspectRatio,
+		float nearPlane, float farPlane, bool leftHandCoordSystem, CULL_MODE cullMode);
+
+	MESHLET_VISIBILITY GetVisibility(const Meshlet& meshlet) const;
+
+	// Whether a triangle with this face plane (see MeshGeometry::GetFacePlanes) gets culled by the cull mode
+	bool IsTriangleCulled(const Elite::FVector4& facePlane) const;
+	bool IsFaceCullingOn() const { return m_FaceCullingOn; }
+
+private:
+	Elite::FMatrix4 m_WorldViewMatrix;
+	float m_MaxScale; // Largest scale of the transform, which the bounding spheres' radius grows by
+	float m_DepthSign; // The view looks down +z in a left handed coordinate system, and down -z in a right handed one
+	float m_TanHalfFovX, m_TanHalfFovY;
+	float m_NearPlane, m_FarPlane;
+	Elite::FPoint3 m_ObjectCameraPos;
+	bool m_FaceCullingOn;
+	bool m_CullFrontFacing; // Which side gets culled, with the cull mode and any mirroring of the transform or the coordinate system already taken into account
+};
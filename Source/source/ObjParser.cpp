@@ -0,0 +1,259 @@
+#include "pch.h"
+#include "ObjParser.h"
+
+#include <charconv>
+#include <cstring>
+
+#include "ThreadPool.h"
+
+namespace
+{
+	// Files are only split into chunks this big or bigger, so a small one doesn't get spread over the threads for nothing
+	const size_t m_MinChunkSize = 1 << 16;
+	// Bits of ChunkData::RelativeCorners, for each index of a corner that's counted back from the chunk's own elements
+	const uint8_t m_RelativePosition = 1 << 0;
+	const uint8_t m_RelativeUV = 1 << 1;
+	const uint8_t m_RelativeNormal = 1 << 2;
+
+	// What one chunk of lines holds, before the elements of the chunks in front of it are known
+	// A negative index can only be resolved against the chunk's own elements, so it's kept relative to the chunk's first one until the merge
+	struct ChunkData
+	{
+		const char* pBegin;
+		const char* pEnd;
+		std::vector<Elite::FPoint3> Positions;
+		std::vector<Elite::FVector2> UVs;
+		std::vector<Elite::FVector3> Normals;
+		std::vector<ObjCorner> Corners;
+		std::vector<uint8_t> RelativeCorners;
+		std::vector<ObjCorner> FaceCorners; // The corners of the face being parsed, before it's turned into triangles
+		std::vector<uint8_t> FaceRelativeCorners;
+		bool IsValid;
+	};
+
+	const char* SkipSpaces(const char* p, const char* pEnd)
+	{
+		while (p < pEnd && (*p == ' ' || *p == '\t' || *p == '\r'))
+			++p;
+		return p;
+	}
+
+	// Reads the next number of the line (leaving it at 0 if there's none), and moves past it
+	template<typename T>
+	void ParseNumber(const char*& p, const char* pEnd, T& value)
+	{
+		p = SkipSpaces(p, pEnd);
+		// from_chars doesn't take a leading plus sign
+		if (p < pEnd && *p == '+')
+			++p;
+		const auto result = std::from_chars(p, pEnd, value);
+		if (result.ec == std::errc{})
+			p = result.ptr;
+	}
+
+	// Reads an obj index (1-based, or negative to count back from the last element so far) as a 0-based one
+	bool ParseIndex(const char*& p, const char* pEnd, int32_t amountElements, int32_t& index, bool& isRelative)
+	{
+		int32_t objIndex = 0;
+		const auto result = std::from_chars(p, pEnd, objIndex);
+		if (result.ec != std::errc{} || objIndex == 0)
+			return false;
+
+		p = result.ptr;
+		isRelative = objIndex < 0;
+		index = isRelative ? amountElements + objIndex : objIndex - 1;
+		return true;
+	}
+
+	// Reads a face's corners (v, v/vt, v//vn or v/vt/vn), and adds it as a fan of triangles
+	bool ParseFace(const char* p, const char* pEnd, ChunkData& chunk)
+	{
+		chunk.FaceCorners.clear();
+		chunk.FaceRelativeCorners.clear();
+		while (true)
+		{
+			p = SkipSpaces(p, pEnd);
+			if (p == pEnd)
+				break;
+
+			ObjCorner corner{ ObjParser::m_Missing, ObjParser::m_Missing, ObjParser::m_Missing };
+			uint8_t relativeCorner = 0;
+			bool isRelative = false;
+			if (ParseIndex(p, pEnd, int32_t(chunk.Positions.size()), corner.Position, isRelative) == false)
+				return false;
+			relativeCorner |= isRelative ? m_RelativePosition : 0;
+
+			if (p < pEnd && *p == '/')
+			{
+				++p;
+				if (p < pEnd && *p != '/')
+				{
+					if (ParseIndex(p, pEnd, int32_t(chunk.UVs.size()), corner.UV, isRelative) == false)
+						return false;
+					relativeCorner |= isRelative ? m_RelativeUV : 0;
+				}
+				if (p < pEnd && *p == '/')
+				{
+					++p;
+					if (ParseIndex(p, pEnd, int32_t(chunk.Normals.size()), corner.Normal, isRelative) == false)
+						return false;
+					relativeCorner |= isRelative ? m_RelativeNormal : 0;
+				}
+			}
+
+			chunk.FaceCorners.push_back(corner);
+			chunk.FaceRelativeCorners.push_back(relativeCorner);
+		}
+
+		if (chunk.FaceCorners.size() < 3)
+			return false;
+
+		for (size_t i = 1; i + 1 < chunk.FaceCorners.size(); ++i)
+		{
+			for (const size_t c : { size_t(0), i, i + 1 })
+			{
+				chunk.Corners.push_back(chunk.FaceCorners[c]);
+				chunk.RelativeCorners.push_back(chunk.FaceRelativeCorners[c]);
+			}
+		}
+		return true;
+	}
+
+	void ParseLine(const char* p, const char* pEnd, ChunkData& chunk)
+	{
+		p = SkipSpaces(p, pEnd);
+		if (pEnd - p < 2)
+			return;
+
+		auto isSpace = [](char c) { return c == ' ' || c == '\t'; };
+		// Save the vertex positions (inverting the z axis, since it's a Left-Handed Coord System)
+		if (p[0] == 'v' && isSpace(p[1]))
+		{
+			p += 2;
+			float x{}, y{}, z{};
+			ParseNumber(p, pEnd, x);
+			ParseNumber(p, pEnd, y);
+			ParseNumber(p, pEnd, z);
+			chunk.Positions.emplace_back(x, y, -z);
+		}
+
+		// Save the uvs (with v going down the texture)
+		else if (p[0] == 'v' && p[1] == 't' && pEnd - p > 2 && isSpace(p[2]))
+		{
+			p += 3;
+			double u{}, v{};
+			ParseNumber(p, pEnd, u);
+			ParseNumber(p, pEnd, v);
+			chunk.UVs.emplace_back(float(u), float(1.0 - v));
+		}
+
+		// Save the normals (inverting the z axis too)
+		else if (p[0] == 'v' && p[1] == 'n' && pEnd - p > 2 && isSpace(p[2]))
+		{
+			p += 3;
+			float x{}, y{}, z{};
+			ParseNumber(p, pEnd, x);
+			ParseNumber(p, pEnd, y);
+			ParseNumber(p, pEnd, z);
+			chunk.Normals.emplace_back(x, y, -z);
+		}
+
+		// Save the faces
+		else if (p[0] == 'f' && isSpace(p[1]))
+		{
+			if (ParseFace(p + 2, pEnd, chunk) == false)
+				chunk.IsValid = false;
+		}
+	}
+}
+
+bool ObjParser::Parse(const char* pText, size_t size, ThreadPool& threadPool, ObjData& data)
+{
+	// Split the text into chunks that each end right after a line
+	const size_t amountChunks = std::max(size_t(1), std::min(size / m_MinChunkSize, size_t(threadPool.GetAmountThreads()) * 4));
+	std::vector<ChunkData> chunks(amountChunks);
+	const char* pTextEnd = pText + size;
+	const char* pChunkBegin = pText;
+	for (size_t i = 0; i < amountChunks; ++i)
+	{
+		const char* pChunkEnd = pTextEnd;
+		if (i + 1 < amountChunks)
+		{
+			pChunkEnd = std::max(pText + size * (i + 1) / amountChunks, pChunkBegin);
+			const void* pNewLine = memchr(pChunkEnd, '\n', pTextEnd - pChunkEnd);
+			pChunkEnd = pNewLine != nullptr ? static_cast<const char*>(pNewLine) + 1 : pTextEnd;
+		}
+
+		chunks[i].pBegin = pChunkBegin;
+		chunks[i].pEnd = pChunkEnd;
+		chunks[i].IsValid = true;
+		pChunkBegin = pChunkEnd;
+	}
+
+	// Parse every chunk on its own, line by line
+	threadPool.ParallelFor(uint32_t(amountChunks), [&](uint32_t chunkIdx)
+	{
+		ChunkData& chunk = chunks[chunkIdx];
+		const char* p = chunk.pBegin;
+		while (p < chunk.pEnd)
+		{
+			const void* pNewLine = memchr(p, '\n', chunk.pEnd - p);
+			const char* pLineEnd = pNewLine != nullptr ? static_cast<const char*>(pNewLine) : chunk.pEnd;
+			ParseLine(p, pLineEnd, chunk);
+			p = pLineEnd + 1;
+		}
+	});
+
+	// Work out where each chunk's elements go
+	std::vector<ObjCorner> chunkOffsets(amountChunks + 1, ObjCorner{ 0, 0, 0 });
+	std::vector<size_t> chunkCornerOffsets(amountChunks + 1, 0);
+	for (size_t i = 0; i < amountChunks; ++i)
+	{
+		if (chunks[i].IsValid == false)
+			return false;
+
+		chunkOffsets[i + 1].Position = chunkOffsets[i].Position + int32_t(chunks[i].Positions.size());
+		chunkOffsets[i + 1].UV = chunkOffsets[i].UV + int32_t(chunks[i].UVs.size());
+		chunkOffsets[i + 1].Normal = chunkOffsets[i].Normal + int32_t(chunks[i].Normals.size());
+		chunkCornerOffsets[i + 1] = chunkCornerOffsets[i] + chunks[i].Corners.size();
+	}
+	const ObjCorner& amountElements = chunkOffsets[amountChunks];
+	data.Positions.resize(amountElements.Position);
+	data.UVs.resize(amountElements.UV);
+	data.Normals.resize(amountElements.Normal);
+	data.Corners.resize(chunkCornerOffsets[amountChunks]);
+
+	// And copy them over in chunk order (in parallel too), resolving the relative indices and checking they're all in range
+	threadPool.ParallelFor(uint32_t(amountChunks), [&](uint32_t chunkIdx)
+	{
+		ChunkData& chunk = chunks[chunkIdx];
+		const ObjCorner& offset = chunkOffsets[chunkIdx];
+		std::copy(chunk.Positions.begin(), chunk.Positions.end(), data.Positions.begin() + offset.Position);
+		std::copy(chunk.UVs.begin(), chunk.UVs.end(), data.UVs.begin() + offset.UV);
+		std::copy(chunk.Normals.begin(), chunk.Normals.end(), data.Normals.begin() + offset.Normal);
+
+		ObjCorner* pCorners = data.Corners.data() + chunkCornerOffsets[chunkIdx];
+		for (size_t i = 0; i < chunk.Corners.size(); ++i)
+		{
+			ObjCorner corner = chunk.Corners[i];
+			const uint8_t relativeCorner = chunk.RelativeCorners[i];
+			corner.Position += (relativeCorner & m_RelativePosition) ? offset.Position : 0;
+			corner.UV += (relativeCorner & m_RelativeUV) ? offset.UV : 0;
+			corner.Normal += (relativeCorner & m_RelativeNormal) ? offset.Normal : 0;
+
+			const bool isPositionValid = corner.Position >= 0 && corner.Position < amountElements.Position;
+			const bool isUVValid = (corner.UV >= 0 && corner.UV < amountElements.UV) || (corner.UV == m_Missing && (relativeCorner & m_RelativeUV) == 0);
+			const bool isNormalValid = (corner.Normal >= 0 && corner.Normal < amountElements.Normal) || (corner.Normal == m_Missing && (relativeCorner & m_RelativeNormal) == 0);
+			if (!isPositionValid || !isUVValid || !isNormalValid)
+				chunk.IsValid = false;
+			pCorners[i] = corner;
+		}
+	});
+
+	for (const auto& chunk : chunks)
+	{
+		if (chunk.IsValid == false)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// One corner of a face, as 0-based indices into the obj's positions, uvs and normals (ObjParser::m_Missing for a uv or a normal it doesn't have)
+struct ObjCorner
+{
+	int32_t Position;
+	int32_t UV;
+	int32_t Normal;
+};
+
+// Everything an obj file holds that the renderer uses, already in its Left-Handed Coord System (z inverted, and v flipped to go down the texture)
+struct ObjData
+{
+	std::vector<Elite::FPoint3> Positions;
+	std::vector<Elite::FVector2> UVs;
+	std::vector<Elite::FVector3> Normals;
+	std::vector<ObjCorner> Corners; // 3 per triangle, with every face that has more than 3 corners turned into a fan of triangles
+};
+
+namespace ObjParser
+{
+	static const int32_t m_Missing = -1;
+
+	// Parses the text of an obj file, split into chunks of whole lines that get parsed in parallel, and then put back together in order
+	// (so the result is always the same, however the chunks got spread over the threads)
+	// Faces can have any amount of corners, negative (relative) indices, and no uv and/or no normal. Everything besides v, vt, vn and f is skipped
+	// Returns false if a face can't be read, or uses an index that's out of range
+	bool Parse(const char* pText, size_t size, ThreadPool& threadPool, ObjData& data);
+}
@@ -5,6 +5,7 @@
 
 Scene::Scene()
 	: m_Meshes()
+	, m_BVH()
 	, m_Cameras()
 	, m_CurrentCameraIdx(0)
 	, m_AmbientLight()
@@ -24,6 +25,7 @@ Scene::~Scene()
 void Scene::AddMesh(Mesh* newMesh)
 {
 	m_Meshes.push_back(newMesh);
+	m_BVH.AddMesh(newMesh);
 }
 
 void Scene::ClearMeshes()
@@ -35,6 +37,12 @@ void Scene::ClearMeshes()
 	}
 
 	m_Meshes.clear();
+	m_BVH.Clear();
+}
+
+void Scene::GetVisibleMeshes(float aspectRatio, bool leftHandCoordSystem, std::vector<Mesh*>& visibleMeshes, SceneCullStats& stats)
+{
+	m_BVH.GetVisibleMeshes(GetCurrentCamera(), aspectRatio, leftHandCoordSystem, visibleMeshes, stats);
 }
 
 void Scene::AddCamera(Elite::ECamera* newCamera)
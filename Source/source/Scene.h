@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "ERGBColor.h"
+#include "SceneBVH.h"
 
 class Mesh;
 
@@ -24,7 +25,9 @@ public:
 
 	void AddMesh(Mesh* newMesh);
 	void ClearMeshes();
-	std::vector<Mesh*> GetMeshes() const { return m_Meshes; }
+	const std::vector<Mesh*>& GetMeshes() const { return m_Meshes; }
+	// Only the meshes the current camera can see (at least partly), found through the BVH
+	void GetVisibleMeshes(float aspectRatio, bool leftHandCoordSystem, std::vector<Mesh*>& visibleMeshes, SceneCullStats& stats);
 
 
 	void AddCamera(Elite::ECamera* newCamera);
@@ -48,6 +51,7 @@ public:
 
 private:
 	std::vector<Mesh*> m_Meshes;
+	SceneBVH m_BVH;
 	std::vector <Elite::ECamera*> m_Cameras;
 	int m_CurrentCameraIdx;
 	Elite::FVector3 m_LightDirection;
@@ -0,0 +1,287 @@
+#include "pch.h"
+#include "SceneBVH.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "ECamera.h"
+#include "Mesh.h"
+
+SceneBVH::SceneBVH()
+	: m_Meshes{}
+	, m_MeshBounds{}
+	, m_MeshLeafs{}
+	, m_MeshDirty{}
+	, m_DirtyMeshIdxs{}
+	, m_Nodes{}
+	, m_LeafMeshIdxs{}
+	, m_NeedsBuild{ false }
+	, m_LeftHandCoordSystem{ true }
+	, m_ViewMatrix{}
+	, m_DepthSign{ 1.f }
+	, m_TanHalfFovX{}
+	, m_TanHalfFovY{}
+	, m_NearPlane{}
+	, m_FarPlane{}
+	, m_NodeStack{}
+	, m_VisibleMeshIdxs{}
+{
+}
+
+void SceneBVH::AddMesh(Mesh* pMesh)
+{
+	// The tree gets built again before the next frame (meshes are only added while a scene is being set up)
+	pMesh->SetSceneBVH(this, uint32_t(m_Meshes.size()));
+	m_Meshes.push_back(pMesh);
+	m_MeshBounds.emplace_back();
+	m_MeshLeafs.push_back(0);
+	m_MeshDirty.push_back(0);
+	m_NeedsBuild = true;
+}
+
+void SceneBVH::Clear()
+{
+	m_Meshes.clear();
+	m_MeshBounds.clear();
+	m_MeshLeafs.clear();
+	m_MeshDirty.clear();
+	m_DirtyMeshIdxs.clear();
+	m_Nodes.clear();
+	m_LeafMeshIdxs.clear();
+	m_NeedsBuild = false;
+}
+
+void SceneBVH::MarkDirty(uint32_t meshIdx)
+{
+	// Each mesh only goes in the list once, no matter how many times its transform changes in a frame
+	if (m_MeshDirty[meshIdx])
+		return;
+
+	m_MeshDirty[meshIdx] = 1;
+	m_DirtyMeshIdxs.push_back(meshIdx);
+}
+
+void SceneBVH::GetVisibleMeshes(const Elite::ECamera* pCamera, float aspectRatio, bool leftHandCoordSystem, std::vector<Mesh*>& visibleMeshes, SceneCullStats& stats)
+{
+	// Switching between the modes moves every mesh into the other world space, so the tree is built again for it
+	if (leftHandCoordSystem != m_LeftHandCoordSystem)
+	{
+		m_LeftHandCoordSystem = leftHandCoordSystem;
+		m_NeedsBuild = true;
+	}
+
+	// Get the boxes up to date
+	if (m_NeedsBuild)
+		Build();
+	else
+		Refit();
+
+	// Set up the frustum (in view space, where it's symmetric, so each pair of side planes is a single test)
+	m_ViewMatrix = pCamera->GetViewMatrix();
+	m_DepthSign = leftHandCoordSystem ? 1.f : -1.f;
+	m_TanHalfFovX = pCamera->GetFov() * aspectRatio;
+	m_TanHalfFovY = pCamera->GetFov();
+	m_NearPlane = pCamera->GetNear();
+	m_FarPlane = pCamera->GetFar();
+
+	stats = SceneCullStats{};
+	stats.AmountMeshes = uint32_t(m_Meshes.size());
+	visibleMeshes.clear();
+	m_VisibleMeshIdxs.clear();
+	if (m_Nodes.empty())
+		return;
+
+	// Go down the tree, skipping every node whose box is outside the frustum along with everything below it
+	m_NodeStack.clear();
+	m_NodeStack.push_back(0);
+	while (m_NodeStack.empty() == false)
+	{
+		const Node& node = m_Nodes[m_NodeStack.back()];
+		m_NodeStack.pop_back();
+		stats.AmountVisitedNodes++;
+		if (IsOutsideFrustum(node.Bounds))
+			continue;
+
+		if (node.AmountMeshes == 0)
+		{
+			m_NodeStack.push_back(node.FirstChild + 1);
+			m_NodeStack.push_back(node.FirstChild);
+			continue;
+		}
+
+		// A leaf with a single mesh has the same box as it, so only the others get their meshes tested one by one
+		for (uint32_t i = node.FirstChild; i < node.FirstChild + node.AmountMeshes; ++i)
+		{
+			const uint32_t meshIdx = m_LeafMeshIdxs[i];
+			if (node.AmountMeshes == 1 || IsOutsideFrustum(m_MeshBounds[meshIdx]) == false)
+				m_VisibleMeshIdxs.push_back(meshIdx);
+		}
+	}
+
+	// Hand them over in the scene's order, so they're drawn just like they would be without the culling
+	std::sort(m_VisibleMeshIdxs.begin(), m_VisibleMeshIdxs.end());
+	for (const uint32_t meshIdx : m_VisibleMeshIdxs)
+		visibleMeshes.push_back(m_Meshes[meshIdx]);
+	stats.AmountFrustumCulledMeshes = stats.AmountMeshes - uint32_t(visibleMeshes.size());
+}
+
+AABB SceneBVH::TransformAABB(const AABB& box, const Elite::FMatrix4& transformMatrix)
+{
+	// Transform the center, and take the absolute of the matrix for the extents (so each new extent is as big as the old ones can reach along it)
+	const Elite::FPoint3 center{ (box.Min.x + box.Max.x) * 0.5f, (box.Min.y + box.Max.y) * 0.5f, (box.Min.z + box.Max.z) * 0.5f };
+	const Elite::FVector3 extents{ (box.Max.x - box.Min.x) * 0.5f, (box.Max.y - box.Min.y) * 0.5f, (box.Max.z - box.Min.z) * 0.5f };
+
+	AABB transformedBox{};
+	for (uint8_t row = 0; row < 3; ++row)
+	{
+		const float newCenter = transformMatrix(row, 0) * center.x + transformMatrix(row, 1) * center.y + transformMatrix(row, 2) * center.z + transformMatrix(row, 3);
+		const float newExtent = std::abs(transformMatrix(row, 0)) * extents.x + std::abs(transformMatrix(row, 1)) * extents.y + std::abs(transformMatrix(row, 2)) * extents.z;
+		transformedBox.Min[row] = newCenter - newExtent;
+		transformedBox.Max[row] = newCenter + newExtent;
+	}
+	return transformedBox;
+}
+
+void SceneBVH::Build()
+{
+	m_NeedsBuild = false;
+	m_Nodes.clear();
+	m_LeafMeshIdxs.clear();
+
+	// Every mesh's box gets worked out again, so none of them are dirty anymore
+	for (const uint32_t meshIdx : m_DirtyMeshIdxs)
+		m_MeshDirty[meshIdx] = 0;
+	m_DirtyMeshIdxs.clear();
+	if (m_Meshes.empty())
+		return;
+
+	for (uint32_t i = 0; i < uint32_t(m_Meshes.size()); ++i)
+	{
+		UpdateMeshBounds(i);
+		m_LeafMeshIdxs.push_back(i);
+	}
+
+	// A binary tree never has more than 2n - 1 nodes, so the nodes never move while it's being built
+	m_Nodes.reserve(m_Meshes.size() * 2);
+	m_Nodes.emplace_back();
+	BuildNode(0, 0, uint32_t(m_Meshes.size()), m_NoParent);
+}
+
+void SceneBVH::BuildNode(uint32_t nodeIdx, uint32_t firstMesh, uint32_t amountMeshes, uint32_t parent)
+{
+	// Get the box around all the node's meshes, and the one around just their centers
+	auto getCenter = [this](uint32_t meshIdx)
+	{
+		const AABB& bounds = m_MeshBounds[meshIdx];
+		return Elite::FPoint3{ (bounds.Min.x + bounds.Max.x) * 0.5f, (bounds.Min.y + bounds.Max.y) * 0.5f, (bounds.Min.z + bounds.Max.z) * 0.5f };
+	};
+
+	AABB bounds = m_MeshBounds[m_LeafMeshIdxs[firstMesh]];
+	AABB centerBounds{ getCenter(m_LeafMeshIdxs[firstMesh]), getCenter(m_LeafMeshIdxs[firstMesh]) };
+	for (uint32_t i = firstMesh + 1; i < firstMesh + amountMeshes; ++i)
+	{
+		bounds = GetUnion(bounds, m_MeshBounds[m_LeafMeshIdxs[i]]);
+		const Elite::FPoint3 center = getCenter(m_LeafMeshIdxs[i]);
+		centerBounds = GetUnion(centerBounds, AABB{ center, center });
+	}
+
+	Node& node = m_Nodes[nodeIdx];
+	node.Bounds = bounds;
+	node.Parent = parent;
+
+	// Few enough meshes make a leaf
+	if (amountMeshes <= m_MaxLeafMeshes)
+	{
+		node.FirstChild = firstMesh;
+		node.AmountMeshes = amountMeshes;
+		for (uint32_t i = firstMesh; i < firstMesh + amountMeshes; ++i)
+			m_MeshLeafs[m_LeafMeshIdxs[i]] = nodeIdx;
+		return;
+	}
+
+	// The rest get split in half, at the median of their centers along the axis they're the most spread out on
+	uint8_t axis = 0;
+	for (uint8_t i = 1; i < 3; ++i)
+	{
+		if (centerBounds.Max[i] - centerBounds.Min[i] > centerBounds.Max[axis] - centerBounds.Min[axis])
+			axis = i;
+	}
+
+	const uint32_t amountLeftMeshes = amountMeshes / 2;
+	const auto first = m_LeafMeshIdxs.begin() + firstMesh;
+	std::nth_element(first, first + amountLeftMeshes, first + amountMeshes, [&](uint32_t a, uint32_t b) { return getCenter(a)[axis] < getCenter(b)[axis]; });
+
+	const uint32_t firstChild = uint32_t(m_Nodes.size());
+	node.FirstChild = firstChild;
+	node.AmountMeshes = 0;
+	m_Nodes.emplace_back();
+	m_Nodes.emplace_back();
+	BuildNode(firstChild, firstMesh, amountLeftMeshes, nodeIdx);
+	BuildNode(firstChild + 1, firstMesh + amountLeftMeshes, amountMeshes - amountLeftMeshes, nodeIdx);
+}
+
+void SceneBVH::Refit()
+{
+	for (const uint32_t meshIdx : m_DirtyMeshIdxs)
+	{
+		m_MeshDirty[meshIdx] = 0;
+		UpdateMeshBounds(meshIdx);
+
+		// Work the boxes out again from the mesh's leaf up, until one of them stays the same (then the ones above it can't change either)
+		uint32_t nodeIdx = m_MeshLeafs[meshIdx];
+		while (nodeIdx != m_NoParent)
+		{
+			Node& node = m_Nodes[nodeIdx];
+			AABB bounds{};
+			if (node.AmountMeshes > 0)
+			{
+				bounds = m_MeshBounds[m_LeafMeshIdxs[node.FirstChild]];
+				for (uint32_t i = node.FirstChild + 1; i < node.FirstChild + node.AmountMeshes; ++i)
+					bounds = GetUnion(bounds, m_MeshBounds[m_LeafMeshIdxs[i]]);
+			}
+			else
+				bounds = GetUnion(m_Nodes[node.FirstChild].Bounds, m_Nodes[node.FirstChild + 1].Bounds);
+
+			if (memcmp(&bounds, &node.Bounds, sizeof(AABB)) == 0)
+				break;
+
+			node.Bounds = bounds;
+			nodeIdx = node.Parent;
+		}
+	}
+	m_DirtyMeshIdxs.clear();
+}
+
+void SceneBVH::UpdateMeshBounds(uint32_t meshIdx)
+{
+	const Mesh* pMesh = m_Meshes[meshIdx];
+	m_MeshBounds[meshIdx] = TransformAABB(pMesh->GetGeometry()->GetBounds(), pMesh->GetTransformMatrix(m_LeftHandCoordSystem));
+}
+
+bool SceneBVH::IsOutsideFrustum(const AABB& box) const
+{
+	// Bring the box into view space (as a box around the rotated one)
+	const AABB viewBox = TransformAABB(box, m_ViewMatrix);
+	const Elite::FPoint3 center{ (viewBox.Min.x + viewBox.Max.x) * 0.5f, (viewBox.Min.y + viewBox.Max.y) * 0.5f, (viewBox.Min.z + viewBox.Max.z) * 0.5f };
+	const Elite::FVector3 extents{ (viewBox.Max.x - viewBox.Min.x) * 0.5f, (viewBox.Max.y - viewBox.Min.y) * 0.5f, (viewBox.Max.z - viewBox.Min.z) * 0.5f };
+
+	// And check it against the near and far planes
+	const float depth = center.z * m_DepthSign;
+	if (depth + extents.z < m_NearPlane || depth - extents.z > m_FarPlane)
+		return true;
+
+	// And against the side planes: the box is outside a plane when its center is farther in front of it than the box reaches back along the plane's normal
+	if (std::abs(center.x) - m_TanHalfFovX * depth > extents.x + m_TanHalfFovX * extents.z)
+		return true;
+	if (std::abs(center.y) - m_TanHalfFovY * depth > extents.y + m_TanHalfFovY * extents.z)
+		return true;
+
+	return false;
+}
+
+AABB SceneBVH::GetUnion(const AABB& a, const AABB& b)
+{
+	return AABB{
+		Elite::FPoint3{ std::min(a.Min.x, b.Min.x), std::min(a.Min.y, b.Min.y), std::min(a.Min.z, b.Min.z) },
+		Elite::FPoint3{ std::max(a.Max.x, b.Max.x), std::max(a.Max.y, b.Max.y), std::max(a.Max.z, b.Max.z) } };
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+class Mesh;
+
+namespace Elite
+{
+	class ECamera;
+}
+
+// Axis aligned bounding box
+struct AABB
+{
+	Elite::FPoint3 Min;
+	Elite::FPoint3 Max;
+};
+
+// How many meshes a frame went over, and how many of them (and how much of the tree) the frustum culling had to look at
+struct SceneCullStats
+{
+	uint32_t AmountMeshes;
+	uint32_t AmountFrustumCulledMeshes;
+	uint32_t AmountVisitedNodes;
+};
+
+// Bounding volume hierarchy over a scene's meshes, by their world space boxes
+// It's built once the meshes are all in, and after that only refit: a mesh whose transform changes marks itself dirty,
+// and only its leaf and the nodes above it get their boxes worked out again (right before the next frame gets culled)
+class SceneBVH final
+{
+public:
+	SceneBVH();
+	~SceneBVH() = default;
+
+	SceneBVH(const SceneBVH& other) = delete;
+	SceneBVH(SceneBVH&& other) noexcept = delete;
+	SceneBVH& operator=(const SceneBVH& other) = delete;
+	SceneBVH& operator=(SceneBVH&& other) noexcept = delete;
+
+	void AddMesh(Mesh* pMesh);
+	void Clear();
+	void MarkDirty(uint32_t meshIdx);
+
+	// Lists the meshes whose box is (at least partly) inside the camera's frustum, in the order they were added
+	void GetVisibleMeshes(const Elite::ECamera* pCamera, float aspectRatio, bool leftHandCoordSystem, std::vector<Mesh*>& visibleMeshes, SceneCullStats& stats);
+
+	// The box around the transformed box (not as tight as transforming the vertices, but it's just 2 points)
+	static AABB TransformAABB(const AABB& box, const Elite::FMatrix4& transformMatrix);
+
+private:
+	struct Node
+	{
+		AABB Bounds;
+		uint32_t Parent;
+		uint32_t FirstChild; // The 2 children of an inner node are next to each other, and a leaf's meshes are next to each other in m_LeafMeshIdxs
+		uint32_t AmountMeshes; // 0 for an inner node
+	};
+
+	void Build();
+	void BuildNode(uint32_t nodeIdx, uint32_t firstMesh, uint32_t amountMeshes, uint32_t parent);
+	void Refit();
+	void UpdateMeshBounds(uint32_t meshIdx);
+	bool IsOutsideFrustum(const AABB& box) const;
+
+	static AABB GetUnion(const AABB& a, const AABB& b);
+
+	// Leaves hold a few meshes each, since testing a box is cheaper than going down one more level
+	static const uint32_t m_MaxLeafMeshes = 4;
+	static const uint32_t m_NoParent = UINT32_MAX;
+
+	std::vector<Mesh*> m_Meshes;
+	std::vector<AABB> m_MeshBounds;
+	std::vector<uint32_t> m_MeshLeafs;
+	std::vector<uint8_t> m_MeshDirty;
+	std::vector<uint32_t> m_DirtyMeshIdxs;
+	std::vector<Node> m_Nodes;
+	std::vector<uint32_t> m_LeafMeshIdxs;
+	bool m_NeedsBuild;
+	bool m_LeftHandCoordSystem; // Both modes have their own world space, so the boxes are for the mode they were last worked out in
+
+	// The frustum of the frame being culled, in view space
+	Elite::FMatrix4 m_ViewMatrix;
+	float m_DepthSign;
+	float m_TanHalfFovX, m_TanHalfFovY;
+	float m_NearPlane, m_FarPlane;
+
+	std::vector<uint32_t> m_NodeStack;
+	std::vector<uint32_t> m_VisibleMeshIdxs;
+};
@@ -15,6 +15,7 @@ ShadedMaterial::ShadedMaterial(ID3D11Device* pDevice, const std::wstring& assetF
 	, m_pAnisotropicTechniqueNoCull{}
 	, m_pDiffuseMapVariable{}
 	, m_pNormalMapVariable{}
+	, m_pNormalMapTwoChannelVariable{}
 	, m_pSpecularMapVariable{}
 	, m_pGlossinessMapVariable{}
 	, m_pMatWorldMatrixVariable{}
@@ -72,6 +73,10 @@ ShadedMaterial::ShadedMaterial(ID3D11Device* pDevice, const std::wstring& assetF
 		if (!m_pNormalMapVariable->IsValid())
 			std::wcout << L"m_pNormalMapVariable not valid\n";
 
+		m_pNormalMapTwoChannelVariable = m_pEffect->GetVariableByName("gNormalMapTwoChannel")->AsScalar();
+		if (!m_pNormalMapTwoChannelVariable->IsValid())
+			std::wcout << L"m_pNormalMapTwoChannelVariable not valid\n";
+
 		m_pSpecularMapVariable = m_pEffect->GetVariableByName("gSpecularMap")->AsShaderResource();
 		if (!m_pSpecularMapVariable->IsValid())
 			std::wcout << L"m_pSpecularMapVariable not valid\n";
@@ -192,6 +197,12 @@ ShadedMaterial::~ShadedMaterial()
 		m_pNormalMapVariable = nullptr;
 	}
 
+	if (m_pNormalMapTwoChannelVariable)
+	{
+		m_pNormalMapTwoChannelVariable->Release();
+		m_pNormalMapTwoChannelVariable = nullptr;
+	}
+
 	if (m_pSpecularMapVariable)
 	{
 		m_pSpecularMapVariable->Release();
@@ -235,6 +246,12 @@ void ShadedMaterial::SetNormalMap(ID3D11ShaderResourceView* pResourceView) const
 		m_pNormalMapVariable->SetResource(pResourceView);
 }
 
+void ShadedMaterial::SetNormalMapTwoChannel(bool isTwoChannel) const
+{
+	if (m_pNormalMapTwoChannelVariable->IsValid())
+		m_pNormalMapTwoChannelVariable->SetBool(isTwoChannel);
+}
+
 void ShadedMaterial::SetSpecularMap(ID3D11ShaderResourceView* pResourceView) const
 {
 	if (m_pSpecularMapVariable->IsValid())
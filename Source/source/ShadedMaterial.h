@@ -16,6 +16,7 @@ public:
 
 	void SetDiffuseMap(ID3D11ShaderResourceView* pResourceView) const override;
 	void SetNormalMap(ID3D11ShaderResourceView* pResourceView) const override;
+	void SetNormalMapTwoChannel(bool isTwoChannel) const override;
 	void SetSpecularMap(ID3D11ShaderResourceView* pResourceView) const override;
 	void SetGlossinessMap(ID3D11ShaderResourceView* pResourceView) const override;
 	void SetWorldMatrix(float* pMatrix) const override;
@@ -41,6 +42,7 @@ private:
 	ID3DX11EffectTechnique* m_pAnisotropicTechniqueNoCull;
 	ID3DX11EffectShaderResourceVariable* m_pDiffuseMapVariable;
 	ID3DX11EffectShaderResourceVariable* m_pNormalMapVariable;
+	ID3DX11EffectScalarVariable* m_pNormalMapTwoChannelVariable;
 	ID3DX11EffectShaderResourceVariable* m_pSpecularMapVariable;
 	ID3DX11EffectShaderResourceVariable* m_pGlossinessMapVariable;
 	ID3DX11EffectMatrixVariable* m_pMatWorldMatrixVariable;
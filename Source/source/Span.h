@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Non-owning view over a contiguous array (a minimal stand-in for C++20's std::span)
+// Lets the geometry be read in place by everyone, instead of being copied around
+template<typename T>
+class Span final
+{
+public:
+	Span()
+		: m_pData{ nullptr }
+		, m_Size{}
+	{
+	}
+
+	Span(T* pData, uint32_t size)
+		: m_pData{ pData }
+		, m_Size{ size }
+	{
+	}
+
+	T& operator[](size_t idx) const { return m_pData[idx]; }
+	T* begin() const { return m_pData; }
+	T* end() const { return m_pData + m_Size; }
+	T* data() const { return m_pData; }
+	uint32_t size() const { return m_Size; }
+	bool empty() const { return m_Size == 0; }
+
+private:
+	T* m_pData;
+	uint32_t m_Size;
+};
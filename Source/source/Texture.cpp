@@ -1,68 +1,194 @@
 #include "pch.h"
 #include "Texture.h"
 
+#include <atomic>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <immintrin.h>
+#include <iterator>
 #include <SDL_image.h>
 
-Texture::Texture(ID3D11Device* pDevice, const char* filePath)
+#include "ThreadPool.h"
+
+// Converts the 8 bit channels to floats with a single lookup (the values are exactly the same as dividing them by 255)
+struct UnormToFloatTable
+{
+	float Values[256];
+
+	UnormToFloatTable()
+	{
+		for (int i = 0; i < 256; ++i)
+			Values[i] = static_cast<float>(i) / 255.f;
+	}
+};
+static const UnormToFloatTable unormToFloat{};
+
+// The blocks each thread decoded last, so the Software Mode doesn't decode a block again for every texel it reads out of it
+// (the 4 texels of a bilinear probe, and the probes of the next few pixels, mostly land in the same block)
+// It's keyed on the blocks' addresses, which stay unique as long as no compressed texture gets freed, so freeing one flushes it
+struct DecodedBlockCache
+{
+	static const uint32_t m_AmountEntries = 256;
+	const uint8_t* pBlocks[m_AmountEntries];
+	uint32_t Texels[m_AmountEntries][16];
+	uint32_t Generation;
+};
+static thread_local DecodedBlockCache decodedBlockCache{};
+static std::atomic<uint32_t> decodedBlockCacheGeneration{ 0 };
+
+Texture::Texture(ID3D11Device* pDevice, const char* filePath, ThreadPool& threadPool, TextureFormat format)
 	: m_pTexture{}
 	, m_pTexResourceView{}
-	, m_Resource{} // aka, the surface
-	, m_ResourcePixel{}
+	, m_Format{ format }
+	, m_MipLevels{}
+	, m_pTexels{}
+	, m_pBlocks{}
 {
-	m_Resource = IMG_Load(filePath);
-	
-	if (m_Resource == nullptr)
+	// DDS files come block compressed already, with their mip chain, anything else is loaded as RGBA8 and compressed here (if asked to)
+	std::vector<std::vector<uint32_t>> levelPixels{};
+	std::vector<std::vector<uint8_t>> levelBlocks{};
+	const size_t pathLength = strlen(filePath);
+	if (pathLength >= 4 && _stricmp(filePath + pathLength - 4, ".dds") == 0)
 	{
-		std::cout << "Unable to load texture file into Surface\n";
+		if (!LoadDDS(filePath, levelBlocks))
+			return;
 	}
 	else
 	{
-		m_ResourcePixel = static_cast<uint32_t*> (m_Resource->pixels);
+		if (!LoadImage(filePath, threadPool, levelPixels))
+			return;
+
+		// DirectX only takes block compressed textures made out of whole blocks
+		if (m_Format != TextureFormat::RGBA8 && (GetWidth() % m_BlockSize != 0 || GetHeight() % m_BlockSize != 0))
+		{
+			std::cout << "Texture size isn't a multiple of 4, so it can't be block compressed\n";
+			m_Format = TextureFormat::RGBA8;
+		}
 
+		// Each row of blocks only depends on its own texels, so a level's rows can all be compressed at the same time, in bands spread over the threads
+		if (m_Format != TextureFormat::RGBA8)
+		{
+			levelBlocks.resize(m_MipLevels.size());
+			for (size_t i = 0; i < m_MipLevels.size(); ++i)
+			{
+				const MipLevel& level = m_MipLevels[i];
+				const uint32_t amountBlocksY = (level.Height + m_BlockSize - 1) / m_BlockSize;
+				levelBlocks[i].resize(size_t(level.AmountBlocksX) * amountBlocksY * BlockCompression::GetBlockBytes(m_Format));
 
-		D3D11_TEXTURE2D_DESC desc;
-		desc.Width = m_Resource->w;
-		desc.Height = m_Resource->h;
-		desc.MipLevels = 1;
-		desc.ArraySize = 1;
-		desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-		desc.SampleDesc.Count = 1;
-		desc.SampleDesc.Quality = 0;
-		desc.Usage = D3D11_USAGE_DEFAULT;
-		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-		desc.CPUAccessFlags = 0;
-		desc.MiscFlags = 0;
+				const uint32_t amountBands = GetAmountBands(amountBlocksY, threadPool);
+				threadPool.ParallelFor(amountBands, [&](uint32_t bandIdx)
+				{
+					EncodeLevel(m_Format, levelPixels[i].data(), level.Width, level.Height, levelBlocks[i].data(), amountBlocksY * bandIdx / amountBands,
+						amountBlocksY * (bandIdx + 1) / amountBands);
+				});
+			}
+		}
+	}
+	const auto amountMipLevels = uint32_t(m_MipLevels.size());
 
-		D3D11_SUBRESOURCE_DATA initData;
-		initData.pSysMem = m_Resource->pixels;
-		initData.SysMemPitch = static_cast<UINT>(m_Resource->pitch);
-		initData.SysMemSlicePitch = static_cast<UINT>(m_Resource->h * m_Resource->pitch);
 
-		HRESULT hr = pDevice->CreateTexture2D(&desc, &initData, &m_pTexture);
-		if (FAILED(hr))
-			std::cout << "Unable to create Texture2D\n";
+	D3D11_TEXTURE2D_DESC desc;
+	desc.Width = GetWidth();
+	desc.Height = GetHeight();
+	desc.MipLevels = amountMipLevels;
+	desc.ArraySize = 1;
+	desc.Format = BlockCompression::GetDXGIFormat(m_Format);
+	desc.SampleDesc.Count = 1;
+	desc.SampleDesc.Quality = 0;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	desc.CPUAccessFlags = 0;
+	desc.MiscFlags = 0;
 
-		// We don't release surface in the initializer anymore, as we need it for the software mode
-		// SDL_FreeSurface(m_Resource);
+	// The BCn levels are uploaded as they are, their pitch being a row of blocks
+	std::vector<D3D11_SUBRESOURCE_DATA> initData(amountMipLevels);
+	for (uint32_t i = 0; i < amountMipLevels; ++i)
+	{
+		if (m_Format == TextureFormat::RGBA8)
+		{
+			initData[i].pSysMem = levelPixels[i].data();
+			initData[i].SysMemPitch = static_cast<UINT>(m_MipLevels[i].Width * sizeof(uint32_t));
+			initData[i].SysMemSlicePitch = static_cast<UINT>(levelPixels[i].size() * sizeof(uint32_t));
+		}
+		else
+		{
+			initData[i].pSysMem = levelBlocks[i].data();
+			initData[i].SysMemPitch = static_cast<UINT>(m_MipLevels[i].AmountBlocksX * BlockCompression::GetBlockBytes(m_Format));
+			initData[i].SysMemSlicePitch = static_cast<UINT>(levelBlocks[i].size());
+		}
+	}
+
+	HRESULT hr = pDevice->CreateTexture2D(&desc, initData.data(), &m_pTexture);
+	if (FAILED(hr))
+		std::cout << "Unable to create Texture2D\n";
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC SRVDesc{};
+	SRVDesc.Format = desc.Format;
+	SRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	SRVDesc.Texture2D.MipLevels = amountMipLevels;
+
+	if (m_pTexture)
+		hr = pDevice->CreateShaderResourceView(m_pTexture, &SRVDesc, &m_pTexResourceView);
 
-		D3D11_SHADER_RESOURCE_VIEW_DESC SRVDesc{};
-		SRVDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-		SRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-		SRVDesc.Texture2D.MipLevels = 1;
+	if (FAILED(hr))
+		std::cout << "Unable to create Shader Resource View\n";
 
-		if (m_pTexture)
-			hr = pDevice->CreateShaderResourceView(m_pTexture, &SRVDesc, &m_pTexResourceView);
 
-		if (FAILED(hr))
-			std::cout << "Unable to create Shader Resource View\n";
+	// The Software Mode keeps the BCn blocks compressed, all levels one after the other, and decodes them as it samples
+	if (m_Format != TextureFormat::RGBA8)
+	{
+		size_t amountBytes = 0;
+		for (const auto& blocks : levelBlocks)
+			amountBytes += blocks.size();
+		m_pBlocks = static_cast<uint8_t*>(_mm_malloc(amountBytes, 64));
+
+		uint8_t* pLevelBlocks = m_pBlocks;
+		for (uint32_t i = 0; i < amountMipLevels; ++i)
+		{
+			std::copy(levelBlocks[i].begin(), levelBlocks[i].end(), pLevelBlocks);
+			m_MipLevels[i].pBlocks = pLevelBlocks;
+			pLevelBlocks += levelBlocks[i].size();
+		}
+		return;
+	}
+
+	// Swizzle the texels of every level into 4x4 blocks for the Software Mode (the edges are padded up to a whole block)
+	size_t amountTexels = 0;
+	for (const auto& level : m_MipLevels)
+		amountTexels += size_t(level.AmountBlocksX) * ((level.Height + m_BlockSize - 1) / m_BlockSize) * m_BlockSize * m_BlockSize;
+	m_pTexels = static_cast<uint32_t*>(_mm_malloc(amountTexels * sizeof(uint32_t), 64));
+	std::fill(m_pTexels, m_pTexels + amountTexels, 0u);
+
+	uint32_t* pLevelTexels = m_pTexels;
+	for (uint32_t i = 0; i < amountMipLevels; ++i)
+	{
+		MipLevel& level = m_MipLevels[i];
+		level.pTexels = pLevelTexels;
+		for (uint32_t y = 0; y < level.Height; ++y)
+		{
+			for (uint32_t x = 0; x < level.Width; ++x)
+				level.pTexels[GetTexelIdx(level, x, y)] = levelPixels[i][x + size_t(y) * level.Width];
+		}
+		pLevelTexels += size_t(level.AmountBlocksX) * ((level.Height + m_BlockSize - 1) / m_BlockSize) * m_BlockSize * m_BlockSize;
 	}
 }
 
 Texture::~Texture()
 {
-	SDL_FreeSurface(m_Resource);
-	m_Resource = nullptr;
+	if (m_pTexels)
+	{
+		_mm_free(m_pTexels);
+		m_pTexels = nullptr;
+	}
+
+	// Some thread might still have these blocks cached, and the next texture could get the same addresses
+	if (m_pBlocks)
+	{
+		decodedBlockCacheGeneration++;
+		_mm_free(m_pBlocks);
+		m_pBlocks = nullptr;
+	}
 	
 	if (m_pTexture)
 	{
@@ -77,38 +203,405 @@ Texture::~Texture()
 	}
 }
 
-Elite::RGBColor Texture::Sample(const Elite::FVector2& uv) const
+bool Texture::LoadImage(const char* filePath, ThreadPool& threadPool, std::vector<std::vector<uint32_t>>& levelPixels)
 {
-	const auto width = m_Resource->w;
-	const auto height = m_Resource->h;
-	const auto col = int(uv.x * width);
-	const auto row = int(uv.y * height);
-	const Uint32 pixelCoord = col + (row * width);
+	SDL_Surface* pLoadedSurface = IMG_Load(filePath);
+	
+	if (pLoadedSurface == nullptr)
+	{
+		std::cout << "Unable to load texture file into Surface\n";
+		return false;
+	}
+
+	// Bring the image to RGBA8, no matter what format it was stored in (that's what the DirectX texture expects too)
+	SDL_Surface* pSurface = SDL_ConvertSurfaceFormat(pLoadedSurface, SDL_PIXELFORMAT_RGBA32, 0);
+	SDL_FreeSurface(pLoadedSurface);
+	if (pSurface == nullptr)
+	{
+		std::cout << "Unable to convert texture Surface to RGBA8\n";
+		return false;
+	}
 
-	Uint8 r{}, g{}, b{};
+	// Set up the whole mip chain, halving the size every level down to 1x1
+	const auto width = static_cast<uint32_t>(pSurface->w);
+	const auto height = static_cast<uint32_t>(pSurface->h);
+	for (uint32_t levelWidth = width, levelHeight = height; ; levelWidth = std::max(levelWidth / 2, 1u), levelHeight = std::max(levelHeight / 2, 1u))
+	{
+		m_MipLevels.push_back(MipLevel{ levelWidth, levelHeight, (levelWidth + m_BlockSize - 1) / m_BlockSize, nullptr, nullptr });
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+	}
+	const auto amountMipLevels = uint32_t(m_MipLevels.size());
 
-	const Uint32 size = height * width;
-	if (pixelCoord < size)
-		SDL_GetRGB(m_ResourcePixel[pixelCoord], m_Resource->format, &r, &g, &b);
+	// Copy the full size level out of the surface, and then box filter every other level out of the one above it
+	// (so each level only reads the texels of the one above it, and the whole chain reads about a third more texels than the full size level has)
+	levelPixels.resize(amountMipLevels);
+	levelPixels[0].resize(size_t(width) * height);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const auto* pRow = reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(pSurface->pixels) + y * size_t(pSurface->pitch));
+		std::copy(pRow, pRow + width, levelPixels[0].data() + size_t(y) * width);
+	}
+	SDL_FreeSurface(pSurface);
+
+	// The rows of a level only depend on the level above it, so they're generated in bands spread over the threads
+	for (uint32_t i = 1; i < amountMipLevels; ++i)
+	{
+		const MipLevel& source = m_MipLevels[i - 1];
+		const MipLevel& level = m_MipLevels[i];
+		levelPixels[i].resize(size_t(level.Width) * level.Height);
+
+		const uint32_t amountBands = GetAmountBands(level.Height, threadPool);
+		threadPool.ParallelFor(amountBands, [&](uint32_t bandIdx)
+		{
+			GenerateMipLevel(levelPixels[i - 1].data(), source.Width, source.Height, levelPixels[i].data(), level.Width, level.Height, level.Height * bandIdx / amountBands,
+				level.Height * (bandIdx + 1) / amountBands);
+		});
+	}
 
-	return Elite::RGBColor{ static_cast<float>(r) / 255.f, static_cast<float>(g) / 255.f, static_cast<float>(b) / 255.f };
+	return true;
 }
 
-Elite::FVector4 Texture::SampleWTransparency(const Elite::FVector2& uv) const
+bool Texture::LoadDDS(const char* filePath, std::vector<std::vector<uint8_t>>& levelBlocks)
 {
-	const auto width = m_Resource->w;
-	const auto height = m_Resource->h;
-	const auto col = int(uv.x * width);
-	const auto row = int(uv.y * height);
-	const Uint32 pixelCoord = col + (row * width);
+	std::ifstream file{ filePath, std::ios::binary };
+	if (!file)
+	{
+		std::cout << "Unable to open DDS texture file\n";
+		return false;
+	}
+	const std::vector<uint8_t> data{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
 
-	Uint8 r{}, g{}, b{}, a{};
-	
-	const Uint32 size = height * width;
-	if (pixelCoord < size)
-		SDL_GetRGBA(m_ResourcePixel[pixelCoord], m_Resource->format, &r, &g, &b, &a);
+	// The file starts with "DDS ", followed by a 124 byte header made out of 32-bit fields
+	const size_t headerEnd = 4 + 124;
+	if (data.size() < headerEnd || memcmp(data.data(), "DDS ", 4) != 0)
+	{
+		std::cout << "Texture file isn't a DDS file\n";
+		return false;
+	}
+	const auto readField = [&data](size_t offset)
+	{
+		uint32_t value{};
+		memcpy(&value, data.data() + offset, sizeof(value));
+		return value;
+	};
+	const auto makeFourCC = [](const char* pCode)
+	{
+		return uint32_t(uint8_t(pCode[0])) | (uint32_t(uint8_t(pCode[1])) << 8) | (uint32_t(uint8_t(pCode[2])) << 16) | (uint32_t(uint8_t(pCode[3])) << 24);
+	};
+	const uint32_t flags = readField(4 + 4);
+	const uint32_t height = readField(4 + 8);
+	const uint32_t width = readField(4 + 12);
+	const uint32_t amountFileLevels = (flags & 0x20000) ? std::max(readField(4 + 24), 1u) : 1u; // DDSD_MIPMAPCOUNT
+	const uint32_t fourCC = readField(4 + 80);
 
-	return Elite::FVector4{ static_cast<float>(r) / 255.f, static_cast<float>(g) / 255.f, static_cast<float>(b) / 255.f,  static_cast<float>(a) / 255.f };
+	// The format is either in the pixel format's FourCC code, or in the DXGI format of the extra DX10 header that follows it
+	size_t offset = headerEnd;
+	if (fourCC == makeFourCC("DXT1"))
+		m_Format = TextureFormat::BC1;
+	else if (fourCC == makeFourCC("DXT5"))
+		m_Format = TextureFormat::BC3;
+	else if (fourCC == makeFourCC("ATI2") || fourCC == makeFourCC("BC5U"))
+		m_Format = TextureFormat::BC5;
+	else if (fourCC == makeFourCC("DX10") && data.size() >= headerEnd + 20)
+	{
+		const uint32_t dxgiFormat = readField(headerEnd);
+		offset += 20;
+		if (dxgiFormat == DXGI_FORMAT_BC1_UNORM)
+			m_Format = TextureFormat::BC1;
+		else if (dxgiFormat == DXGI_FORMAT_BC3_UNORM)
+			m_Format = TextureFormat::BC3;
+		else if (dxgiFormat == DXGI_FORMAT_BC5_UNORM)
+			m_Format = TextureFormat::BC5;
+		else
+			m_Format = TextureFormat::RGBA8;
+	}
+	else
+		m_Format = TextureFormat::RGBA8;
+
+	if (m_Format == TextureFormat::RGBA8)
+	{
+		std::cout << "DDS texture file isn't BC1, BC3 or BC5\n";
+		return false;
+	}
+
+	if (width == 0 || height == 0 || width % m_BlockSize != 0 || height % m_BlockSize != 0)
+	{
+		std::cout << "DDS texture size isn't a multiple of 4\n";
+		return false;
+	}
+
+	// And then every level's blocks, row by row, from the full size one down
+	const uint32_t blockBytes = BlockCompression::GetBlockBytes(m_Format);
+	for (uint32_t levelWidth = width, levelHeight = height; m_MipLevels.size() < amountFileLevels; levelWidth = std::max(levelWidth / 2, 1u), levelHeight = std::max(levelHeight / 2, 1u))
+	{
+		const uint32_t amountBlocksX = (levelWidth + m_BlockSize - 1) / m_BlockSize;
+		const size_t levelBytes = size_t(amountBlocksX) * ((levelHeight + m_BlockSize - 1) / m_BlockSize) * blockBytes;
+		if (offset + levelBytes > data.size())
+		{
+			std::cout << "DDS texture file is missing some of its mip levels\n";
+			m_MipLevels.clear();
+			levelBlocks.clear();
+			return false;
+		}
+
+		m_MipLevels.push_back(MipLevel{ levelWidth, levelHeight, amountBlocksX, nullptr, nullptr });
+		levelBlocks.emplace_back(data.begin() + offset, data.begin() + offset + levelBytes);
+		offset += levelBytes;
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+	}
+	return true;
 }
 
+void Texture::GenerateMipLevel(const uint32_t* pSource, uint32_t sourceWidth, uint32_t sourceHeight, uint32_t* pDestination, uint32_t width, uint32_t height, uint32_t firstRow,
+	uint32_t lastRow)
+{
+	// Every texel is the average of all the source level's texels it covers (a box filter)
+	for (uint32_t y = firstRow; y < lastRow; ++y)
+	{
+		const uint32_t minY = y * sourceHeight / height;
+		const uint32_t maxY = std::max(minY + 1, (y + 1) * sourceHeight / height);
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			const uint32_t minX = x * sourceWidth / width;
+			const uint32_t maxX = std::max(minX + 1, (x + 1) * sourceWidth / width);
+
+			uint64_t sums[4]{};
+			for (uint32_t sourceY = minY; sourceY < maxY; ++sourceY)
+			{
+				for (uint32_t sourceX = minX; sourceX < maxX; ++sourceX)
+				{
+					const uint32_t texel = pSource[sourceX + size_t(sourceY) * sourceWidth];
+					for (uint32_t channel = 0; channel < 4; ++channel)
+						sums[channel] += (texel >> (channel * 8)) & 0xFF;
+				}
+			}
+
+			// Rounded to the closest 8 bit value
+			const uint64_t amountTexels = uint64_t(maxX - minX) * (maxY - minY);
+			uint32_t texel = 0;
+			for (uint32_t channel = 0; channel < 4; ++channel)
+				texel |= uint32_t((sums[channel] + amountTexels / 2) / amountTexels) << (channel * 8);
+			pDestination[x + size_t(y) * width] = texel;
+		}
+	}
+}
 
+void Texture::EncodeLevel(TextureFormat format, const uint32_t* pPixels, uint32_t width, uint32_t height, uint8_t* pBlocks, uint32_t firstBlockRow, uint32_t lastBlockRow)
+{
+	// Gather the texels of every 4x4 block (repeating the edge texels in the levels smaller than a block) and compress them
+	const uint32_t blockBytes = BlockCompression::GetBlockBytes(format);
+	const uint32_t amountBlocksX = (width + m_BlockSize - 1) / m_BlockSize;
+	uint32_t blockTexels[m_BlockSize * m_BlockSize];
+	for (uint32_t blockY = firstBlockRow; blockY < lastBlockRow; ++blockY)
+	{
+		for (uint32_t blockX = 0; blockX < amountBlocksX; ++blockX)
+		{
+			for (uint32_t y = 0; y < m_BlockSize; ++y)
+			{
+				const uint32_t sourceY = std::min(blockY * m_BlockSize + y, height - 1);
+				for (uint32_t x = 0; x < m_BlockSize; ++x)
+					blockTexels[x + y * m_BlockSize] = pPixels[std::min(blockX * m_BlockSize + x, width - 1) + size_t(sourceY) * width];
+			}
+			BlockCompression::EncodeBlock(format, blockTexels, pBlocks + (blockX + size_t(blockY) * amountBlocksX) * blockBytes);
+		}
+	}
+}
+
+uint32_t Texture::GetAmountBands(uint32_t amountRows, const ThreadPool& threadPool)
+{
+	// A few bands per thread, so the threads that finish first can pick up the rest (but never a band without any rows)
+	return std::max(1u, std::min(amountRows, threadPool.GetAmountThreads() * 4));
+}
+
+Elite::FVector4 Texture::SamplePoint(const Elite::FVector2& uv, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy) const
+{
+	if (m_MipLevels.empty())
+		return Elite::FVector4{ 0.f, 0.f, 0.f, 0.f };
+
+	// Just the closest texel of the closest level
+	const MipLevel& level = m_MipLevels[GetPointFootprint(GetWidth(), GetHeight(), GetAmountMipLevels(), uvDx, uvDy).LevelIdx];
+	const float x = Elite::Clamp(uv.x * level.Width, -1.f, static_cast<float>(level.Width));
+	const float y = Elite::Clamp(uv.y * level.Height, -1.f, static_cast<float>(level.Height));
+	const uint32_t texel = GetTexel(level, static_cast<int>(floorf(x)), static_cast<int>(floorf(y)));
+	return Elite::FVector4{ unormToFloat.Values[texel & 0xFF], unormToFloat.Values[(texel >> 8) & 0xFF], unormToFloat.Values[(texel >> 16) & 0xFF],
+		unormToFloat.Values[texel >> 24] };
+}
+
+Elite::FVector4 Texture::SampleTrilinear(const Elite::FVector2& uv, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy) const
+{
+	if (m_MipLevels.empty())
+		return Elite::FVector4{ 0.f, 0.f, 0.f, 0.f };
+
+	return SampleFootprint(GetTrilinearFootprint(GetWidth(), GetHeight(), GetAmountMipLevels(), uvDx, uvDy), uv);
+}
+
+Elite::FVector4 Texture::SampleAnisotropic(const Elite::FVector2& uv, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy) const
+{
+	if (m_MipLevels.empty())
+		return Elite::FVector4{ 0.f, 0.f, 0.f, 0.f };
+
+	return SampleFootprint(GetAnisotropicFootprint(GetWidth(), GetHeight(), GetAmountMipLevels(), uvDx, uvDy), uv);
+}
+
+Texture::Footprint Texture::GetPointFootprint(uint32_t width, uint32_t height, uint32_t amountMipLevels, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy)
+{
+	// The closest level, without blending in the next one
+	Footprint footprint = MakeFootprint(GetLevelOfDetail(width, height, uvDx, uvDy) + 0.5f, amountMipLevels, 1, Elite::FVector2{});
+	footprint.LevelBlend = 0.f;
+	return footprint;
+}
+
+Texture::Footprint Texture::GetTrilinearFootprint(uint32_t width, uint32_t height, uint32_t amountMipLevels, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy)
+{
+	return MakeFootprint(GetLevelOfDetail(width, height, uvDx, uvDy), amountMipLevels, 1, Elite::FVector2{});
+}
+
+Texture::Footprint Texture::GetAnisotropicFootprint(uint32_t width, uint32_t height, uint32_t amountMipLevels, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy)
+{
+	// The pixel covers a stretched area of the texture: take a few probes along its long axis, each from the level that fits its short axis
+	const float lengthX = Elite::Magnitude(Elite::FVector2{ uvDx.x * width, uvDx.y * height });
+	const float lengthY = Elite::Magnitude(Elite::FVector2{ uvDy.x * width, uvDy.y * height });
+	const float majorLength = std::max(lengthX, lengthY);
+	const float minorLength = std::min(lengthX, lengthY);
+	const Elite::FVector2& majorAxis = (lengthX >= lengthY) ? uvDx : uvDy;
+
+	uint32_t amountProbes = 1;
+	if (minorLength * m_MaxAnisotropy < majorLength)
+		amountProbes = m_MaxAnisotropy;
+	else if (minorLength > 0.f)
+		amountProbes = static_cast<uint32_t>(ceilf(majorLength / minorLength));
+	const float lod = (majorLength > 0.f) ? log2f(majorLength / amountProbes) : 0.f;
+
+	// The probes are spread evenly over the long axis
+	const float probeSpacing = 1.f / amountProbes;
+	return MakeFootprint(lod, amountMipLevels, amountProbes, Elite::FVector2{ majorAxis.x * probeSpacing, majorAxis.y * probeSpacing });
+}
+
+void Texture::GetBilinearWeights(uint32_t levelWidth, uint32_t levelHeight, const Elite::FVector2& uv, int& x0, int& y0, __m128i& topWeights, __m128i& bottomWeights)
+{
+	// Find the 4 texel centers around the sample point (the address modes take care of the ones past the edges)
+	const float x = Elite::Clamp(uv.x * levelWidth - 0.5f, -1.f, static_cast<float>(levelWidth));
+	const float y = Elite::Clamp(uv.y * levelHeight - 0.5f, -1.f, static_cast<float>(levelHeight));
+	const float floorX = floorf(x);
+	const float floorY = floorf(y);
+	x0 = static_cast<int>(floorX);
+	y0 = static_cast<int>(floorY);
+
+	// The blend factors in fixed point, so each texel's weight is an integer and the 4 weights add up to exactly 1 << (2 * m_WeightBits)
+	const int weightOne = 1 << m_WeightBits;
+	const auto blendX = static_cast<int>((x - floorX) * weightOne + 0.5f);
+	const auto blendY = static_cast<int>((y - floorY) * weightOne + 0.5f);
+	topWeights = _mm_set1_epi32(((weightOne - blendX) * (weightOne - blendY)) | ((blendX * (weightOne - blendY)) << 16));
+	bottomWeights = _mm_set1_epi32(((weightOne - blendX) * blendY) | ((blendX * blendY) << 16));
+}
+
+float Texture::GetLevelOfDetail(uint32_t width, uint32_t height, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy)
+{
+	// The level where one pixel step covers a single full size texel, along the screen axis that covers the most (negative when magnified)
+	const auto widthF = static_cast<float>(width);
+	const auto heightF = static_cast<float>(height);
+	const float squaredStepX = (uvDx.x * widthF) * (uvDx.x * widthF) + (uvDx.y * heightF) * (uvDx.y * heightF);
+	const float squaredStepY = (uvDy.x * widthF) * (uvDy.x * widthF) + (uvDy.y * heightF) * (uvDy.y * heightF);
+	const float squaredStep = std::max(squaredStepX, squaredStepY);
+
+	// Without derivatives (mipmaps off), it's always the full size level
+	return (squaredStep > 0.f) ? 0.5f * log2f(squaredStep) : 0.f;
+}
+
+Texture::Footprint Texture::MakeFootprint(float lod, uint32_t amountMipLevels, uint32_t amountProbes, const Elite::FVector2& probeStep)
+{
+	// Magnified (or no derivatives): just the full size level, and smaller than the smallest level: just the 1x1 one
+	// Otherwise blend between the two closest levels
+	const uint32_t lastLevel = amountMipLevels - 1;
+	Footprint footprint{};
+	footprint.LevelIdx = (lod > 0.f) ? std::min(static_cast<uint32_t>(lod), lastLevel) : 0;
+	footprint.LevelBlend = (lod > 0.f && footprint.LevelIdx < lastLevel) ? lod - static_cast<float>(footprint.LevelIdx) : 0.f;
+	footprint.AmountProbes = amountProbes;
+	footprint.ProbeStep = probeStep;
+	footprint.SumScale = 1.f / (255.f * (1 << (2 * m_WeightBits)) * amountProbes);
+	return footprint;
+}
+
+uint32_t Texture::GetTexel(const MipLevel& level, int x, int y) const
+{
+	// AddressU = Border: anything left or right of the texture is the border color
+	if (static_cast<uint32_t>(x) >= level.Width)
+		return m_BorderTexel;
+
+	// AddressV = Clamp: anything above or below it repeats the closest edge row
+	const int maxY = static_cast<int>(level.Height) - 1;
+	const int clampedY = Elite::Clamp(y, 0, maxY);
+
+	// The block compressed formats get decoded on the fly
+	if (m_Format != TextureFormat::RGBA8)
+		return GetDecodedTexel(level, x, clampedY);
+	return level.pTexels[GetTexelIdx(level, x, clampedY)];
+}
+
+uint32_t Texture::GetTexelIdx(const MipLevel& level, uint32_t x, uint32_t y) const
+{
+	// Find the block, and then the texel inside it
+	const uint32_t blockIdx = (x / m_BlockSize) + (y / m_BlockSize) * level.AmountBlocksX;
+	return blockIdx * (m_BlockSize * m_BlockSize) + (y % m_BlockSize) * m_BlockSize + (x % m_BlockSize);
+}
+
+uint32_t Texture::GetDecodedTexel(const MipLevel& level, uint32_t x, uint32_t y) const
+{
+	const uint8_t* pBlock = level.pBlocks + ((x / m_BlockSize) + size_t(y / m_BlockSize) * level.AmountBlocksX) * BlockCompression::GetBlockBytes(m_Format);
+
+	DecodedBlockCache& cache = decodedBlockCache;
+	const uint32_t generation = decodedBlockCacheGeneration.load(std::memory_order_relaxed);
+	if (cache.Generation != generation)
+	{
+		std::fill(cache.pBlocks, cache.pBlocks + DecodedBlockCache::m_AmountEntries, nullptr);
+		cache.Generation = generation;
+	}
+
+	// The address is hashed down to the 8 bits of an entry (instead of just taking its low bits), so the blocks right above and below each other don't keep evicting each other
+	const auto entryIdx = static_cast<uint32_t>((static_cast<uint32_t>(reinterpret_cast<uintptr_t>(pBlock) >> 3) * 2654435761u) >> 24);
+	if (cache.pBlocks[entryIdx] != pBlock)
+	{
+		BlockCompression::DecodeBlock(m_Format, pBlock, cache.Texels[entryIdx]);
+		cache.pBlocks[entryIdx] = pBlock;
+	}
+	return cache.Texels[entryIdx][(y % m_BlockSize) * m_BlockSize + (x % m_BlockSize)];
+}
+
+__m128i Texture::SampleBilinear(const MipLevel& level, const Elite::FVector2& uv) const
+{
+	int x0{}, y0{};
+	__m128i topWeights{}, bottomWeights{};
+	GetBilinearWeights(level.Width, level.Height, uv, x0, y0, topWeights, bottomWeights);
+
+	// Interleave the channels of the left and right texel of a row in 16-bit lanes (r0 r1 g0 g1 b0 b1 a0 a1),
+	// so a single multiply-add weighs and sums the whole row, giving its 4 channels as 32-bit integers
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i topRow = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(int(GetTexel(level, x0, y0))), _mm_cvtsi32_si128(int(GetTexel(level, x0 + 1, y0)))), zero);
+	const __m128i bottomRow = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(int(GetTexel(level, x0, y0 + 1))), _mm_cvtsi32_si128(int(GetTexel(level, x0 + 1, y0 + 1)))), zero);
+	return _mm_add_epi32(_mm_madd_epi16(topRow, topWeights), _mm_madd_epi16(bottomRow, bottomWeights));
+}
+
+Elite::FVector4 Texture::SampleFootprint(const Footprint& footprint, const Elite::FVector2& uv) const
+{
+	// The probes' fixed point sums are simply added up (16 probes of 255 << 14 still fit in 32 bits), for both levels
+	__m128i sum = _mm_setzero_si128();
+	__m128i nextLevelSum = _mm_setzero_si128();
+	for (uint32_t i = 0; i < footprint.AmountProbes; ++i)
+	{
+		const Elite::FVector2 probeUV = footprint.GetProbeUV(uv, i);
+		sum = _mm_add_epi32(sum, SampleBilinear(m_MipLevels[footprint.LevelIdx], probeUV));
+		if (footprint.LevelBlend > 0.f)
+			nextLevelSum = _mm_add_epi32(nextLevelSum, SampleBilinear(m_MipLevels[footprint.LevelIdx + 1], probeUV));
+	}
+
+	__m128 result = _mm_cvtepi32_ps(sum);
+	if (footprint.LevelBlend > 0.f)
+		result = _mm_add_ps(result, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(nextLevelSum), result), _mm_set1_ps(footprint.LevelBlend)));
+
+	// Average the probes, and bring the fixed point sums back to [0, 1]
+	alignas(16) float channels[4];
+	_mm_store_ps(channels, _mm_mul_ps(result, _mm_set1_ps(footprint.SumScale)));
+	return Elite::FVector4{ channels[0], channels[1], channels[2], channels[3] };
+}
@@ -1,12 +1,19 @@
 #pragma once
-#include <SDL_surface.h>
+#include <emmintrin.h>
+#include <vector>
+
 #include "EMath.h"
 #include "ERGBColor.h"
+#include "BlockCompression.h"
+
+class ThreadPool;
 
 class Texture
 {
 public:
-	Texture(ID3D11Device* pDevice, const char* filePath);
+	// Images get compressed to the given format when they're loaded, while DDS files are already block compressed (and keep their own format and mip chain)
+	// The mip chain generation and the compression are spread over the thread pool's threads
+	Texture(ID3D11Device* pDevice, const char* filePath, ThreadPool& threadPool, TextureFormat format = TextureFormat::RGBA8);
 	~Texture();
 
 	Texture(const Texture& other) = delete;
@@ -15,13 +22,80 @@ public:
 	Texture& operator=(Texture&& other) noexcept = delete;
 
 	ID3D11ShaderResourceView* GetResourceView() const { return m_pTexResourceView; }
+	TextureFormat GetFormat() const { return m_Format; }
+
+	// The Software Mode versions of the samplers in PosCol3D.fx (MIN_MAG_MIP_POINT, MIN_MAG_MIP_LINEAR and ANISOTROPIC, all with AddressU = Border and AddressV = Clamp)
+	// The UV derivatives are the UV steps to the next pixel on the screen, which pick the mip level (with no derivatives, only the full size level is read)
+	Elite::FVector4 SamplePoint(const Elite::FVector2& uv, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy) const;
+	Elite::FVector4 SampleTrilinear(const Elite::FVector2& uv, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy) const;
+	Elite::FVector4 SampleAnisotropic(const Elite::FVector2& uv, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy) const;
+
+	uint32_t GetAmountMipLevels() const { return uint32_t(m_MipLevels.size()); }
+	uint32_t GetWidth(uint32_t levelIdx = 0) const { return m_MipLevels[levelIdx].Width; }
+	uint32_t GetHeight(uint32_t levelIdx = 0) const { return m_MipLevels[levelIdx].Height; }
+	// The raw RGBA8 texel (decoded, if the texture is block compressed), to bake the texture into other formats
+	uint32_t GetLevelTexel(uint32_t levelIdx, uint32_t x, uint32_t y) const { return GetTexel(m_MipLevels[levelIdx], static_cast<int>(x), static_cast<int>(y)); }
+	static uint32_t GetBorderTexel() { return m_BorderTexel; }
+
+	// Which texels one pixel's sample reads: one or two neighbouring mip levels, and one or more bilinear probes spread along the pixel's footprint
+	// MaterialTexture filters through these too, so both always pick the exact same texels
+	struct Footprint
+	{
+		uint32_t LevelIdx;
+		float LevelBlend; // How much of the next level gets blended in
+		uint32_t AmountProbes;
+		Elite::FVector2 ProbeStep; // The UV step from one probe to the next (they're centered on the sample point)
+		float SumScale; // Brings the fixed point sum of all the probes back to [0, 1]
 
-	Elite::RGBColor Sample(const Elite::FVector2& uv) const;
-	Elite::FVector4 SampleWTransparency(const Elite::FVector2& uv) const;
+		Elite::FVector2 GetProbeUV(const Elite::FVector2& uv, uint32_t probeIdx) const
+		{
+			const float offset = static_cast<float>(probeIdx) - 0.5f * static_cast<float>(AmountProbes - 1);
+			return Elite::FVector2{ uv.x + ProbeStep.x * offset, uv.y + ProbeStep.y * offset };
+		}
+	};
+	static Footprint GetPointFootprint(uint32_t width, uint32_t height, uint32_t amountMipLevels, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy);
+	static Footprint GetTrilinearFootprint(uint32_t width, uint32_t height, uint32_t amountMipLevels, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy);
+	static Footprint GetAnisotropicFootprint(uint32_t width, uint32_t height, uint32_t amountMipLevels, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy);
+
+	// The top left texel of a bilinear probe, and the fixed point weights of its 2 texel rows, as (left, right) pairs of 16-bit lanes for _mm_madd_epi16
+	static void GetBilinearWeights(uint32_t levelWidth, uint32_t levelHeight, const Elite::FVector2& uv, int& x0, int& y0, __m128i& topWeights, __m128i& bottomWeights);
 
 private:
+	// A level of the mip chain, with its texels kept as RGBA8 in 4x4 blocks (64 bytes, so each block is a single cache line)
+	// A triangle samples a small 2D area of the texture, which this way only touches a few lines, no matter how it's rotated
+	// The BCn formats already come in 4x4 blocks, so those are simply kept compressed, in the same order
+	struct MipLevel
+	{
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t AmountBlocksX;
+		uint32_t* pTexels;
+		const uint8_t* pBlocks; // Instead of the texels, for the BCn formats
+	};
+
+	bool LoadImage(const char* filePath, ThreadPool& threadPool, std::vector<std::vector<uint32_t>>& levelPixels);
+	bool LoadDDS(const char* filePath, std::vector<std::vector<uint8_t>>& levelBlocks);
+	static void GenerateMipLevel(const uint32_t* pSource, uint32_t sourceWidth, uint32_t sourceHeight, uint32_t* pDestination, uint32_t width, uint32_t height, uint32_t firstRow,
+		uint32_t lastRow);
+	static void EncodeLevel(TextureFormat format, const uint32_t* pPixels, uint32_t width, uint32_t height, uint8_t* pBlocks, uint32_t firstBlockRow, uint32_t lastBlockRow);
+	static uint32_t GetAmountBands(uint32_t amountRows, const ThreadPool& threadPool);
+	static float GetLevelOfDetail(uint32_t width, uint32_t height, const Elite::FVector2& uvDx, const Elite::FVector2& uvDy);
+	static Footprint MakeFootprint(float lod, uint32_t amountMipLevels, uint32_t amountProbes, const Elite::FVector2& probeStep);
+	uint32_t GetTexel(const MipLevel& level, int x, int y) const;
+	uint32_t GetTexelIdx(const MipLevel& level, uint32_t x, uint32_t y) const;
+	uint32_t GetDecodedTexel(const MipLevel& level, uint32_t x, uint32_t y) const;
+	__m128i SampleBilinear(const MipLevel& level, const Elite::FVector2& uv) const;
+	Elite::FVector4 SampleFootprint(const Footprint& footprint, const Elite::FVector2& uv) const;
+
 	ID3D11Texture2D* m_pTexture;
 	ID3D11ShaderResourceView* m_pTexResourceView;
-	SDL_Surface* m_Resource;
-	uint32_t* m_ResourcePixel;
+	TextureFormat m_Format;
+
+	static const uint32_t m_BlockSize = 4;
+	static const uint32_t m_BorderTexel = 0xFFFF0000; // The samplers' BorderColor (opaque blue), in RGBA8
+	static const uint32_t m_MaxAnisotropy = 16; // The D3D11 default, since the effect doesn't set one
+	static const int m_WeightBits = 7; // The precision of the bilinear weights, so the product of 2 of them still fits in a 16-bit lane
+	std::vector<MipLevel> m_MipLevels;
+	uint32_t* m_pTexels; // The texels of every level, one level after the other
+	uint8_t* m_pBlocks; // Or their compressed blocks
 };
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "pch.h"
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(uint32_t amountThreads)
+	: m_Workers{}
+	, m_Mutex{}
+	, m_StartCondition{}
+	, m_DoneCondition{}
+	, m_pTask{ nullptr }
+	, m_pTaskFunction{ nullptr }
+	, m_AmountTasks{}
+	, m_NextTask{}
+	, m_Generation{}
+	, m_AmountBusyWorkers{}
+	, m_IsStopping{ false }
+{
+	// The calling thread also works on the tasks, so it only needs amountThreads - 1 extra workers
+	// (hardware_concurrency is allowed to return 0, in which case everything just runs on the calling thread)
+	for (uint32_t i = 1; i < amountThreads; i++)
+		m_Workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_IsStopping = true;
+	}
+	m_StartCondition.notify_all();
+
+	for (auto& worker : m_Workers)
+		worker.join();
+}
+
+void ThreadPool::Run(uint32_t amountTasks, const void* pTask, TaskFunction pTaskFunction)
+{
+	// Not worth waking anyone up for a single task
+	if (m_Workers.empty() || amountTasks <= 1)
+	{
+		for (uint32_t i = 0; i < amountTasks; i++)
+			pTaskFunction(pTask, i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_pTask = pTask;
+		m_pTaskFunction = pTaskFunction;
+		m_AmountTasks = amountTasks;
+		m_NextTask = 0;
+		m_AmountBusyWorkers = uint32_t(m_Workers.size());
+		m_Generation++;
+	}
+	m_StartCondition.notify_all();
+
+	// Help out while the workers are running
+	RunTasks();
+
+	// And wait for every worker to be done with this batch (so the task can safely go out of scope)
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_DoneCondition.wait(lock, [this]() { return m_AmountBusyWorkers == 0; });
+	m_pTask = nullptr;
+	m_pTaskFunction = nullptr;
+}
+
+void ThreadPool::WorkerLoop()
+{
+	uint32_t lastGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_StartCondition.wait(lock, [this, lastGeneration]() { return m_IsStopping || m_Generation != lastGeneration; });
+			if (m_IsStopping)
+				return;
+			lastGeneration = m_Generation;
+		}
+
+		RunTasks();
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_AmountBusyWorkers--;
+			if (m_AmountBusyWorkers == 0)
+				m_DoneCondition.notify_one();
+		}
+	}
+}
+
+void ThreadPool::RunTasks()
+{
+	// Each thread keeps grabbing the next free task index until there's none left
+	for (uint32_t i = m_NextTask++; i < m_AmountTasks; i = m_NextTask++)
+		m_pTaskFunction(m_pTask, i);
+}
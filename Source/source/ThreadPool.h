@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool final
+{
+public:
+	ThreadPool(uint32_t amountThreads = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool& other) = delete;
+	ThreadPool(ThreadPool&& other) noexcept = delete;
+	ThreadPool& operator=(const ThreadPool& other) = delete;
+	ThreadPool& operator=(ThreadPool&& other) noexcept = delete;
+
+	// Runs task(0) to task(amountTasks - 1) spread over all the threads (the calling one included) and only returns once every task is done
+	// The task is only referenced, never copied (unlike wrapping it in a std::function, this doesn't allocate)
+	template<typename Task>
+	void ParallelFor(uint32_t amountTasks, const Task& task)
+	{
+		Run(amountTasks, &task, [](const void* pTask, uint32_t taskIdx) { (*static_cast<const Task*>(pTask))(taskIdx); });
+	}
+
+	uint32_t GetAmountThreads() const { return uint32_t(m_Workers.size()) + 1; }
+
+private:
+	using TaskFunction = void(*)(const void* pTask, uint32_t taskIdx);
+
+	void Run(uint32_t amountTasks, const void* pTask, TaskFunction pTaskFunction);
+	void WorkerLoop();
+	void RunTasks();
+
+	std::vector<std::thread> m_Workers;
+	std::mutex m_Mutex;
+	std::condition_variable m_StartCondition;
+	std::condition_variable m_DoneCondition;
+
+	const void* m_pTask;
+	TaskFunction m_pTaskFunction;
+	uint32_t m_AmountTasks;
+	std::atomic<uint32_t> m_NextTask;
+	uint32_t m_Generation;
+	uint32_t m_AmountBusyWorkers;
+	bool m_IsStopping;
+};
@@ -7,6 +7,9 @@ TransparentMaterial::TransparentMaterial(ID3D11Device* pDevice, const std::wstri
 	, m_pLinearTechnique{}
 	, m_pAnisotropicTechnique{}
 	, m_pDiffuseMapVariable{}
+	, m_pCompositeTechnique{}
+	, m_pAccumulationMapVariable{}
+	, m_pRevealageMapVariable{}
 {
 	if (m_pEffect)
 	{
@@ -25,6 +28,18 @@ TransparentMaterial::TransparentMaterial(ID3D11Device* pDevice, const std::wstri
 		m_pDiffuseMapVariable = m_pEffect->GetVariableByName("gDiffuseMap")->AsShaderResource();
 		if (!m_pDiffuseMapVariable->IsValid())
 			std::wcout << L"m_pDiffuseMapVariable not valid\n";
+
+		m_pCompositeTechnique = m_pEffect->GetTechniqueByName("TransparentCompositeTechnique");
+		if (!m_pCompositeTechnique->IsValid())
+			std::wcout << L"Composite Technique not valid\n";
+
+		m_pAccumulationMapVariable = m_pEffect->GetVariableByName("gAccumulationMap")->AsShaderResource();
+		if (!m_pAccumulationMapVariable->IsValid())
+			std::wcout << L"m_pAccumulationMapVariable not valid\n";
+
+		m_pRevealageMapVariable = m_pEffect->GetVariableByName("gRevealageMap")->AsShaderResource();
+		if (!m_pRevealageMapVariable->IsValid())
+			std::wcout << L"m_pRevealageMapVariable not valid\n";
 	}
 	else
 	{
@@ -57,6 +72,24 @@ TransparentMaterial::~TransparentMaterial()
 		m_pDiffuseMapVariable->Release();
 		m_pDiffuseMapVariable = nullptr;
 	}
+
+	if (m_pCompositeTechnique)
+	{
+		m_pCompositeTechnique->Release();
+		m_pCompositeTechnique = nullptr;
+	}
+
+	if (m_pAccumulationMapVariable)
+	{
+		m_pAccumulationMapVariable->Release();
+		m_pAccumulationMapVariable = nullptr;
+	}
+
+	if (m_pRevealageMapVariable)
+	{
+		m_pRevealageMapVariable->Release();
+		m_pRevealageMapVariable = nullptr;
+	}
 }
 
 void TransparentMaterial::SetDiffuseMap(ID3D11ShaderResourceView* pResourceView) const
@@ -65,5 +98,21 @@ void TransparentMaterial::SetDiffuseMap(ID3D11ShaderResourceView* pResourceView)
 		m_pDiffuseMapVariable->SetResource(pResourceView);
 }
 
+void TransparentMaterial::Composite(ID3D11DeviceContext* pDeviceContext, ID3D11ShaderResourceView* pAccumulationView, ID3D11ShaderResourceView* pRevealageView) const
+{
+	if (!m_pCompositeTechnique->IsValid() || !m_pAccumulationMapVariable->IsValid() || !m_pRevealageMapVariable->IsValid())
+		return;
 
+	// The triangle's vertices are made up in the vertex shader, out of their index, so it needs no buffers at all
+	m_pAccumulationMapVariable->SetResource(pAccumulationView);
+	m_pRevealageMapVariable->SetResource(pRevealageView);
+	pDeviceContext->IASetInputLayout(nullptr);
+	pDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	m_pCompositeTechnique->GetPassByIndex(0)->Apply(0, pDeviceContext);
+	pDeviceContext->Draw(3, 0);
 
+	// Unbind the targets again, so they can be rendered to next frame
+	m_pAccumulationMapVariable->SetResource(nullptr);
+	m_pRevealageMapVariable->SetResource(nullptr);
+	m_pCompositeTechnique->GetPassByIndex(0)->Apply(0, pDeviceContext);
+}
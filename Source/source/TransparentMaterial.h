@@ -20,9 +20,15 @@ public:
 	ID3DX11EffectTechnique* GetLinearTechnique(CULL_MODE cullMode) const override { return m_pLinearTechnique; }
 	ID3DX11EffectTechnique* GetAnisotropicTechnique(CULL_MODE cullMode) const override { return m_pAnisotropicTechnique; }
 
+	// Blends the average of the accumulated transparent fragments over the render target that's bound, with a single full screen triangle
+	void Composite(ID3D11DeviceContext* pDeviceContext, ID3D11ShaderResourceView* pAccumulationView, ID3D11ShaderResourceView* pRevealageView) const;
+
 private:
 	ID3DX11EffectTechnique* m_pPointTechnique;
 	ID3DX11EffectTechnique* m_pLinearTechnique;
 	ID3DX11EffectTechnique* m_pAnisotropicTechnique;
 	ID3DX11EffectShaderResourceVariable* m_pDiffuseMapVariable;
+	ID3DX11EffectTechnique* m_pCompositeTechnique;
+	ID3DX11EffectShaderResourceVariable* m_pAccumulationMapVariable;
+	ID3DX11EffectShaderResourceVariable* m_pRevealageMapVariable;
 };
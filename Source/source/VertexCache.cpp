@@ -0,0 +1,168 @@
+#include "pch.h"
+#include "VertexCache.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Mesh.h"
+
+namespace
+{
+	// The LRU cache the triangle order gets scored against (bigger than the measured one, so the order also holds up on caches that are)
+	const uint32_t m_ScoreCacheSize = 32;
+
+	// How much it's worth to use a vertex now, from where it is in the cache and how many of its triangles are still left
+	float GetVertexScore(int32_t cachePosition, uint32_t amountRemainingTriangles)
+	{
+		// A vertex that's done with doesn't count at all
+		if (amountRemainingTriangles == 0)
+			return -1.f;
+
+		// The 3 vertices of the last triangle all get the same score, so the next one doesn't favor any of them
+		// and the ones after them are worth less the closer they get to being pushed out
+		float score = 0.f;
+		if (cachePosition >= 0)
+			score = (cachePosition < 3) ? 0.75f : powf(1.f - float(cachePosition - 3) / float(m_ScoreCacheSize - 3), 1.5f);
+
+		// And vertices with only a few triangles left get a boost, so they're finished off instead of being left behind (and having to be transformed again later)
+		return score + 2.f / sqrtf(float(amountRemainingTriangles));
+	}
+}
+
+void VertexCache::OptimizeTriangleOrder(Span<const Meshlet> meshlets, uint32_t amountVertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> remainingTriangles(amountVertices, 0);
+	std::vector<int32_t> cachePositions(amountVertices, -1);
+	std::vector<float> vertexScores(amountVertices, 0.f);
+	std::vector<uint32_t> cache{};
+	std::vector<uint32_t> newCache{};
+	std::vector<bool> triangleUsed{};
+	std::vector<uint32_t> reorderedIndices{};
+
+	for (const auto& meshlet : meshlets)
+	{
+		const uint32_t* pIndices = indices.data() + meshlet.FirstIndex;
+		const uint32_t amountTriangles = meshlet.AmountIndices / 3;
+
+		// Count how many of the meshlet's triangles use each vertex (they count themselves back down to 0, for the next meshlet)
+		for (uint32_t i = 0; i < amountTriangles * 3; ++i)
+			remainingTriangles[pIndices[i]]++;
+		for (uint32_t i = 0; i < amountTriangles * 3; ++i)
+			vertexScores[pIndices[i]] = GetVertexScore(-1, remainingTriangles[pIndices[i]]);
+
+		// Keep taking the triangle whose vertices are worth the most right now
+		// A meshlet has few enough triangles that going over all of them every time is cheaper than keeping track of which ones each vertex is in
+		triangleUsed.assign(amountTriangles, false);
+		reorderedIndices.clear();
+		cache.clear();
+		for (uint32_t step = 0; step < amountTriangles; ++step)
+		{
+			uint32_t bestTriangle = UINT32_MAX;
+			float bestScore = -FLT_MAX;
+			for (uint32_t t = 0; t < amountTriangles; ++t)
+			{
+				if (triangleUsed[t])
+					continue;
+
+				const float score = vertexScores[pIndices[t * 3]] + vertexScores[pIndices[t * 3 + 1]] + vertexScores[pIndices[t * 3 + 2]];
+				if (score > bestScore)
+				{
+					bestTriangle = t;
+					bestScore = score;
+				}
+			}
+
+			// Add it
+			triangleUsed[bestTriangle] = true;
+			const uint32_t* pTriangle = pIndices + bestTriangle * 3;
+			for (uint32_t corner = 0; corner < 3; ++corner)
+			{
+				reorderedIndices.push_back(pTriangle[corner]);
+				remainingTriangles[pTriangle[corner]]--;
+			}
+
+			// Its vertices move to the front of the cache, and the ones that fall off the back of it are out
+			newCache.clear();
+			for (uint32_t corner = 0; corner < 3; ++corner)
+			{
+				if (std::find(newCache.begin(), newCache.end(), pTriangle[corner]) == newCache.end())
+					newCache.push_back(pTriangle[corner]);
+			}
+			for (const uint32_t vertex : cache)
+			{
+				if (std::find(newCache.begin(), newCache.end(), vertex) != newCache.end())
+					continue;
+
+				if (newCache.size() < m_ScoreCacheSize)
+					newCache.push_back(vertex);
+				else
+				{
+					cachePositions[vertex] = -1;
+					vertexScores[vertex] = GetVertexScore(-1, remainingTriangles[vertex]);
+				}
+			}
+			cache.swap(newCache);
+
+			// And all that changed is the score of the vertices in it
+			for (uint32_t position = 0; position < cache.size(); ++position)
+			{
+				cachePositions[cache[position]] = int32_t(position);
+				vertexScores[cache[position]] = GetVertexScore(int32_t(position), remainingTriangles[cache[position]]);
+			}
+		}
+
+		// Put the triangles back in their new order (in the same range), and leave the cache empty for the next meshlet
+		std::copy(reorderedIndices.begin(), reorderedIndices.end(), indices.begin() + meshlet.FirstIndex);
+		for (const uint32_t vertex : cache)
+			cachePositions[vertex] = -1;
+	}
+}
+
+void VertexCache::OptimizeVertexOrder(std::vector<VS_INPUT>& vertices, std::vector<uint32_t>& indices)
+{
+	// Give each vertex its new index the first time it's used
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	std::vector<VS_INPUT> reorderedVertices{};
+	reorderedVertices.reserve(vertices.size());
+	for (const uint32_t index : indices)
+	{
+		if (remap[index] != UINT32_MAX)
+			continue;
+
+		remap[index] = uint32_t(reorderedVertices.size());
+		reorderedVertices.push_back(vertices[index]);
+	}
+
+	// The ones no triangle uses go at the end
+	for (uint32_t v = 0; v < vertices.size(); ++v)
+	{
+		if (remap[v] == UINT32_MAX)
+		{
+			remap[v] = uint32_t(reorderedVertices.size());
+			reorderedVertices.push_back(vertices[v]);
+		}
+	}
+
+	for (auto& index : indices)
+		index = remap[index];
+	vertices.swap(reorderedVertices);
+}
+
+float VertexCache::GetACMR(Span<const uint32_t> indices, uint32_t amountVertices)
+{
+	const uint32_t amountTriangles = indices.size() / 3;
+	if (amountTriangles == 0)
+		return 0.f;
+
+	// A vertex is in the cache until m_CacheSize other vertices have been put in after it (a hit doesn't move it, since it's a FIFO)
+	std::vector<uint32_t> cacheTimes(amountVertices, 0);
+	uint32_t cacheTime = 0;
+	for (const uint32_t index : indices)
+	{
+		if (cacheTimes[index] == 0 || cacheTime - cacheTimes[index] >= m_CacheSize)
+			cacheTimes[index] = ++cacheTime;
+	}
+
+	// Every vertex that went in was a miss
+	return float(cacheTime) / float(amountTriangles);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Span.h"
+
+struct VS_INPUT;
+struct Meshlet;
+
+namespace VertexCache
+{
+	// Entries of the FIFO post-transform cache the miss ratio gets measured with (what most GPUs have had, give or take)
+	static const uint32_t m_CacheSize = 16;
+
+	// Reorders the triangles inside each meshlet so their vertices get reused while they're still in the post-transform cache (Forsyth's algorithm)
+	// The meshlets keep their ranges, so each one is still culled and drawn as a whole
+	void OptimizeTriangleOrder(Span<const Meshlet> meshlets, uint32_t amountVertices, std::vector<uint32_t>& indices);
+
+	// Puts the vertices in the order the indices first use them, so fetching them walks through memory (instead of jumping around it)
+	void OptimizeVertexOrder(std::vector<VS_INPUT>& vertices, std::vector<uint32_t>& indices);
+
+	// Average cache miss ratio: vertices transformed per triangle, with a FIFO cache of m_CacheSize (3 without any reuse, 0.5 at best on a big grid)
+	float GetACMR(Span<const uint32_t> indices, uint32_t amountVertices);
+}